@@ -0,0 +1,170 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include <unordered_map>
+#include <sys/statvfs.h>
+#include "Config.hpp"
+#include "Metrics.hpp"
+#include "DataManager.hpp"
+#include "StorageRoots.hpp"
+#include "ErasureStore.hpp"
+
+namespace storage{
+    // 过载保护：限制同时进行的上传会话(第一个分片到最后一个分片之间)和排队等待压缩的文件数，
+    // 超过时新请求直接回503并附Retry-After，已开始的上传不受影响，使系统在高峰时降级而不是崩溃。
+    // 开始上传时还检查存储类别的配额(已登记用量加上进行中的上传)和磁盘保留空间，
+    // 在预分配之前就拒绝放不下的文件，并为新文件选定写入的根目录。只在事件循环线程中调用，压缩数由Metrics中的原子计数给出
+    class Admission{
+    public:
+        enum Verdict{ kAdmit, kBusy, kOverQuota, kNoSpace };
+
+        static Admission& GetAdmission()
+        {
+            static Admission admission;
+            return admission;
+        }
+
+        // 能否开始写入bytes字节的上传会话，不登记。用于在接收请求体之前提前拒绝
+        Verdict CanBegin(const string &key, DataManager::StorageClass c, uint64_t bytes) const
+        {
+            return Check(key, c, bytes, nullptr);
+        }
+
+        // 开始一个上传会话，预留配额并选定写入的根目录(纠删码存储的分片位置由对象名决定，不选择)，
+        // 返回kAdmit以外的值表示应拒绝
+        Verdict BeginUpload(const string &key, DataManager::StorageClass c, uint64_t bytes)
+        {
+            StorageRoots::Root *root = nullptr;
+            Verdict v = Check(key, c, bytes, &root);
+            if (v != kAdmit) return v;
+            auto it = uploads_.find(key);
+            if (it != uploads_.end()) Release(it->second);
+            Session &s = uploads_[key];
+            s = {MonotonicNs(), bytes, c, root};
+            reserved_[c] += bytes;
+            if (root) root->pending.fetch_add(1, std::memory_order_relaxed);
+            return kAdmit;
+        }
+
+        // 上传会话选定的根目录，会话不存在(如服务重启后继续上传)时返回nullptr
+        StorageRoots::Root *UploadRoot(const string &key) const
+        {
+            auto it = uploads_.find(key);
+            return it == uploads_.end() ? nullptr : it->second.root;
+        }
+
+        void TouchUpload(const string &key)
+        {
+            auto it = uploads_.find(key);
+            if (it != uploads_.end()) it->second.last_ns = MonotonicNs();
+        }
+
+        // 上传完成或放弃，文件登记后由DataManager的用量计入配额
+        void EndUpload(const string &key)
+        {
+            auto it = uploads_.find(key);
+            if (it == uploads_.end()) return;
+            Release(it->second);
+            uploads_.erase(it);
+        }
+
+        // 进行中的上传为该存储类别预留的字节数
+        uint64_t Reserved(DataManager::StorageClass c) const { return reserved_[c]; }
+        uint64_t Quota(DataManager::StorageClass c) const { return quota_[c]; }
+        uint64_t ReserveBytes() const { return reserve_; }
+
+        bool CompressionBacklogged() const
+        {
+            return Metrics::GetMetrics().Compressions().load(std::memory_order_relaxed) >= (int64_t)max_compress_backlog_;
+        }
+
+        // 客户端中途放弃的上传会话在空闲超时后不再占用名额，普通存储的暂存文件一并删除
+        void Sweep()
+        {
+            uint64_t now = MonotonicNs();
+            for (auto it = uploads_.begin(); it != uploads_.end();)
+            {
+                if (now - it->second.last_ns > idle_ns_)
+                {
+                    if (it->second.c == DataManager::kLow && it->second.root)
+                        remove((it->second.root->path + StorageInfo::kPartialDir + it->first).c_str());
+                    Release(it->second);
+                    it = uploads_.erase(it);
+                }
+                else ++it;
+            }
+        }
+
+        size_t Uploads() const { return uploads_.size(); }
+        std::atomic<uint64_t> &Shed() { return shed_; }     // 被拒绝的请求数
+
+        Admission(const Admission&) = delete;
+        Admission& operator=(const Admission&) = delete;
+
+    private:
+        Admission()
+        {
+            Config &cf = Config::GetConfigData();
+            max_uploads_ = cf.GetMaxUploadSessions();
+            max_compress_backlog_ = cf.GetMaxCompressBacklog();
+            idle_ns_ = (uint64_t)std::max(1, cf.GetHttpTimeout()) * 2 * 1000000000ull;
+            quota_[DataManager::kLow] = cf.GetLowStorageQuota();
+            quota_[DataManager::kDeep] = cf.GetDeepStorageQuota();
+            quota_[DataManager::kErasure] = cf.GetErasureStorageQuota();
+            temp_dir_ = cf.GetTemporaryFileDir();
+            reserve_ = cf.GetDiskReserveBytes();
+        }
+
+        struct Session{
+            uint64_t last_ns;                               // 最近一个分片的时间
+            uint64_t bytes;                                 // 预留的字节数
+            DataManager::StorageClass c;
+            StorageRoots::Root *root;                       // 文件最终写入的根目录，纠删码存储为nullptr
+        };
+
+        Verdict Check(const string &key, DataManager::StorageClass c, uint64_t bytes, StorageRoots::Root **root) const
+        {
+            // 深度存储和纠删码存储都在上传完成后由后台线程压缩、编码
+            bool staged = c != DataManager::kLow;
+            if (staged && CompressionBacklogged()) return kBusy;
+            auto it = uploads_.find(key);
+            if (it == uploads_.end() && uploads_.size() >= max_uploads_) return kBusy;
+
+            // 同一会话重新开始时不重复计算它自己的预留
+            uint64_t reserved = reserved_[c] - (it != uploads_.end() && it->second.c == c ? it->second.bytes : 0);
+            if (quota_[c] != 0 && DataManager::GetDataManager().GetUsage(c).bytes + reserved + bytes > quota_[c])
+                return kOverQuota;
+            // 预分配已占用了进行中上传的空间，只需与本次的大小比较。深度存储和纠删码存储先写入临时文件，
+            // 压缩后的大小未知，按原大小检查最终的根目录
+            struct statvfs vfs;
+            if (staged && statvfs(temp_dir_.c_str(), &vfs) == 0 && (uint64_t)vfs.f_bavail * vfs.f_frsize < bytes + reserve_)
+                return kNoSpace;
+            // 只检查时不选择，选择会推进得分相同的根目录间的轮流
+            if (c == DataManager::kErasure) return ErasureStore::GetErasureStore().Fits(bytes, reserve_) ? kAdmit : kNoSpace;
+            bool deep = c == DataManager::kDeep;
+            StorageRoots &roots = StorageRoots::GetStorageRoots();
+            if (root == nullptr) return roots.Fits(deep, bytes, reserve_) ? kAdmit : kNoSpace;
+            *root = roots.Pick(deep, bytes, reserve_);
+            if (*root == nullptr) return kNoSpace;
+            return kAdmit;
+        }
+
+        void Release(const Session &s)
+        {
+            reserved_[s.c] -= s.bytes;
+            if (s.root) s.root->pending.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+    private:
+        std::unordered_map<string, Session> uploads_;
+        uint64_t reserved_[DataManager::kClasses] = {};
+        uint64_t quota_[DataManager::kClasses];
+        string temp_dir_;
+        uint64_t reserve_;
+        size_t max_uploads_;
+        size_t max_compress_backlog_;
+        uint64_t idle_ns_;
+        std::atomic<uint64_t> shed_{0};
+    }; // class Admission
+}
@@ -1,12 +1,20 @@
 #pragma once
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <algorithm>
 #include "Util.hpp"
 
 using std::string;
 
 namespace storage{
     const char* Config_File = "Storage.conf";
+
+    // 一个存储根目录，通常是一块数据盘的挂载点
+    struct RootSpec{
+        string path;                     // 以'/'结尾
+        double weight;                   // 放置新文件时的权重
+    };
     
     // 用于读取云存储系统的配置文件信息
     class Config{
@@ -30,10 +38,58 @@ namespace storage{
             download_prefix_ = val["download_prefix"].asString();
             deep_storage_dir_ = val["deep_storage_dir"].asString();
             low_storage_dir_ = val["low_storage_dir"].asString();
+            // 多块盘时用low_storage_dirs/deep_storage_dirs列出各根目录，如[{"path": "/data1/low/", "weight": 1}]，
+            // 没有配置时只有low_storage_dir/deep_storage_dir一个根目录
+            low_storage_roots_ = ReadRoots(val["low_storage_dirs"], low_storage_dir_);
+            deep_storage_roots_ = ReadRoots(val["deep_storage_dirs"], deep_storage_dir_);
+            low_storage_dir_ = low_storage_roots_[0].path;
+            deep_storage_dir_ = deep_storage_roots_[0].path;
             storage_info_file_ = val["storage_info_file"].asString();
             bundle_format_ = val["bundle_format"].asInt();
             temporary_files_dir_ = val["temporary_files_dir"].asString();
             password_ = val["password"].asString();
+            reconcile_threads_ = val["reconcile_threads"].asInt();
+            if (reconcile_threads_ <= 0) reconcile_threads_ = std::max(1u, std::thread::hardware_concurrency());
+            session_timeout_ = val.get("session_timeout", 60 * 60 * 24).asInt();
+            max_sessions_ = val.get("max_sessions", 16384).asInt();
+            trace_slow_ms_ = val.get("trace_slow_ms", 200).asInt();
+            object_cache_bytes_ = val.get("object_cache_bytes", 64 << 20).asUInt64();
+            object_cache_max_object_ = val.get("object_cache_max_object", 1 << 20).asUInt64();
+            fd_cache_max_ = val.get("fd_cache_max", 1024).asUInt64();
+            fd_cache_ttl_ = val.get("fd_cache_ttl", 30).asInt();
+            global_upload_rate_ = val.get("global_upload_rate", 0).asUInt64();
+            global_download_rate_ = val.get("global_download_rate", 0).asUInt64();
+            client_upload_rate_ = val.get("client_upload_rate", 0).asUInt64();
+            client_download_rate_ = val.get("client_download_rate", 0).asUInt64();
+            max_connections_ = val.get("max_connections", 1024).asUInt64();
+            max_upload_sessions_ = val.get("max_upload_sessions", 256).asUInt64();
+            max_body_size_ = val.get("max_body_size", 64 << 20).asInt64();
+            max_headers_size_ = val.get("max_headers_size", 16384).asInt64();
+            http_timeout_ = val.get("http_timeout", 60).asInt();
+            compress_threads_ = val.get("compress_threads", 2).asInt();
+            max_compress_backlog_ = val.get("max_compress_backlog", 32).asUInt64();
+            retry_after_ = val.get("retry_after", 5).asInt();
+            low_storage_quota_ = val.get("low_storage_quota", 0).asUInt64();
+            deep_storage_quota_ = val.get("deep_storage_quota", 0).asUInt64();
+            disk_reserve_bytes_ = val.get("disk_reserve_bytes", 1 << 30).asUInt64();
+            tier_interval_ = val.get("tier_interval", 3600).asInt();
+            tier_cold_days_ = val.get("tier_cold_days", 30).asInt();
+            tier_hot_hits_ = val.get("tier_hot_hits", 20).asInt();
+            tier_hot_window_ = val.get("tier_hot_window", 24 * 60 * 60).asInt();
+            tier_rate_ = val.get("tier_rate", 8 << 20).asUInt64();
+            pack_dir_ = val.get("pack_dir", "./pack_storage/").asString();
+            pack_max_object_ = val.get("pack_max_object", 64 << 10).asUInt64();
+            pack_segment_bytes_ = val.get("pack_segment_bytes", 256 << 20).asUInt64();
+            pack_compact_ratio_ = val.get("pack_compact_ratio", 0.5).asDouble();
+            pack_compact_interval_ = val.get("pack_compact_interval", 600).asInt();
+            storage_fanout_levels_ = val.get("storage_fanout_levels", 2).asInt();
+            // 纠删码存储的各分片分散在ec_storage_dirs的不同目录(不同的盘)上，没有配置时不可用
+            ec_storage_roots_ = ReadRoots(val["ec_storage_dirs"], "");
+            ec_data_fragments_ = val.get("ec_data_fragments", 4).asInt();
+            ec_parity_fragments_ = val.get("ec_parity_fragments", 2).asInt();
+            ec_threads_ = val.get("ec_threads", 2).asInt();
+            ec_repair_interval_ = val.get("ec_repair_interval", 3600).asInt();
+            ec_storage_quota_ = val.get("ec_storage_quota", 0).asUInt64();
             return true;
         }
 
@@ -43,8 +99,14 @@ namespace storage{
 
         string GetDownLoadPrefix() { return download_prefix_; }
 
+        // 第一个深度存储根目录
         string GetDeepStorageDir() { return deep_storage_dir_; }
 
+        const std::vector<RootSpec> &GetLowStorageRoots() { return low_storage_roots_; }
+
+        const std::vector<RootSpec> &GetDeepStorageRoots() { return deep_storage_roots_; }
+
+        // 第一个普通存储根目录
         string GetLowStorageDir() { return low_storage_dir_; }
 
         string GetTemporaryFileDir() { return temporary_files_dir_; }
@@ -55,6 +117,86 @@ namespace storage{
 
         int GetBundleFormat() { return bundle_format_; }
 
+        int GetReconcileThreads() { return reconcile_threads_; }
+
+        int GetSessionTimeout() { return session_timeout_; }
+
+        int GetMaxSessions() { return max_sessions_; }
+
+        int GetTraceSlowMs() { return trace_slow_ms_; }
+
+        size_t GetObjectCacheBytes() { return object_cache_bytes_; }
+
+        size_t GetObjectCacheMaxObject() { return object_cache_max_object_; }
+
+        size_t GetFdCacheMax() { return fd_cache_max_; }
+
+        int GetFdCacheTtl() { return fd_cache_ttl_; }
+
+        size_t GetGlobalUploadRate() { return global_upload_rate_; }
+
+        size_t GetGlobalDownloadRate() { return global_download_rate_; }
+
+        size_t GetClientUploadRate() { return client_upload_rate_; }
+
+        size_t GetClientDownloadRate() { return client_download_rate_; }
+
+        size_t GetMaxConnections() { return max_connections_; }
+
+        size_t GetMaxUploadSessions() { return max_upload_sessions_; }
+
+        int64_t GetMaxBodySize() { return max_body_size_; }
+
+        int64_t GetMaxHeadersSize() { return max_headers_size_; }
+
+        int GetHttpTimeout() { return http_timeout_; }
+
+        int GetCompressThreads() { return compress_threads_; }
+
+        size_t GetMaxCompressBacklog() { return max_compress_backlog_; }
+
+        int GetRetryAfter() { return retry_after_; }
+
+        size_t GetLowStorageQuota() { return low_storage_quota_; }
+
+        size_t GetDeepStorageQuota() { return deep_storage_quota_; }
+
+        size_t GetDiskReserveBytes() { return disk_reserve_bytes_; }
+
+        int GetTierInterval() { return tier_interval_; }
+
+        int GetTierColdDays() { return tier_cold_days_; }
+
+        int GetTierHotHits() { return tier_hot_hits_; }
+
+        int GetTierHotWindow() { return tier_hot_window_; }
+
+        size_t GetTierRate() { return tier_rate_; }
+
+        string GetPackDir() { return pack_dir_; }
+
+        size_t GetPackMaxObject() { return pack_max_object_; }
+
+        size_t GetPackSegmentBytes() { return pack_segment_bytes_; }
+
+        double GetPackCompactRatio() { return pack_compact_ratio_; }
+
+        int GetPackCompactInterval() { return pack_compact_interval_; }
+
+        int GetStorageFanoutLevels() { return storage_fanout_levels_; }
+
+        const std::vector<RootSpec> &GetErasureRoots() { return ec_storage_roots_; }
+
+        int GetErasureDataFragments() { return ec_data_fragments_; }
+
+        int GetErasureParityFragments() { return ec_parity_fragments_; }
+
+        int GetErasureThreads() { return ec_threads_; }
+
+        int GetErasureRepairInterval() { return ec_repair_interval_; }
+
+        size_t GetErasureStorageQuota() { return ec_storage_quota_; }
+
         // 确保单例
         Config(const Config&) = delete;
         Config(const Config&&) = delete;
@@ -72,6 +214,20 @@ namespace storage{
             mylog::GetLogger("asynclogger")->Info("Get configure information successfully");
         }
         ~Config() = default;
+
+        static std::vector<RootSpec> ReadRoots(const Json::Value &list, const string &single)
+        {
+            std::vector<RootSpec> roots;
+            for (int i = 0; list.isArray() && i < (int)list.size(); i++)
+            {
+                string path = list[i]["path"].asString();
+                if (path.empty()) continue;
+                if (path.back() != '/') path += '/';
+                roots.push_back({path, std::max(0.0, list[i].get("weight", 1.0).asDouble())});
+            }
+            if (roots.empty() && !single.empty()) roots.push_back({single, 1.0});
+            return roots;
+        }
         
     private:
         int server_port_;
@@ -80,8 +236,50 @@ namespace storage{
         string download_prefix_;
         string deep_storage_dir_;
         string low_storage_dir_;
+        std::vector<RootSpec> low_storage_roots_;
+        std::vector<RootSpec> deep_storage_roots_;
         string temporary_files_dir_;
         string storage_info_file_;       // 记录已存储文件信息的文件的路径
         int bundle_format_;
+        int reconcile_threads_;          // 启动后后台核对文件时并行stat的线程数
+        int session_timeout_;            // 登录会话空闲多少秒后过期
+        int max_sessions_;               // 同时存在的登录会话上限
+        int trace_slow_ms_;              // 耗时超过该值的上传、下载请求会保存各阶段耗时
+        size_t object_cache_bytes_;      // 热点小文件内存缓存的容量
+        size_t object_cache_max_object_; // 超过该大小的文件不进入内存缓存
+        size_t fd_cache_max_;            // 下载时缓存的打开文件数上限，0表示不缓存
+        int fd_cache_ttl_;               // 缓存的fd在打开多少秒后关闭重开
+        size_t global_upload_rate_;      // 所有连接合计的上传(读)带宽，字节/秒，0表示不限
+        size_t global_download_rate_;    // 所有连接合计的下载(写)带宽
+        size_t client_upload_rate_;      // 每个客户端IP的上传带宽，由其各连接平分
+        size_t client_download_rate_;    // 每个客户端IP的下载带宽
+        size_t max_connections_;         // 连接数超过该值时新请求回503
+        size_t max_upload_sessions_;     // 同时进行的分片上传数上限
+        int64_t max_body_size_;          // 请求体(一个分片)的最大字节数
+        int64_t max_headers_size_;       // 请求头的最大字节数
+        int http_timeout_;               // 连接读写超时秒数
+        int compress_threads_;           // 每个深度存储根目录的压缩线程数
+        size_t max_compress_backlog_;    // 排队和正在压缩的文件数达到该值时拒绝新的深度存储上传
+        int retry_after_;                // 拒绝请求时Retry-After建议的秒数
+        size_t low_storage_quota_;       // 普通存储可使用的总字节数，0表示不限
+        size_t deep_storage_quota_;      // 深度存储可使用的总字节数(压缩后)，0表示不限
+        size_t disk_reserve_bytes_;      // 开始上传后磁盘至少还要剩余的字节数
+        int tier_interval_;              // 分层迁移每隔多少秒检查一次，0表示关闭
+        int tier_cold_days_;             // 普通存储的文件多少天没有被下载后压缩转入深度存储，0表示不转
+        int tier_hot_hits_;              // 深度存储的文件在tier_hot_window秒内被下载这么多次后解压转回普通存储，0表示不转
+        int tier_hot_window_;
+        size_t tier_rate_;               // 迁移时每秒最多处理的字节数(按未压缩大小)
+        string pack_dir_;                // 打包存储的段文件目录
+        size_t pack_max_object_;         // 不超过该大小的普通存储单分片上传追加到段文件中，0表示不打包
+        size_t pack_segment_bytes_;      // 段文件写到该大小后换新段
+        double pack_compact_ratio_;      // 已写满的段中仍被引用的数据低于该比例时整理
+        int pack_compact_interval_;      // 每隔多少秒检查一次是否需要整理，0表示不整理
+        int storage_fanout_levels_;      // 存储目录按文件名散列分几层子目录(0-3)，0表示不分层
+        std::vector<RootSpec> ec_storage_roots_;
+        int ec_data_fragments_;          // 纠删码的数据分片数k
+        int ec_parity_fragments_;        // 纠删码的校验分片数m，最多可同时丢失m个分片
+        int ec_threads_;                 // 纠删码编码线程数
+        int ec_repair_interval_;         // 每隔多少秒检查并修复一遍纠删码分片，0表示不修复
+        size_t ec_storage_quota_;        // 纠删码存储可使用的总字节数(按原文件大小)，0表示不限
     }; // class Config
 }
@@ -3,13 +3,29 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <ctime>
+#include <thread>
+#include <future>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <sys/stat.h>
 #include "Config.hpp"
+#include "MetaTable.hpp"
+#include "Namespace.hpp"
+#include "Listing.hpp"
+#include "SearchIndex.hpp"
+#include "Trace.hpp"
+#include "Fanout.hpp"
+#include "StorageRoots.hpp"
+#include "base64.h"
+#include "../log_system/logs_code/ThreadPool.hpp"
 
 namespace storage{
     // 存储文件的属性信息
     class StorageInfo{
     public:
-        bool NewStorageInfo(const string &storage_path)
+        // ns_path为文件在目录命名空间中的路径，为空时使用文件名
+        bool NewStorageInfo(const string &storage_path, const string &ns_path = "")
         {
             mylog::GetLogger("asynclogger")->Info("NewStorageInfo start");
             FileUtil fu(storage_path);
@@ -22,24 +38,63 @@ namespace storage{
             mtime_ = fu.LastMidifyTime();
             atime_ = fu.LastAccessTime();
             fsize_ = fu.FileSize();
+            osize_ = PlainSize(storage_path, fsize_);
             storage_path_ = storage_path;
-            url_ = Config::GetConfigData().GetDownLoadPrefix() + fu.FileName();
+            url_ = Config::GetConfigData().GetDownLoadPrefix() + (ns_path.empty() ? fu.FileName() : ns_path);
             mylog::GetLogger("asynclogger")->Info(
                 "download_url: %s, mtime: %s, atime: %s, fsize: %d",
                  url_.c_str(), ctime(&mtime_), ctime(&atime_), fsize_);
             mylog::GetLogger("asynclogger")->Info("NewStorageInfo end");
             return true;
         }
+
+        // 普通存储的文件原样保存，大小即内容长度；深度存储的文件压缩前的大小需由上传流程另行记录
+        static size_t PlainSize(const string &storage_path, size_t fsize)
+        {
+            return StorageRoots::GetStorageRoots().IsDeep(storage_path) ? kUnknownSize : fsize;
+        }
+
+        static constexpr size_t kUnknownSize = SIZE_MAX;
+
+        // 打包存储：小文件追加在段文件中，pack_高24位为段号(从1开始)，低40位为段内偏移，长度即fsize_
+        static uint64_t PackLocation(uint32_t segment, uint64_t offset) { return (uint64_t)segment << 40 | offset; }
+        bool Packed() const { return pack_ != 0; }
+        uint32_t PackSegment() const { return pack_ >> 40; }
+        uint64_t PackOffset() const { return pack_ & ((1ull << 40) - 1); }
+
+        static string PackSegmentPath(uint32_t segment)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "%06u.pack", segment);
+            return Config::GetConfigData().GetPackDir() + name;
+        }
+
+        // 纠删码存储：对象拆成k+m个分片分散在多块盘上，storage_path_为虚拟根目录下的对象名，分片位置见ErasureStore
+        static constexpr const char *kErasureRoot = "erasure:/";
+        bool Erasure() const { return storage_path_.compare(0, strlen(kErasureRoot), kErasureRoot) == 0; }
+        string ErasureName() const { return storage_path_.substr(strlen(kErasureRoot)); }
+
+        // 普通存储上传中的文件先写在根目录下的这个子目录中，最后一个分片写完后改名为最终路径，不是对象
+        static constexpr const char *kPartialDir = ".partial/";
     public:
         time_t mtime_;          // 文件修改时间
         time_t atime_;          // 文件访问时间
         size_t fsize_;          // 文件大小
-        string storage_path_;   // 文件存储路径
+        size_t osize_ = kUnknownSize; // 内容(压缩前)大小，kUnknownSize表示未知
+        string storage_path_;   // 文件存储路径，打包存储和纠删码存储的为虚拟路径，只用于区分对象
         string url_;            // 请求URL中的资源路径
+        uint64_t pack_ = 0;     // 打包存储的位置，0表示独立的文件
     }; // class StorageInfo
 
     class DataManager{
     public:
+        enum StorageClass{ kLow = 0, kDeep = 1, kErasure = 2, kClasses };
+
+        struct Usage{
+            uint64_t files;
+            uint64_t bytes;                                 // 磁盘上占用的字节数，深度存储为压缩后大小
+        };
+
         static DataManager& GetDataManager()
         {
             static DataManager data_manager;
@@ -60,6 +115,8 @@ namespace storage{
                 item["mtime_"] = (Json::Int64)e.mtime_;
                 item["atime_"] = (Json::Int64)e.atime_;
                 item["fsize_"] = (Json::Int64)e.fsize_;
+                if (e.osize_ != StorageInfo::kUnknownSize) item["osize_"] = (Json::UInt64)e.osize_;
+                if (e.pack_ != 0) item["pack_"] = (Json::UInt64)e.pack_;
                 item["storage_path_"] = e.storage_path_.c_str();
                 item["url_"] = e.url_.c_str();
                 root.append(item);
@@ -89,10 +146,18 @@ namespace storage{
 #ifdef DEBUG_LOG
             mylog::GetLogger("asynclogger")->DEBUG("data information insert start");
 #endif
+            TraceStages stage("insert.lock");
             pthread_rwlock_wrlock(&rwlock_);
-            table_[info.url_] = info;
+            stage.Next("insert.update");
+            bool ok = PutLocked(info);
             pthread_rwlock_unlock(&rwlock_);
+            if (!ok)
+            {
+                mylog::GetLogger("asynclogger")->Error("data information insert error: %s", info.url_.c_str());
+                return false;
+            }
             
+            stage.Next("insert.persist");
             // 在初始化阶段need_persist为false，此时不需要将table写入文件
             if (need_persist_ && !Storage())
             {
@@ -116,13 +181,14 @@ namespace storage{
         bool GetOneByURL(const string &url, StorageInfo *info)
         {
             pthread_rwlock_rdlock(&rwlock_);
-            if (table_.find(url) == table_.end())
+            uint32_t row = FindURLLocked(url);
+            if (row == MetaTable::npos)
             {
                 pthread_rwlock_unlock(&rwlock_);
                 mylog::GetLogger("asynclogger")->Error("can not find URL: %s", url.c_str());
                 return false;
             }
-            *info = table_[url];
+            ToInfo(row, info);
             pthread_rwlock_unlock(&rwlock_);
             mylog::GetLogger("asynclogger")->Info("URL: %s, get information successfully", url.c_str());
             return true;
@@ -131,11 +197,16 @@ namespace storage{
         bool GetOneByStoragePath(const string &path, StorageInfo *info)
         {
             pthread_rwlock_rdlock(&rwlock_);
-            for (auto e : table_)
+            // 目录前缀数量很少，逐个尝试前缀后按对象名查哈希表
+            const PathInterner &dirs = table_.Dirs();
+            for (uint32_t id = 0; id < dirs.Size(); id++)
             {
-                if (e.second.storage_path_ == path)
+                const string &dir = dirs.Get(id);
+                if (path.size() <= dir.size() || path.compare(0, dir.size(), dir) != 0) continue;
+                uint32_t row = table_.Find(std::string_view(path).substr(dir.size()));
+                if (row != MetaTable::npos && table_.DirId(row) == id)
                 {
-                    *info = e.second;
+                    ToInfo(row, info);
                     pthread_rwlock_unlock(&rwlock_);
                     mylog::GetLogger("asynclogger")->Info("Path: %s, get information successfully", path.c_str());
                     return true; 
@@ -149,10 +220,11 @@ namespace storage{
         bool GetAll(std::vector<StorageInfo> &vec)
         {
             pthread_rwlock_rdlock(&rwlock_);
-            for (auto e : table_)
-            {
-                vec.push_back(e.second);
-            }
+            vec.reserve(vec.size() + table_.Size());
+            table_.ForEach([&](uint32_t row){
+                vec.emplace_back();
+                ToInfo(row, &vec.back());
+            });
             pthread_rwlock_unlock(&rwlock_);
             return true;
         }
@@ -161,37 +233,311 @@ namespace storage{
         void Remove(const string &url)
         {
             pthread_rwlock_wrlock(&rwlock_);
-            table_.erase(url);
+            uint32_t row = FindURLLocked(url);
+            if (row != MetaTable::npos) EraseRowLocked(row);
             pthread_rwlock_unlock(&rwlock_);
             if (!Storage()) // 更新失败，程序能够正常运行，但是用户在浏览器中看到的文件列表可能过期
                 mylog::GetLogger("asynclogger")->Warn("Update %s failed, files list may expired", Config::GetConfigData().GetStorageInfoFile());
         }
 
-        // 更新文件信息，同时查看文件是否真实存在，若不存在需要删除该文件在table_中的信息并更新storage文件
-        void Update()
+        // 列出命名空间中prefix下的内容，参数含义见NamespaceIndex::List
+        bool List(const string &prefix, bool recursive, const string &after, size_t limit,
+                  std::vector<string> *folders, std::vector<StorageInfo> *files, bool *more)
+        {
+            std::vector<uint32_t> rows;
+            pthread_rwlock_rdlock(&rwlock_);
+            bool ok = ns_.List(prefix, recursive, after, limit, folders, &rows, more);
+            for (uint32_t row : rows)
+            {
+                files->emplace_back();
+                ToInfo(row, &files->back());
+            }
+            pthread_rwlock_unlock(&rwlock_);
+            return ok;
+        }
+
+        // 各存储类别已登记文件的数量和大小，随记录的增删改维护，不需要加锁或遍历
+        Usage GetUsage(StorageClass c) const
+        {
+            return {usage_[c].files.load(std::memory_order_relaxed), usage_[c].bytes.load(std::memory_order_relaxed)};
+        }
+
+        // 文件列表的版本，任何会改变列表内容的修改都会使其递增，用于生成列表的ETag
+        uint64_t ListingVersion() const { return version_.load(std::memory_order_relaxed); }
+
+        // 分页列出全部文件：sort为name、mtime或size，mtime与size前加'-'表示倒序；
+        // cursor为上一页返回的不透明游标，为空表示第一页；next_cursor为空表示没有下一页
+        bool Page(const string &sort, const string &cursor, size_t limit,
+                  std::vector<StorageInfo> *files, string *next_cursor)
+        {
+            bool desc = !sort.empty() && sort[0] == '-';
+            string key = desc ? sort.substr(1) : sort;
+            if (key != "name" && key != "mtime" && key != "size") return false;
+            if (key == "name" && desc) return false;
+
+            // 游标格式：排序字段 '\n' 上一页最后一项的排序键 '\n' 行号(按名字排序时为路径)
+            string after_key, after_row;
+            if (!cursor.empty())
+            {
+                string raw;
+                try { raw = base64_decode(cursor); }
+                catch (const std::exception &) { return false; }
+                size_t p1 = raw.find('\n');
+                if (p1 == string::npos || raw.substr(0, p1) != sort) return false;
+                size_t p2 = key == "name" ? string::npos : raw.find('\n', p1 + 1);
+                after_key = raw.substr(p1 + 1, p2 == string::npos ? string::npos : p2 - p1 - 1);
+                if (p2 != string::npos) after_row = raw.substr(p2 + 1);
+                if (key != "name" && after_row.empty()) return false;
+            }
+
+            std::vector<uint32_t> rows;
+            string last;
+            pthread_rwlock_rdlock(&rwlock_);
+            if (key == "name")
+            {
+                ns_.Scan(after_key, limit, &rows);
+                if (!rows.empty()) last = ns_.PathOf(rows.back());
+            }
+            else if (key == "mtime")
+            {
+                std::pair<uint32_t, uint32_t> after{strtoul(after_key.c_str(), nullptr, 10), strtoul(after_row.c_str(), nullptr, 10)}, end;
+                listing_.ByMtime().Page(cursor.empty() ? nullptr : &after, desc, limit, &rows, &end);
+                if (!rows.empty()) last = std::to_string(end.first) + "\n" + std::to_string(end.second);
+            }
+            else
+            {
+                std::pair<uint64_t, uint32_t> after{strtoull(after_key.c_str(), nullptr, 10), strtoul(after_row.c_str(), nullptr, 10)}, end;
+                listing_.BySize().Page(cursor.empty() ? nullptr : &after, desc, limit, &rows, &end);
+                if (!rows.empty()) last = std::to_string(end.first) + "\n" + std::to_string(end.second);
+            }
+            for (uint32_t row : rows)
+            {
+                files->emplace_back();
+                ToInfo(row, &files->back());
+            }
+            pthread_rwlock_unlock(&rwlock_);
+
+            next_cursor->clear();
+            if (rows.size() >= limit) *next_cursor = base64_encode(sort + "\n" + last, true);
+            return true;
+        }
+
+        size_t Size()
+        {
+            pthread_rwlock_rdlock(&rwlock_);
+            size_t n = table_.Size();
+            pthread_rwlock_unlock(&rwlock_);
+            return n;
+        }
+
+        size_t MetadataBytes()
+        {
+            pthread_rwlock_rdlock(&rwlock_);
+            size_t n = table_.MemoryBytes();
+            pthread_rwlock_unlock(&rwlock_);
+            return n;
+        }
+
+        // 按文件名搜索，结果按相关度排序
+        void Search(const string &query, size_t limit, std::vector<StorageInfo> *files)
+        {
+            std::vector<uint32_t> rows;
+            pthread_rwlock_rdlock(&rwlock_);
+            search_.Search(query, limit, &rows);
+            for (uint32_t row : rows)
+            {
+                files->emplace_back();
+                ToInfo(row, &files->back());
+            }
+            pthread_rwlock_unlock(&rwlock_);
+        }
+
+        // 文件被覆盖、删除或在磁盘上发生变化时的通知，参数为变化前的下载URL和存储路径。
+        // 回调在持有写锁时执行，必须很快返回且不能再调用DataManager
+        using ChangeListener = std::function<void(const string &url, const string &storage_path)>;
+        void AddChangeListener(ChangeListener f)
         {
             pthread_rwlock_wrlock(&rwlock_);
-            size_t old_size = table_.size();
-            for (auto it = table_.begin(); it != table_.end(); ) 
+            listeners_.push_back(std::move(f));
+            pthread_rwlock_unlock(&rwlock_);
+        }
+
+        // 把文件换到新的存储位置(如分层迁移)。只有记录在此期间没有被覆盖、删除或改名时才替换，返回是否替换
+        bool ReplaceIf(const StorageInfo &old_info, const StorageInfo &new_info)
+        {
+            std::vector<std::pair<StorageInfo, StorageInfo>> moves{{old_info, new_info}};
+            std::vector<bool> done;
+            ReplaceIf(moves, &done);
+            return done[0];
+        }
+
+        // 批量替换，最后只持久化一次。done[i]表示第i项是否替换
+        size_t ReplaceIf(const std::vector<std::pair<StorageInfo, StorageInfo>> &moves, std::vector<bool> *done)
+        {
+            size_t n = 0;
+            done->assign(moves.size(), false);
+            pthread_rwlock_wrlock(&rwlock_);
+            for (size_t i = 0; i < moves.size(); i++)
             {
-                FileUtil fu(it->second.storage_path_);
-                
-                if (!fu.Exists()) 
+                const StorageInfo &old_info = moves[i].first;
+                uint32_t row = FindURLLocked(old_info.url_);
+                if (row == MetaTable::npos) continue;
+                StorageInfo cur;
+                ToInfo(row, &cur);
+                if (cur.storage_path_ == old_info.storage_path_ && cur.pack_ == old_info.pack_ &&
+                    cur.mtime_ == old_info.mtime_ && cur.fsize_ == old_info.fsize_ && PutLocked(moves[i].second))
                 {
-                    it = table_.erase(it);
+                    (*done)[i] = true;
+                    n++;
                 }
-                else
-                {
-                    it->second.mtime_ = fu.LastMidifyTime();
-                    it->second.atime_ = fu.LastAccessTime();
-                    it->second.fsize_ = fu.FileSize();
-                    ++it;
-                }
-            }   
-            pthread_rwlock_unlock(&rwlock_); 
+            }
+            pthread_rwlock_unlock(&rwlock_);
+            if (n > 0 && !Storage())
+                mylog::GetLogger("asynclogger")->Warn("Update %s failed, files list may expired", storage_info_file_.c_str());
+            return n;
+        }
+
+        // 各打包段中仍被引用的字节数
+        void PackLiveBytes(std::unordered_map<uint32_t, uint64_t> *live)
+        {
+            pthread_rwlock_rdlock(&rwlock_);
+            table_.ForEach([&](uint32_t row){
+                uint64_t pack = table_.Pack(row);
+                if (pack != 0) (*live)[(uint32_t)(pack >> 40)] += table_.Fsize(row);
+            });
+            pthread_rwlock_unlock(&rwlock_);
+        }
+
+        // 存放在指定打包段中的对象
+        void PackedIn(uint32_t segment, std::vector<StorageInfo> *files)
+        {
+            pthread_rwlock_rdlock(&rwlock_);
+            table_.ForEach([&](uint32_t row){
+                if (table_.Pack(row) >> 40 != segment) return;
+                files->emplace_back();
+                ToInfo(row, &files->back());
+            });
+            pthread_rwlock_unlock(&rwlock_);
+        }
+
+        // 记下文件最近被下载的时间，atime_只会推后，随下一次持久化保存
+        void RecordAccess(const std::vector<std::pair<string, time_t>> &accesses)
+        {
+            pthread_rwlock_wrlock(&rwlock_);
+            for (auto &a : accesses)
+            {
+                uint32_t row = FindURLLocked(a.first);
+                if (row != MetaTable::npos && a.second > table_.Atime(row))
+                    table_.SetTimes(row, table_.Mtime(row), a.second);
+            }
+            pthread_rwlock_unlock(&rwlock_);
+        }
+
+        // 目录重命名只修改命名空间索引，文件的存储位置不变
+        bool RenameDir(const string &from, const string &to, string *err)
+        {
+            pthread_rwlock_wrlock(&rwlock_);
+            bool ok = ns_.RenameDir(from, to, err);
+            if (ok) version_++;
+            pthread_rwlock_unlock(&rwlock_);
+            if (ok && !Storage())
+                mylog::GetLogger("asynclogger")->Warn("Update %s failed, files list may expired", storage_info_file_.c_str());
+            return ok;
+        }
+
+        // 为上传到命名空间路径ns_path的文件选择对象名(存储目录下的相对路径)：
+        // 路径上已有对象时覆盖它；否则优先使用ns_path本身，若该名字已被重命名到别处的对象占用，
+        // 则放到以upload_id区分的子目录中，保证对象名与路径的最后一段相同
+        string StorageNameFor(const string &ns_path, const string &upload_id)
+        {
+            pthread_rwlock_rdlock(&rwlock_);
+            string name = Fanout::Prefix(ns_path) + ns_path;
+            uint32_t row = ns_.Lookup(ns_path);
+            if (row != NamespaceIndex::npos) name = string(table_.Name(row));
+            else if (table_.Find(name) != MetaTable::npos)
+            {
+                string unique = "~" + upload_id + "/" + ns_path;
+                name = Fanout::Prefix(unique) + unique;
+            }
+            pthread_rwlock_unlock(&rwlock_);
+            return name;
+        }
+
+        // 更新文件信息，同时查看文件是否真实存在，若不存在需要删除该文件在table_中的信息并更新storage文件
+        void Update()
+        {
+            Reconcile(false);
             if (!Storage()) // 更新失败，程序能够正常运行，但是用户在浏览器中看到的文件列表可能过期
                 mylog::GetLogger("asynclogger")->Warn("Update %s failed, files list may expired", Config::GetConfigData().GetStorageInfoFile());
         }
+
+        // 启动后台核对：服务器无需等待逐个stat所有文件即可开始服务。核对完成后把旧布局的文件迁入散列分层目录
+        void StartReconcile()
+        {
+            std::thread([this]{
+                auto start = std::chrono::steady_clock::now();
+                size_t changed = Reconcile(true);
+                if (changed > 0 && !Storage())
+                    mylog::GetLogger("asynclogger")->Warn("Update %s failed, files list may expired", storage_info_file_.c_str());
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+                mylog::GetLogger("asynclogger")->Info("background reconcile completed: %lu changes in %ld ms", changed, (long)ms);
+                if (Fanout::Levels() > 0)
+                {
+                    size_t moved = MigrateLayout();
+                    mylog::GetLogger("asynclogger")->Info("storage layout migration completed: %lu files moved", moved);
+                }
+            }).detach();
+        }
+
+        // 把不在散列分层目录中的文件移入：先建硬链接，元数据改指新路径后再删除旧路径，
+        // 迁移期间按旧路径的下载不受影响；记录在此期间变化的放弃迁移。URL不变。返回迁移的文件数
+        size_t MigrateLayout()
+        {
+            std::vector<StorageInfo> files;
+            GetAll(files);
+            size_t moved = 0;
+            std::vector<std::pair<StorageInfo, StorageInfo>> moves;
+            auto flush = [&]{
+                std::vector<bool> done;
+                moved += ReplaceIf(moves, &done);
+                for (size_t i = 0; i < moves.size(); i++)
+                {
+                    const string &stale = done[i] ? moves[i].first.storage_path_ : moves[i].second.storage_path_;
+                    unlink(stale.c_str());
+                    RemoveEmptyDirs(stale);
+                }
+                moves.clear();
+            };
+            for (auto &f : files)
+            {
+                if (f.Packed() || f.Erasure()) continue;
+                const string *root = nullptr;
+                for (auto &r : roots_)
+                    if (r != pack_dir_ && f.storage_path_.size() > r.size() && f.storage_path_.compare(0, r.size(), r) == 0) root = &r;
+                if (root == nullptr) continue;
+                string name = f.storage_path_.substr(root->size());
+                if (Fanout::Has(name)) continue;
+
+                StorageInfo to = f;
+                string to_name = Fanout::Prefix(name) + name;
+                to.storage_path_ = *root + to_name;
+                pthread_rwlock_rdlock(&rwlock_);
+                bool taken = table_.Find(to_name) != MetaTable::npos;
+                pthread_rwlock_unlock(&rwlock_);
+                if (taken) continue;
+                FileUtil(to.storage_path_.substr(0, to.storage_path_.find_last_of('/') + 1)).CreateDirectory();
+                unlink(to.storage_path_.c_str());           // 上次迁移中断留下的链接
+                if (link(f.storage_path_.c_str(), to.storage_path_.c_str()) == -1)
+                {
+                    mylog::GetLogger("asynclogger")->Warn("layout migration: link %s failed: %s", f.storage_path_.c_str(), strerror(errno));
+                    continue;
+                }
+                moves.emplace_back(f, to);
+                if (moves.size() == kMigrateBatch) flush();
+            }
+            flush();
+            return moved;
+        }
         // 确保单例
         DataManager(const DataManager&) = delete;
         DataManager(const DataManager&&) = delete;
@@ -203,6 +549,16 @@ namespace storage{
             mylog::GetLogger("asynclogger")->Info("DataManager construct start");
             // 获取已存储的文件的信息
             storage_info_file_ = Config::GetConfigData().GetStorageInfoFile();
+            download_prefix_ = Config::GetConfigData().GetDownLoadPrefix();
+            for (auto &r : StorageRoots::GetStorageRoots().Roots())
+            {
+                roots_.push_back(r->path);
+                if (r->deep) deep_dirs_.push_back(r->path);
+            }
+            pack_dir_ = Config::GetConfigData().GetPackDir();
+            roots_.push_back(pack_dir_);
+            roots_.push_back(StorageInfo::kErasureRoot);
+            stat_pool_.reset(new ThreadPool(Config::GetConfigData().GetReconcileThreads()));
             pthread_rwlock_init(&rwlock_, nullptr);
             need_persist_ = false;
             InitLoad();
@@ -236,91 +592,284 @@ namespace storage{
                 return false;
             }
 
+            // 只加载元数据，与磁盘的核对交给StartReconcile在后台完成
             for (int i = 0; i < val.size(); i++)
             {
                 StorageInfo info;
-                info.atime_ = val[i]["atime_"].asInt();
-                info.mtime_ = val[i]["mtime_"].asInt();
-                info.fsize_ = val[i]["fsize_"].asInt();
+                info.atime_ = val[i]["atime_"].asInt64();
+                info.mtime_ = val[i]["mtime_"].asInt64();
+                info.fsize_ = val[i]["fsize_"].asInt64();
                 info.storage_path_ = val[i]["storage_path_"].asString();
+                info.osize_ = val[i].isMember("osize_") ? val[i]["osize_"].asUInt64() : StorageInfo::PlainSize(info.storage_path_, info.fsize_);
                 info.url_ = val[i]["url_"].asString();
+                info.pack_ = val[i].get("pack_", 0).asUInt64();
                 Insert(info);
             }
-            // 更新文件信息
-            Update();
- 
+
+            pthread_rwlock_rdlock(&rwlock_);
+            size_t count = table_.Size(), bytes = table_.MemoryBytes();
+            pthread_rwlock_unlock(&rwlock_);
+            mylog::GetLogger("asynclogger")->Info("metadata: %lu objects, %lu bytes in memory", count, bytes);
             mylog::GetLogger("asynclogger")->Info("init data manager completed");
             return true;
         }
 
-    private:
-        string storage_info_file_;
-        pthread_rwlock_t rwlock_;
-        std::unordered_map<string, StorageInfo> table_;
-        bool need_persist_;                                 // 用于避免在初始化的使用调用Insert重复将刚读取到的信息写入文件中
-    }; // class DataManager
-
-    class LoginManager{
-    public:
-        static LoginManager& GetLoginManager()
+        // 用stat线程池并行核对table_中的文件：更新属性、删除已不存在的记录；
+        // scan为true时还会扫描存储目录，收录不在table_中的文件。返回发生变化的记录数
+        size_t Reconcile(bool scan)
         {
-            static LoginManager login_manager;
-            return login_manager;
-        }
-
-        const std::unordered_map<string, time_t> GetAllIp() 
-        { 
+            struct Item{
+                string name;
+                string path;                                // 打包存储的为段文件
+                uint32_t dir;
+                uint64_t pack_end;                          // 打包存储的对象在段中的结束位置，0表示独立文件
+                time_t mtime;                               // 快照时记录中的属性，应用结果时不同说明期间被重新写入
+                uint64_t fsize;
+                bool exists;
+                struct stat st;
+            };
+            std::vector<Item> items;
             pthread_rwlock_rdlock(&rwlock_);
-            auto ret = ip_register_;
+            items.reserve(table_.Size());
+            table_.ForEach([&](uint32_t row){
+                if (table_.Dir(row) == StorageInfo::kErasureRoot) return;    // 分片的完整性由ErasureStore的修复检查
+                uint64_t pack = table_.Pack(row);
+                if (pack == 0) items.push_back(Item{string(table_.Name(row)), StoragePath(row), table_.DirId(row), 0,
+                                                    table_.Mtime(row), table_.Fsize(row), false, {}});
+                else items.push_back(Item{string(table_.Name(row)), StorageInfo::PackSegmentPath(pack >> 40), table_.DirId(row),
+                                          (pack & ((1ull << 40) - 1)) + table_.Fsize(row), table_.Mtime(row), table_.Fsize(row), false, {}});
+            });
             pthread_rwlock_unlock(&rwlock_);
-            return ip_register_;
-        }
 
-        bool CheckLoggedIn(const string &ip) 
-        { 
-            pthread_rwlock_rdlock(&rwlock_);
-            bool ret = ip_register_.find(ip) != ip_register_.end();
-            pthread_rwlock_unlock(&rwlock_);
-            return ret;
-        }
+            // 按线程数分段并行stat，锁外进行
+            size_t workers = Config::GetConfigData().GetReconcileThreads();
+            size_t step = (items.size() + workers - 1) / workers;
+            std::vector<std::future<void>> futs;
+            for (size_t begin = 0; begin < items.size(); begin += step)
+            {
+                size_t end = std::min(items.size(), begin + step);
+                futs.push_back(stat_pool_->enqueue([&items, begin, end]{
+                    for (size_t i = begin; i < end; i++)
+                        items[i].exists = FileUtil(items[i].path).GetStat(&items[i].st) &&
+                                          (uint64_t)items[i].st.st_size >= items[i].pack_end;
+                }));
+            }
+            for (auto &f : futs) f.wait();
 
-        void Login(const string &ip)
-        {
+            // 应用结果，跳过核对期间已被修改或删除的记录
+            size_t changed = 0;
             pthread_rwlock_wrlock(&rwlock_);
-            ip_register_[ip] = time(nullptr);
+            for (auto &item : items)
+            {
+                uint32_t row = table_.Find(item.name);
+                if (row == MetaTable::npos || table_.DirId(row) != item.dir ||
+                    table_.Mtime(row) != item.mtime || table_.Fsize(row) != item.fsize) continue;
+                if (!item.exists)
+                {
+                    EraseRowLocked(row);
+                    changed++;
+                    continue;
+                }
+                if (item.pack_end != 0) continue;           // 段文件的属性不是对象的属性
+                bool changed_on_disk = table_.Mtime(row) != item.st.st_mtime || table_.Fsize(row) != (uint64_t)item.st.st_size;
+                AccountLocked(row, -1);
+                if (changed_on_disk)
+                {
+                    NotifyLocked(row);
+                    listing_.Remove(row, table_.Mtime(row), table_.Fsize(row));
+                    listing_.Add(row, item.st.st_mtime, item.st.st_size);
+                    version_++;
+                    changed++;
+                }
+                // 下载时记录的访问时间可能比文件系统的atime新(如noatime挂载)
+                table_.SetTimes(row, item.st.st_mtime, std::max<time_t>(table_.Atime(row), item.st.st_atime));
+                table_.SetFsize(row, item.st.st_size);
+                if (changed_on_disk) table_.SetOsize(row, StorageInfo::PlainSize(item.path, item.st.st_size));
+                AccountLocked(row, 1);
+            }
             pthread_rwlock_unlock(&rwlock_);
+            if (!scan) return changed;
+
+            // 收录存储目录中未登记的文件
+            for (const string &dir : roots_)
+            {
+                if (dir == pack_dir_ || dir == StorageInfo::kErasureRoot) continue;    // 段文件、分片不是对象
+                std::vector<string> paths;
+                if (!FileUtil(dir).Exists() || !FileUtil(dir).ScanDirectory(&paths, true)) continue;
+                for (auto &path : paths)
+                {
+                    if (path.size() <= dir.size() || path.compare(0, dir.size(), dir) != 0) continue;
+                    // 未登记的文件以其相对路径(去掉散列分层目录)作为命名空间路径，路径已被占用时跳过
+                    string name = path.substr(dir.size());
+                    if (name.compare(0, strlen(StorageInfo::kPartialDir), StorageInfo::kPartialDir) == 0) continue;    // 未完成的上传
+                    string ns(Fanout::Strip(name));
+                    pthread_rwlock_rdlock(&rwlock_);
+                    bool tracked = table_.Find(name) != MetaTable::npos || ns_.Lookup(ns) != NamespaceIndex::npos;
+                    pthread_rwlock_unlock(&rwlock_);
+                    if (tracked || !NamespaceIndex::ValidPath(ns)) continue;
+
+                    StorageInfo info;
+                    if (!info.NewStorageInfo(path, ns)) continue;
+                    pthread_rwlock_wrlock(&rwlock_);
+                    PutLocked(info);
+                    pthread_rwlock_unlock(&rwlock_);
+                    mylog::GetLogger("asynclogger")->Info("reconcile: found untracked file %s", path.c_str());
+                    changed++;
+                }
+            }
+            return changed;
         }
 
-        void LogOut(const string &ip)
+        // 拆分info：url = download_prefix + ns(命名空间路径)，storage_path = dir + name，
+        // dir取最长的存储根目录前缀，name为对象名，二者的最后一段必须相同
+        bool SplitInfo(const StorageInfo &info, std::string_view *ns, std::string_view *name, std::string_view *dir)
         {
-            pthread_rwlock_wrlock(&rwlock_);
-            ip_register_.erase(ip);
-            pthread_rwlock_unlock(&rwlock_);
+            if (info.url_.size() <= download_prefix_.size() ||
+                info.url_.compare(0, download_prefix_.size(), download_prefix_) != 0) return false;
+            *ns = std::string_view(info.url_).substr(download_prefix_.size());
+
+            std::string_view path(info.storage_path_);
+            size_t dir_len = 0;
+            for (auto &root : roots_)
+                if (root.size() > dir_len && path.size() > root.size() && path.substr(0, root.size()) == root)
+                    dir_len = root.size();
+            if (dir_len == 0)
+            {
+                size_t pos = path.find_last_of('/');
+                dir_len = pos == std::string_view::npos ? 0 : pos + 1;
+            }
+            *dir = path.substr(0, dir_len);
+            *name = path.substr(dir_len);
+            return NamespaceIndex::ValidPath(*ns) && !name->empty() &&
+                   NamespaceIndex::BaseName(*ns) == NamespaceIndex::BaseName(*name);
         }
 
-        void UpdateLoginTime(const string ip)
+        // 写入一条记录并登记到命名空间，调用前需持有写锁。路径已被其他对象占用时替换之
+        bool PutLocked(const StorageInfo &info)
         {
-            if (ip_register_.find(ip) == ip_register_.end()) return;
-            pthread_rwlock_wrlock(&rwlock_);
-            ip_register_[ip] = time(nullptr);
-            pthread_rwlock_unlock(&rwlock_);
+            std::string_view ns, name, dir;
+            if (!SplitInfo(info, &ns, &name, &dir))
+            {
+                mylog::GetLogger("asynclogger")->Error("url %s does not match storage path %s",
+                    info.url_.c_str(), info.storage_path_.c_str());
+                return false;
+            }
+
+            uint32_t row = table_.Find(name);
+            bool is_new = row == MetaTable::npos;
+            if (!is_new) NotifyLocked(row);
+            uint32_t old = ns_.Lookup(ns);
+            if (old != NamespaceIndex::npos && old != row) EraseRowLocked(old);
+            if (row != MetaTable::npos)
+            {
+                listing_.Remove(row, table_.Mtime(row), table_.Fsize(row));
+                AccountLocked(row, -1);
+            }
+
+            row = table_.Upsert(dir, name, info.mtime_, info.atime_, info.fsize_, info.osize_, info.pack_);
+            if (row == MetaTable::npos) return false;
+            version_++;
+            if (ns_.Contains(row) && ns_.PathOf(row) != ns) ns_.Remove(row);
+            if (!ns_.Contains(row) && !ns_.Add(ns, row))
+            {
+                table_.Erase(string(name));
+                return false;
+            }
+            AccountLocked(row, 1);
+            listing_.Add(row, table_.Mtime(row), table_.Fsize(row));
+            if (is_new) search_.Add(row);
+            return true;
         }
 
-        // 清理掉最后登录时间超过一天的IP信息
-        void UpdateRegister()
+        // 删除文件后清理变空的上级目录，直到存储根目录
+        void RemoveEmptyDirs(const string &path)
         {
-            time_t now = time(nullptr);
-            for (auto it = ip_register_.begin(); it != ip_register_.end();)
+            string dir = path.substr(0, path.find_last_of('/'));
+            for (auto &root : roots_)
             {
-                if ((now - it->second) > 60 * 60 *24) ip_register_.erase(it->first);
-                else it++;
+                if (dir.size() <= root.size() || dir.compare(0, root.size(), root) != 0) continue;
+                while (dir.size() > root.size() && rmdir(dir.c_str()) == 0)
+                    dir.erase(dir.find_last_of('/'));
+                return;
             }
         }
+
+        void EraseRowLocked(uint32_t row)
+        {
+            NotifyLocked(row);
+            AccountLocked(row, -1);
+            listing_.Remove(row, table_.Mtime(row), table_.Fsize(row));
+            search_.Remove(row);
+            ns_.Remove(row);
+            table_.Erase(string(table_.Name(row)));
+            version_++;
+        }
+
+        // 把一条记录计入(sign为1)或移出(sign为-1)其存储类别的用量，修改记录的大小或目录前后各调用一次
+        void AccountLocked(uint32_t row, int sign)
+        {
+            const string &dir = table_.Dir(row);
+            StorageClass c = kLow;
+            if (dir == StorageInfo::kErasureRoot) c = kErasure;
+            else if (std::find(deep_dirs_.begin(), deep_dirs_.end(), dir) != deep_dirs_.end()) c = kDeep;
+            ClassUsage &u = usage_[c];
+            u.files.fetch_add((uint64_t)(int64_t)sign, std::memory_order_relaxed);
+            u.bytes.fetch_add((uint64_t)((int64_t)sign * (int64_t)table_.Fsize(row)), std::memory_order_relaxed);
+        }
+
+        void NotifyLocked(uint32_t row)
+        {
+            if (listeners_.empty()) return;
+            string url = ns_.Contains(row) ? download_prefix_ + ns_.PathOf(row) : "";
+            string path = StoragePath(row);
+            for (auto &f : listeners_) f(url, path);
+        }
+
+        uint32_t FindURLLocked(const string &url)
+        {
+            if (url.size() <= download_prefix_.size() || url.compare(0, download_prefix_.size(), download_prefix_) != 0)
+                return MetaTable::npos;
+            return ns_.Lookup(std::string_view(url).substr(download_prefix_.size()));
+        }
+
+        string StoragePath(uint32_t row)
+        {
+            string path = table_.Dir(row);
+            path.append(table_.Name(row));
+            return path;
+        }
+
+        void ToInfo(uint32_t row, StorageInfo *info)
+        {
+            info->mtime_ = table_.Mtime(row);
+            info->atime_ = table_.Atime(row);
+            info->fsize_ = table_.Fsize(row);
+            info->osize_ = table_.Osize(row);
+            info->storage_path_ = StoragePath(row);
+            info->url_ = download_prefix_ + ns_.PathOf(row);
+            info->pack_ = table_.Pack(row);
+        }
+
     private:
-        LoginManager(){ pthread_rwlock_init(&rwlock_, nullptr); }
-        ~LoginManager() { pthread_rwlock_destroy(&rwlock_); }
-    private:
-        std::unordered_map<string, time_t> ip_register_;    // 用于记录服务器启动以来登录过的IP地址及其登录时间
+        string storage_info_file_;
+        string download_prefix_;
         pthread_rwlock_t rwlock_;
-    };
+        std::vector<string> roots_;                         // 存储根目录，用于从存储路径中拆出对象名
+        std::vector<string> deep_dirs_;                     // 目录为其中之一的记录属于深度存储
+        string pack_dir_;                                   // 打包存储的段文件所在目录
+        struct ClassUsage{
+            std::atomic<uint64_t> files{0};
+            std::atomic<uint64_t> bytes{0};
+        };
+        ClassUsage usage_[kClasses];                        // 写锁内修改，读取不需要锁
+        MetaTable table_;                                   // 紧凑存放的文件元数据，键为对象名
+        NamespaceIndex ns_{&table_};                        // 目录命名空间：路径 -> table_行号
+        ListingIndex listing_;                              // 按修改时间、大小排序的分页索引
+        SearchIndex search_{&table_};                       // 文件名前缀与三元组搜索索引
+        std::atomic<uint64_t> version_{0};                  // 文件列表版本
+        std::unique_ptr<ThreadPool> stat_pool_;             // 核对文件时并行执行stat的线程池
+        std::vector<ChangeListener> listeners_;             // 文件变化的订阅者，如下载缓存
+        static constexpr size_t kMigrateBatch = 1024;      // 迁移时每批更新的记录数，每批持久化一次
+        bool need_persist_;                                 // 用于避免在初始化的使用调用Insert重复将刚读取到的信息写入文件中
+    }; // class DataManager
 }
\ No newline at end of file
@@ -0,0 +1,272 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STORAGE_EC_X86 1
+#endif
+
+namespace storage{
+    // GF(2^8)上的乘法，本原多项式x^8+x^4+x^3+x^2+1(0x11d)
+    class GF256{
+    public:
+        static uint8_t Mul(uint8_t a, uint8_t b) { return Tables().mul[a][b]; }
+
+        static uint8_t Inv(uint8_t a) { return Tables().exp[255 - Tables().log[a]]; }
+
+        // dst ^= c * src，按CPU支持的指令集选择实现
+        static void MulAdd(uint8_t c, const uint8_t *src, uint8_t *dst, size_t len)
+        {
+            if (c == 0) return;
+            Kernel().fn(Tables().nibble[c], src, dst, len);
+        }
+
+        // 当前使用的实现："avx2"、"ssse3"或"scalar"
+        static const char *KernelName() { return Kernel().name; }
+
+        // 改用指定的实现(用于基准测试对比)，CPU不支持时返回false
+        static bool SetKernel(const char *name)
+        {
+            for (auto &k : Kernels())
+                if (strcmp(k.name, name) == 0 && k.supported())
+                {
+                    Kernel() = k;
+                    return true;
+                }
+            return false;
+        }
+
+    private:
+        using KernelFn = void (*)(const uint8_t *tbl, const uint8_t *src, uint8_t *dst, size_t len);
+        struct KernelInfo{
+            const char *name;
+            KernelFn fn;
+            bool (*supported)();
+        };
+
+        struct GFTables{
+            uint8_t exp[512];
+            uint8_t log[256];
+            uint8_t mul[256][256];
+            // nibble[c]的前16字节为c乘以0-15，后16字节为c乘以0x00-0xf0，c*x = 低4位查前表 ^ 高4位查后表
+            uint8_t nibble[256][32];
+
+            GFTables()
+            {
+                unsigned x = 1;
+                for (int i = 0; i < 255; i++)
+                {
+                    exp[i] = exp[i + 255] = (uint8_t)x;
+                    log[x] = (uint8_t)i;
+                    x <<= 1;
+                    if (x & 0x100) x ^= 0x11d;
+                }
+                exp[510] = exp[511] = exp[0];
+                log[0] = 0;
+                for (int a = 0; a < 256; a++)
+                    for (int b = 0; b < 256; b++)
+                        mul[a][b] = (a == 0 || b == 0) ? 0 : exp[log[a] + log[b]];
+                for (int c = 0; c < 256; c++)
+                    for (int i = 0; i < 16; i++)
+                    {
+                        nibble[c][i] = mul[c][i];
+                        nibble[c][16 + i] = mul[c][i << 4];
+                    }
+            }
+        };
+
+        static const GFTables &Tables()
+        {
+            static const GFTables tables;
+            return tables;
+        }
+
+        static void MulAddScalar(const uint8_t *tbl, const uint8_t *src, uint8_t *dst, size_t len)
+        {
+            for (size_t i = 0; i < len; i++)
+                dst[i] ^= tbl[src[i] & 0x0f] ^ tbl[16 + (src[i] >> 4)];
+        }
+
+#ifdef STORAGE_EC_X86
+        // 以pshufb同时查16个字节的4位表，每次处理16字节
+        __attribute__((target("ssse3")))
+        static void MulAddSsse3(const uint8_t *tbl, const uint8_t *src, uint8_t *dst, size_t len)
+        {
+            const __m128i lo = _mm_loadu_si128((const __m128i *)tbl);
+            const __m128i hi = _mm_loadu_si128((const __m128i *)(tbl + 16));
+            const __m128i mask = _mm_set1_epi8(0x0f);
+            size_t i = 0;
+            for (; i + 16 <= len; i += 16)
+            {
+                __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+                __m128i p = _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(s, mask)),
+                                          _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+                _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i *)(dst + i)), p));
+            }
+            MulAddScalar(tbl, src + i, dst + i, len - i);
+        }
+
+        // vpshufb在每个128位通道内查表，两个通道放同一张表，每次处理64字节
+        __attribute__((target("avx2")))
+        static void MulAddAvx2(const uint8_t *tbl, const uint8_t *src, uint8_t *dst, size_t len)
+        {
+            const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)tbl));
+            const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(tbl + 16)));
+            const __m256i mask = _mm256_set1_epi8(0x0f);
+            size_t i = 0;
+            for (; i + 64 <= len; i += 64)
+            {
+                __m256i s0 = _mm256_loadu_si256((const __m256i *)(src + i));
+                __m256i s1 = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+                __m256i p0 = _mm256_xor_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(s0, mask)),
+                                              _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s0, 4), mask)));
+                __m256i p1 = _mm256_xor_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(s1, mask)),
+                                              _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s1, 4), mask)));
+                _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(dst + i)), p0));
+                _mm256_storeu_si256((__m256i *)(dst + i + 32), _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(dst + i + 32)), p1));
+            }
+            for (; i + 32 <= len; i += 32)
+            {
+                __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+                __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask)),
+                                             _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+                _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(dst + i)), p));
+            }
+            MulAddScalar(tbl, src + i, dst + i, len - i);
+        }
+#endif
+
+        static const std::vector<KernelInfo> &Kernels()
+        {
+            static const std::vector<KernelInfo> kernels = {
+#ifdef STORAGE_EC_X86
+                {"avx2", MulAddAvx2, []{ return (bool)__builtin_cpu_supports("avx2"); }},
+                {"ssse3", MulAddSsse3, []{ return (bool)__builtin_cpu_supports("ssse3"); }},
+#endif
+                {"scalar", MulAddScalar, []{ return true; }},
+            };
+            return kernels;
+        }
+
+        // 启动时选第一个CPU支持的实现
+        static KernelInfo &Kernel()
+        {
+            static KernelInfo kernel = []{
+                for (auto &k : Kernels())
+                    if (k.supported()) return k;
+                return Kernels().back();
+            }();
+            return kernel;
+        }
+    }; // class GF256
+
+    // 系统化的Reed-Solomon码：k个数据分片即原数据，m个校验分片由编码矩阵的Cauchy部分算出，
+    // 任意k个分片都能恢复全部数据(要求k+m<=256)。只做内存中的计算，分片的存放见ErasureStore
+    class ReedSolomon{
+    public:
+        ReedSolomon(int k, int m) : k_(k), m_(m), matrix_((size_t)(k + m) * k)
+        {
+            for (int r = 0; r < k; r++) matrix_[(size_t)r * k + r] = 1;
+            // 第k+r行第c列为1/(x_r ^ y_c)，x_r = k+r，y_c = c，各x、y互不相同
+            for (int r = 0; r < m; r++)
+                for (int c = 0; c < k; c++)
+                    matrix_[(size_t)(k + r) * k + c] = GF256::Inv((uint8_t)((k + r) ^ c));
+        }
+
+        int K() const { return k_; }
+        int M() const { return m_; }
+
+        // 由k个数据分片算出m个校验分片，各分片长len字节
+        void Encode(const uint8_t *const *data, uint8_t *const *parity, size_t len) const
+        {
+            for (int r = 0; r < m_; r++) memset(parity[r], 0, len);
+            // 分段计算，使同一段数据在缓存中被各校验行复用
+            for (size_t off = 0; off < len; off += kSlice)
+            {
+                size_t n = std::min(kSlice, len - off);
+                for (int r = 0; r < m_; r++)
+                    for (int c = 0; c < k_; c++)
+                        GF256::MulAdd(matrix_[(size_t)(k_ + r) * k_ + c], data[c] + off, parity[r] + off, n);
+            }
+        }
+
+        // 由编号为have[0..k-1]的k个分片恢复编号为want[0..count-1]的分片，编号不可重复。have中的分片不可逆时返回false
+        bool Reconstruct(const int *have, const uint8_t *const *in, const int *want, uint8_t *const *out, int count, size_t len) const
+        {
+            std::vector<uint8_t> inv;
+            if (!Invert(have, &inv)) return false;
+            // out[w] = matrix_[want[w]] * inv * in
+            std::vector<uint8_t> coef((size_t)count * k_, 0);
+            for (int w = 0; w < count; w++)
+                for (int j = 0; j < k_; j++)
+                {
+                    uint8_t v = 0;
+                    for (int t = 0; t < k_; t++)
+                        v ^= GF256::Mul(matrix_[(size_t)want[w] * k_ + t], inv[(size_t)t * k_ + j]);
+                    coef[(size_t)w * k_ + j] = v;
+                }
+            for (int w = 0; w < count; w++) memset(out[w], 0, len);
+            for (size_t off = 0; off < len; off += kSlice)
+            {
+                size_t n = std::min(kSlice, len - off);
+                for (int w = 0; w < count; w++)
+                    for (int j = 0; j < k_; j++)
+                        GF256::MulAdd(coef[(size_t)w * k_ + j], in[j] + off, out[w] + off, n);
+            }
+            return true;
+        }
+
+    private:
+        static constexpr size_t kSlice = 16 * 1024;
+
+        // 取编码矩阵中have各行组成k*k矩阵，高斯-约当消元求逆
+        bool Invert(const int *have, std::vector<uint8_t> *inv) const
+        {
+            size_t k = k_;
+            std::vector<uint8_t> a(k * k);
+            for (size_t r = 0; r < k; r++)
+            {
+                if (have[r] < 0 || have[r] >= k_ + m_) return false;
+                memcpy(&a[r * k], &matrix_[(size_t)have[r] * k], k);
+            }
+            inv->assign(k * k, 0);
+            for (size_t r = 0; r < k; r++) (*inv)[r * k + r] = 1;
+            for (size_t col = 0; col < k; col++)
+            {
+                size_t pivot = col;
+                while (pivot < k && a[pivot * k + col] == 0) pivot++;
+                if (pivot == k) return false;
+                if (pivot != col)
+                    for (size_t j = 0; j < k; j++)
+                    {
+                        std::swap(a[pivot * k + j], a[col * k + j]);
+                        std::swap((*inv)[pivot * k + j], (*inv)[col * k + j]);
+                    }
+                uint8_t f = GF256::Inv(a[col * k + col]);
+                for (size_t j = 0; j < k; j++)
+                {
+                    a[col * k + j] = GF256::Mul(a[col * k + j], f);
+                    (*inv)[col * k + j] = GF256::Mul((*inv)[col * k + j], f);
+                }
+                for (size_t r = 0; r < k; r++)
+                {
+                    uint8_t g = a[r * k + col];
+                    if (r == col || g == 0) continue;
+                    for (size_t j = 0; j < k; j++)
+                    {
+                        a[r * k + j] ^= GF256::Mul(g, a[col * k + j]);
+                        (*inv)[r * k + j] ^= GF256::Mul(g, (*inv)[col * k + j]);
+                    }
+                }
+            }
+            return true;
+        }
+
+    private:
+        int k_, m_;
+        std::vector<uint8_t> matrix_;                       // (k+m)*k的编码矩阵，按行存放
+    }; // class ReedSolomon
+}
@@ -0,0 +1,545 @@
+#pragma once
+#include <ctime>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <zlib.h>
+#include "DataManager.hpp"
+#include "ErasureCode.hpp"
+#include "../log_system/logs_code/ThreadPool.hpp"
+
+namespace storage{
+    // 纠删码存储：对象按Reed-Solomon(k+m)拆成k个数据分片和m个校验分片，分别写到ec_storage_dirs中的不同目录(不同的盘)，
+    // 任意m块盘损坏时仍可读出，磁盘开销为(k+m)/k倍，而不是镜像的2倍。
+    // 数据分片i是原文件的第i段，分片大小F = ceil(size/k)，末段补0；校验分片的第j字节由各数据分片的第j字节算出，
+    // 读取时数据分片齐全就直接发送各分片文件中的内容，缺少的数据分片才在后台线程解码。
+    // 分片i存放在根目录(hash(对象名)+i) % 根目录数下，文件名为对象名加".i"，文件头记录分片的编号、对象大小、
+    // 本次编码的随机标识和内容的CRC32，重新上传时整组替换，标识不一致的分片视为缺失。
+    // 后台修复定期校验所有分片的CRC，重建缺失或损坏的分片
+    class ErasureStore{
+    public:
+        static ErasureStore& GetErasureStore()
+        {
+            static ErasureStore store;
+            return store;
+        }
+
+        bool Enabled() const { return rs_ != nullptr; }
+        int K() const { return k_; }
+        int M() const { return m_; }
+        const std::vector<string> &Roots() const { return roots_; }
+        ThreadPool &Pool() { return *pool_; }
+
+        uint64_t FragmentSize(uint64_t size) const { return (size + k_ - 1) / k_; }
+
+        // 是否有足够多的盘能放下bytes字节对象的分片并留有reserve
+        bool Fits(uint64_t bytes, uint64_t reserve) const
+        {
+            int n = 0;
+            for (auto &root : roots_)
+            {
+                struct statvfs vfs;
+                if (statvfs(root.c_str(), &vfs) == 0 && (uint64_t)vfs.f_bavail * vfs.f_frsize >= FragmentSize(bytes) + sizeof(Header) + reserve) n++;
+            }
+            return n >= k_ + m_;
+        }
+
+        // 把文件src编码为对象name的k+m个分片，成功时size为原文件大小
+        bool Encode(const string &src, const string &name, uint64_t *size)
+        {
+            std::lock_guard<std::mutex> lock(LockFor(name));
+            int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            if (in == -1 || fstat(in, &st) == -1)
+            {
+                mylog::GetLogger("asynclogger")->Error("erasure encode: open %s failed: %s", src.c_str(), strerror(errno));
+                if (in != -1) close(in);
+                return false;
+            }
+            *size = st.st_size;
+            uint64_t frag = FragmentSize(*size);
+            std::vector<Fragment> out(k_ + m_);
+            Header h = NewHeader(*size);
+            bool ok = true;
+            for (int i = 0; i < k_ + m_ && ok; i++)
+            {
+                out[i].path = Path(name, i);
+                out[i].h = h;
+                out[i].h.index = i;
+                FileUtil(out[i].path.substr(0, out[i].path.find_last_of('/') + 1)).CreateDirectory();
+                out[i].fd = open((out[i].path + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                ok = out[i].fd != -1;
+            }
+
+            Buffers buf(k_ + m_, std::min<uint64_t>(kBlock, std::max<uint64_t>(frag, 1)));
+            for (uint64_t off = 0; off < frag && ok; off += buf.len)
+            {
+                size_t len = std::min<uint64_t>(buf.len, frag - off);
+                for (int c = 0; c < k_ && ok; c++)
+                {
+                    uint64_t pos = c * frag + off;
+                    size_t avail = pos < *size ? std::min<uint64_t>(len, *size - pos) : 0;
+                    ok = ReadAt(in, buf.ptr[c], avail, pos);
+                    memset(buf.ptr[c] + avail, 0, len - avail);
+                }
+                if (!ok) break;
+                rs_->Encode(buf.ptr.data(), buf.ptr.data() + k_, len);
+                for (int i = 0; i < k_ + m_ && ok; i++)
+                    ok = WritePayload(&out[i], buf.ptr[i], len, off);
+            }
+            close(in);
+            for (int i = 0; i < k_ + m_ && ok; i++)
+                ok = WriteAt(out[i].fd, (const char *)&out[i].h, sizeof(Header), 0);
+            return Commit(&out, ok, name);
+        }
+
+        // 读取对象时的一个数据分片：fd中从offset开始的len字节，fd由调用者关闭
+        struct Piece{
+            int fd;
+            uint64_t offset;
+            uint64_t len;
+        };
+
+        // 打开大小为size的对象name的数据分片，pieces依次为对象的各段。数据分片齐全时只打开文件，不读取内容；
+        // 缺少数据分片时decode为false则置degraded并返回false，为true则解码到匿名临时文件(较慢，应在后台线程调用)
+        bool OpenPieces(const string &name, uint64_t size, bool decode, std::vector<Piece> *pieces, bool *degraded)
+        {
+            *degraded = false;
+            std::vector<Fragment> f;
+            if (Open(name, size, &f) < k_)
+            {
+                mylog::GetLogger("asynclogger")->Error("erasure object %s unreadable: fewer than %d fragments left", name.c_str(), k_);
+                CloseAll(&f);
+                return false;
+            }
+            uint64_t frag = FragmentSize(size);
+            std::vector<int> want;
+            for (int i = 0; i < k_; i++)
+                if (!f[i].ok && i * frag < size) want.push_back(i);
+            if (!want.empty() && !decode)
+            {
+                *degraded = true;
+                CloseAll(&f);
+                return false;
+            }
+
+            // 缺少的数据分片解码到已删除名字的临时文件，内容从0开始
+            std::vector<int> rebuilt(k_, -1);
+            bool ok = true;
+            if (!want.empty())
+            {
+                degraded_reads_.fetch_add(1, std::memory_order_relaxed);
+                mylog::GetLogger("asynclogger")->Warn("erasure object %s: degraded read, %lu data fragments rebuilt", name.c_str(), want.size());
+                string temp_dir = Config::GetConfigData().GetTemporaryFileDir();
+                FileUtil(temp_dir).CreateDirectory();
+                for (int i : want)
+                {
+                    string temp_path = temp_dir + "ec-XXXXXX";
+                    rebuilt[i] = mkstemp(&temp_path[0]);
+                    if (rebuilt[i] == -1) ok = false;
+                    else unlink(temp_path.c_str());         // 已打开的fd仍可读写
+                }
+                ok = ok && Rebuild(f, want, frag, [&](int i, const uint8_t *data, size_t len, uint64_t off){
+                    uint64_t pos = i * frag + off;
+                    return pos >= size || WriteAt(rebuilt[i], (const char *)data, std::min<uint64_t>(len, size - pos), off);
+                });
+            }
+
+            for (int i = 0; i < k_ && ok; i++)
+            {
+                uint64_t pos = i * frag;
+                if (pos >= size) break;
+                uint64_t len = std::min(frag, size - pos);
+                if (rebuilt[i] != -1) pieces->push_back({rebuilt[i], 0, len});
+                else
+                {
+                    pieces->push_back({f[i].fd, sizeof(Header), len});
+                    f[i].fd = -1;                           // 交给调用者
+                }
+                rebuilt[i] = -1;
+            }
+            for (int fd : rebuilt)
+                if (fd != -1) close(fd);
+            CloseAll(&f);
+            if (!ok)
+            {
+                for (auto &p : *pieces) close(p.fd);
+                pieces->clear();
+            }
+            return ok;
+        }
+
+        // 删除对象name的全部分片
+        void Remove(const string &name)
+        {
+            std::lock_guard<std::mutex> lock(LockFor(name));
+            for (int i = 0; i < k_ + m_; i++)
+                for (auto &root : roots_)
+                {
+                    string path = root + name + "." + std::to_string(i);
+                    if (unlink(path.c_str()) == 0) RemoveEmptyDirs(root, path);
+                }
+        }
+
+        void Start()
+        {
+            if (!Enabled() || repair_interval_ <= 0) return;
+            std::thread([this]{
+                while (true)
+                {
+                    std::this_thread::sleep_for(std::chrono::seconds(repair_interval_));
+                    Repair();
+                }
+            }).detach();
+        }
+
+        // 检查一遍所有纠删码对象，重建缺失、损坏的分片，返回重建的分片数
+        size_t Repair()
+        {
+            if (!Enabled()) return 0;
+            std::vector<StorageInfo> files;
+            DataManager::GetDataManager().GetAll(files);
+            size_t rebuilt = 0, lost = 0;
+            for (auto &file : files)
+            {
+                if (!file.Erasure()) continue;
+                int n = RepairOne(file);
+                if (n < 0) lost++;
+                else rebuilt += n;
+            }
+            lost_.store(lost, std::memory_order_relaxed);
+            repaired_.fetch_add(rebuilt, std::memory_order_relaxed);
+            if (rebuilt + lost > 0)
+                mylog::GetLogger("asynclogger")->Info("erasure repair: %lu fragments rebuilt, %lu objects unrecoverable", rebuilt, lost);
+            return rebuilt;
+        }
+
+        uint64_t Repaired() const { return repaired_.load(std::memory_order_relaxed); }
+        uint64_t DegradedReads() const { return degraded_reads_.load(std::memory_order_relaxed); }
+        uint64_t Lost() const { return lost_.load(std::memory_order_relaxed); }
+
+        ErasureStore(const ErasureStore&) = delete;
+        ErasureStore& operator=(const ErasureStore&) = delete;
+
+    private:
+        static constexpr size_t kBlock = 256 * 1024;       // 每个分片每次读写的字节数
+        static constexpr size_t kLockStripes = 64;
+        static constexpr char kMagic[4] = {'R', 'S', 'F', '1'};
+
+        // 分片文件头，按本机字节序存放，分片内容紧随其后
+        struct Header{
+            char magic[4];
+            uint8_t k, m, index, reserved;
+            uint32_t crc;                                   // 分片内容的CRC32
+            uint64_t size;                                  // 对象大小
+            uint64_t nonce;                                 // 同一次编码的各分片相同
+        };
+        static_assert(sizeof(Header) == 32, "fragment header layout");
+
+        struct Fragment{
+            string path;
+            int fd = -1;
+            Header h;
+            bool ok = false;
+        };
+
+        // k+m个分片各一块缓冲区，ptr[i]指向第i块
+        struct Buffers{
+            std::vector<uint8_t> mem;
+            std::vector<uint8_t *> ptr;
+            size_t len;
+
+            Buffers(int n, size_t block) : mem((size_t)n * block), ptr(n), len(block)
+            {
+                for (int i = 0; i < n; i++) ptr[i] = mem.data() + (size_t)i * block;
+            }
+        };
+
+        ErasureStore()
+        {
+            Config &cf = Config::GetConfigData();
+            k_ = cf.GetErasureDataFragments();
+            m_ = cf.GetErasureParityFragments();
+            repair_interval_ = cf.GetErasureRepairInterval();
+            for (auto &root : cf.GetErasureRoots())
+            {
+                roots_.push_back(root.path);
+                FileUtil(root.path).CreateDirectory();
+            }
+            if (roots_.empty()) return;
+            if (k_ < 1 || m_ < 1 || k_ + m_ > 256 || (int)roots_.size() < k_ + m_)
+            {
+                mylog::GetLogger("asynclogger")->Error("erasure coding disabled: %d+%d fragments need as many storage dirs, %lu configured",
+                    k_, m_, roots_.size());
+                return;
+            }
+            rs_.reset(new ReedSolomon(k_, m_));
+            pool_.reset(new ThreadPool(std::max(1, cf.GetErasureThreads())));
+            mylog::GetLogger("asynclogger")->Info("erasure coding %d+%d over %lu dirs, GF(2^8) kernel %s",
+                k_, m_, roots_.size(), GF256::KernelName());
+        }
+
+        Header NewHeader(uint64_t size)
+        {
+            static std::mt19937_64 rng(std::random_device{}() ^ (uint64_t)time(nullptr));
+            static std::mutex rng_mutex;
+            Header h;
+            memcpy(h.magic, kMagic, sizeof(kMagic));
+            h.k = k_;
+            h.m = m_;
+            h.index = 0;
+            h.reserved = 0;
+            h.crc = crc32(0, Z_NULL, 0);
+            h.size = size;
+            std::lock_guard<std::mutex> lock(rng_mutex);
+            h.nonce = rng();
+            return h;
+        }
+
+        static uint32_t NameHash(const string &name)
+        {
+            uint32_t h = 2166136261u;
+            for (unsigned char c : name) h = (h ^ c) * 16777619u;
+            return h;
+        }
+
+        // 分片i应在的位置
+        string Path(const string &name, int i) const
+        {
+            return roots_[(NameHash(name) + i) % roots_.size()] + name + "." + std::to_string(i);
+        }
+
+        // 同一对象的编码、删除、修复使用同一把锁，不同对象按名字散列分到各把锁
+        std::mutex &LockFor(const string &name) { return locks_[NameHash(name) % kLockStripes]; }
+
+        // 打开对象的各个分片并检查文件头和长度，取数量最多的一次编码，返回可用的分片数
+        int Open(const string &name, uint64_t size, std::vector<Fragment> *f)
+        {
+            f->assign(k_ + m_, Fragment());
+            if (roots_.empty()) return 0;                   // 配置中去掉了纠删码存储
+            uint64_t frag = FragmentSize(size);
+            for (int i = 0; i < k_ + m_; i++)
+            {
+                Fragment &x = (*f)[i];
+                // 根目录列表调整过时分片可能不在应在的位置
+                x.path = Path(name, i);
+                x.fd = open(x.path.c_str(), O_RDONLY | O_CLOEXEC);
+                for (size_t r = 0; x.fd == -1 && r < roots_.size(); r++)
+                {
+                    x.path = roots_[r] + name + "." + std::to_string(i);
+                    x.fd = open(x.path.c_str(), O_RDONLY | O_CLOEXEC);
+                }
+                struct stat st;
+                x.ok = x.fd != -1 && ReadAt(x.fd, (uint8_t *)&x.h, sizeof(Header), 0) && fstat(x.fd, &st) == 0 &&
+                       memcmp(x.h.magic, kMagic, sizeof(kMagic)) == 0 && x.h.k == k_ && x.h.m == m_ && x.h.index == i &&
+                       x.h.size == size && (uint64_t)st.st_size == sizeof(Header) + frag;
+            }
+            uint64_t nonce = 0;
+            int best = 0;
+            for (auto &x : *f)
+            {
+                if (!x.ok) continue;
+                int n = 0;
+                for (auto &y : *f) n += y.ok && y.h.nonce == x.h.nonce;
+                if (n > best)
+                {
+                    best = n;
+                    nonce = x.h.nonce;
+                }
+            }
+            for (auto &x : *f) x.ok = x.ok && x.h.nonce == nonce;
+            return best;
+        }
+
+        static void CloseAll(std::vector<Fragment> *f)
+        {
+            for (auto &x : *f)
+                if (x.fd != -1) close(x.fd);
+        }
+
+        // 由可用的k个分片逐块解码出编号为want的分片，每块交给emit(编号, 数据, 长度, 分片内偏移)
+        template <typename F>
+        bool Rebuild(const std::vector<Fragment> &f, const std::vector<int> &want, uint64_t frag, F &&emit)
+        {
+            std::vector<int> have;
+            for (int i = 0; i < k_ + m_ && (int)have.size() < k_; i++)
+                if (f[i].ok) have.push_back(i);
+            if ((int)have.size() < k_) return false;
+            Buffers in(k_, std::min<uint64_t>(kBlock, std::max<uint64_t>(frag, 1)));
+            Buffers out(want.size(), in.len);
+            for (uint64_t off = 0; off < frag; off += in.len)
+            {
+                size_t len = std::min<uint64_t>(in.len, frag - off);
+                for (int j = 0; j < k_; j++)
+                    if (!ReadAt(f[have[j]].fd, in.ptr[j], len, sizeof(Header) + off)) return false;
+                if (!rs_->Reconstruct(have.data(), in.ptr.data(), want.data(), out.ptr.data(), want.size(), len)) return false;
+                for (size_t w = 0; w < want.size(); w++)
+                    if (!emit(want[w], out.ptr[w], len, off)) return false;
+            }
+            return true;
+        }
+
+        // 校验并修复一个对象，返回重建的分片数，无法恢复时返回-1。
+        // 与同一对象的编码、删除互斥，否则可能读到改名到一半的新旧两组分片，或在删除之后又写回分片
+        int RepairOne(const StorageInfo &file)
+        {
+            string name = file.ErasureName();
+            uint64_t size = file.fsize_;
+            std::lock_guard<std::mutex> lock(LockFor(name));
+            std::vector<Fragment> f;
+            uint64_t frag = FragmentSize(size);
+            int valid = Open(name, size, &f);
+            std::vector<uint8_t> buf(kBlock);
+            for (auto &x : f)
+            {
+                if (!x.ok) continue;
+                uLong crc = crc32(0, Z_NULL, 0);
+                for (uint64_t off = 0; off < frag && x.ok; off += kBlock)
+                {
+                    size_t len = std::min<uint64_t>(kBlock, frag - off);
+                    x.ok = ReadAt(x.fd, buf.data(), len, sizeof(Header) + off);
+                    crc = crc32(crc, buf.data(), len);
+                }
+                if (x.ok && crc != x.h.crc)
+                {
+                    mylog::GetLogger("asynclogger")->Warn("erasure fragment %s is corrupt", x.path.c_str());
+                    x.ok = false;
+                }
+                if (!x.ok) valid--;
+            }
+            // 扫描开始后对象已被删除或重新上传时既不计为丢失也不写入
+            StorageInfo now;
+            if (!DataManager::GetDataManager().GetOneByStoragePath(file.storage_path_, &now) ||
+                now.mtime_ != file.mtime_ || now.fsize_ != file.fsize_)
+            {
+                CloseAll(&f);
+                return 0;
+            }
+            if (valid < k_)
+            {
+                mylog::GetLogger("asynclogger")->Error("erasure object %s unrecoverable: %d of %d fragments intact", name.c_str(), valid, k_ + m_);
+                CloseAll(&f);
+                return -1;
+            }
+            std::vector<int> want;
+            Header h;
+            for (int i = 0; i < k_ + m_; i++)
+            {
+                if (f[i].ok) h = f[i].h;
+                else want.push_back(i);
+            }
+            if (want.empty())
+            {
+                CloseAll(&f);
+                return 0;
+            }
+
+            std::vector<Fragment> out(k_ + m_);
+            bool ok = true;
+            for (int i : want)
+            {
+                out[i].path = Path(name, i);
+                out[i].h = h;
+                out[i].h.index = i;
+                out[i].h.crc = crc32(0, Z_NULL, 0);
+                FileUtil(out[i].path.substr(0, out[i].path.find_last_of('/') + 1)).CreateDirectory();
+                out[i].fd = open((out[i].path + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                ok = ok && out[i].fd != -1;
+            }
+            ok = ok && Rebuild(f, want, frag, [&](int i, const uint8_t *data, size_t len, uint64_t off){
+                return WritePayload(&out[i], data, len, off);
+            });
+            for (int i : want)
+                ok = ok && WriteAt(out[i].fd, (const char *)&out[i].h, sizeof(Header), 0);
+            // 不在应在位置上的旧分片由重建的分片代替
+            for (int i : want)
+                if (ok && f[i].fd != -1 && f[i].path != out[i].path) unlink(f[i].path.c_str());
+            CloseAll(&f);
+            if (!Commit(&out, ok, name)) return 0;
+            for (int i : want)
+                mylog::GetLogger("asynclogger")->Info("erasure fragment %s rebuilt", out[i].path.c_str());
+            return want.size();
+        }
+
+        // 分片内容写入偏移off处(文件头之后)并累计CRC
+        static bool WritePayload(Fragment *x, const uint8_t *data, size_t len, uint64_t off)
+        {
+            x->h.crc = crc32(x->h.crc, data, len);
+            return WriteAt(x->fd, (const char *)data, len, sizeof(Header) + off);
+        }
+
+        // 关闭写好的临时分片，ok时改名为正式分片，否则删除
+        bool Commit(std::vector<Fragment> *out, bool ok, const string &name)
+        {
+            for (auto &x : *out)
+            {
+                if (x.fd == -1) continue;
+                close(x.fd);
+                x.fd = -1;
+                string tmp = x.path + ".tmp";
+                if (ok && rename(tmp.c_str(), x.path.c_str()) == -1)
+                {
+                    mylog::GetLogger("asynclogger")->Error("erasure: rename %s failed: %s", tmp.c_str(), strerror(errno));
+                    ok = false;
+                }
+                if (!ok) unlink(tmp.c_str());
+            }
+            if (!ok) mylog::GetLogger("asynclogger")->Error("erasure: writing fragments of %s failed", name.c_str());
+            return ok;
+        }
+
+        static bool ReadAt(int fd, uint8_t *buf, size_t len, uint64_t offset)
+        {
+            size_t done = 0;
+            while (done < len)
+            {
+                ssize_t n = pread(fd, buf + done, len - done, offset + done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                done += n;
+            }
+            return true;
+        }
+
+        static bool WriteAt(int fd, const char *buf, size_t len, uint64_t offset)
+        {
+            size_t done = 0;
+            while (done < len)
+            {
+                ssize_t n = pwrite(fd, buf + done, len - done, offset + done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                done += n;
+            }
+            return true;
+        }
+
+        // 删除分片后清理变空的上级目录，直到根目录
+        static void RemoveEmptyDirs(const string &root, const string &path)
+        {
+            string dir = path.substr(0, path.find_last_of('/'));
+            while (dir.size() > root.size() && rmdir(dir.c_str()) == 0)
+                dir.erase(dir.find_last_of('/'));
+        }
+
+    private:
+        int k_, m_;
+        int repair_interval_;
+        std::vector<string> roots_;
+        std::unique_ptr<ReedSolomon> rs_;                   // 为空表示未启用
+        std::unique_ptr<ThreadPool> pool_;                  // 编码线程
+        std::atomic<uint64_t> repaired_{0};
+        std::atomic<uint64_t> degraded_reads_{0};
+        std::atomic<uint64_t> lost_{0};
+        std::mutex locks_[kLockStripes];
+    }; // class ErasureStore
+}
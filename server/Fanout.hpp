@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "Config.hpp"
+
+namespace storage{
+    // 存储目录的散列分层：对象名前加上由名字散列得到的目录，如"3f/a2/docs/report.pdf"，
+    // 每层256个目录，单个目录下的条目数不会随文件总数无限增长。
+    // 散列用FNV-1a，结果只取决于名字本身，跨版本、跨机器稳定
+    class Fanout{
+    public:
+        static int Levels()
+        {
+            static const int levels = std::min(3, std::max(0, Config::GetConfigData().GetStorageFanoutLevels()));
+            return levels;
+        }
+
+        // name(不含分层目录)对应的分层目录前缀，不分层时为空
+        static string Prefix(std::string_view name)
+        {
+            static const char hex[] = "0123456789abcdef";
+            uint32_t h = 2166136261u;
+            for (unsigned char c : name) h = (h ^ c) * 16777619u;
+            string prefix;
+            for (int i = 0; i < Levels(); i++, h >>= 8)
+            {
+                prefix += hex[(h >> 4) & 0xf];
+                prefix += hex[h & 0xf];
+                prefix += '/';
+            }
+            return prefix;
+        }
+
+        // name是否已带有与其余部分相符的分层目录
+        static bool Has(std::string_view name)
+        {
+            size_t len = Levels() * 3;
+            return name.size() > len && name.substr(0, len) == Prefix(name.substr(len));
+        }
+
+        // 去掉分层目录，得到写入时的对象名
+        static std::string_view Strip(std::string_view name)
+        {
+            return Has(name) ? name.substr(Levels() * 3) : name;
+        }
+    }; // class Fanout
+}
@@ -0,0 +1,178 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <event2/buffer.h>
+#include "Config.hpp"
+#include "Metrics.hpp"
+
+namespace storage{
+    // 下载用的文件描述符缓存，键为存储路径。
+    // 每个文件打开一次，包装为evbuffer_file_segment；segment自带引用计数，每个响应通过
+    // evbuffer_add_file_segment各持一份引用，同一文件的并发下载共享同一个fd(可走sendfile)。
+    // 缓存只持有自己那一份引用：条目过期(TTL)、被淘汰或失效后释放它，仍在发送的响应不受影响。
+    // evbuffer本身未开启多线程支持，因此segment只在事件循环线程中释放：其他线程调用Invalidate时
+    // 只把segment放入待释放列表，由事件循环线程下一次Acquire或Sweep时释放
+    class FdCache{
+    public:
+        struct Handle{
+            evbuffer_file_segment *seg = nullptr;           // 仅在本次回调内有效，跨回调使用须自行加引用
+            int fd = -1;                                    // segment所属的fd，可用于pread，不要关闭
+            size_t size = 0;
+        };
+
+        static FdCache& GetFdCache()
+        {
+            static FdCache cache;
+            return cache;
+        }
+
+        // 取得path的segment，必要时打开文件。expect_size为元数据中的文件大小，
+        // 与缓存中的不一致说明文件已被改写，重新打开。at_least为true时用于只追加的文件(如打包段)，
+        // 缓存的大小不小于expect_size即可。失败时返回false，errno为open/fstat的错误
+        bool Acquire(const string &path, size_t expect_size, Handle *h, bool at_least = false)
+        {
+            std::vector<evbuffer_file_segment *> garbage;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                garbage.swap(dead_);
+                auto it = entries_.find(path);
+                if (it != entries_.end())
+                {
+                    Entry &e = it->second;
+                    if (e.expire_ns > MonotonicNs() && (at_least ? e.size >= expect_size : e.size == expect_size))
+                    {
+                        lru_.splice(lru_.begin(), lru_, e.lru);
+                        *h = {e.seg, e.fd, e.size};
+                        hits_.fetch_add(1, std::memory_order_relaxed);
+                        Free(garbage);
+                        return true;
+                    }
+                    EraseLocked(it, &garbage);
+                }
+                misses_.fetch_add(1, std::memory_order_relaxed);
+            }
+            Free(garbage);
+
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1) return false;
+            struct stat st;
+            if (fstat(fd, &st) == -1)
+            {
+                int err = errno;
+                close(fd);
+                errno = err;
+                return false;
+            }
+            evbuffer_file_segment *seg = evbuffer_file_segment_new(fd, 0, st.st_size, EVBUF_FS_CLOSE_ON_FREE);
+            if (seg == nullptr)
+            {
+                close(fd);
+                errno = EIO;
+                return false;
+            }
+            *h = {seg, fd, (size_t)st.st_size};
+            if (max_entries_ == 0)
+            {
+                // 缓存关闭：segment交给本次事件循环结束后释放，期间响应已各自持有引用
+                std::lock_guard<std::mutex> lock(mutex_);
+                dead_.push_back(seg);
+                return true;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            lru_.push_front(path);
+            Entry &e = entries_[path];
+            e = {seg, fd, (size_t)st.st_size, MonotonicNs() + ttl_ns_, lru_.begin()};
+            while (entries_.size() > max_entries_)
+            {
+                auto victim = entries_.find(lru_.back());
+                EraseLocked(victim, &dead_);
+            }
+            return true;
+        }
+
+        // 文件被覆盖或删除，可在任意线程调用
+        void Invalidate(const string &path)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = entries_.find(path);
+            if (it != entries_.end()) EraseLocked(it, &dead_);
+        }
+
+        // 释放过期条目和待释放的segment，由事件循环定时调用
+        void Sweep()
+        {
+            std::vector<evbuffer_file_segment *> garbage;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                garbage.swap(dead_);
+                uint64_t now = MonotonicNs();
+                for (auto it = entries_.begin(); it != entries_.end();)
+                {
+                    auto next = std::next(it);
+                    if (it->second.expire_ns <= now) EraseLocked(it, &garbage);
+                    it = next;
+                }
+            }
+            Free(garbage);
+        }
+
+        size_t Size()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return entries_.size();
+        }
+
+        uint64_t Hits() const { return hits_.load(std::memory_order_relaxed); }
+        uint64_t Misses() const { return misses_.load(std::memory_order_relaxed); }
+
+        FdCache(const FdCache&) = delete;
+        FdCache& operator=(const FdCache&) = delete;
+
+    private:
+        struct Entry{
+            evbuffer_file_segment *seg;
+            int fd;
+            size_t size;
+            uint64_t expire_ns;
+            std::list<string>::iterator lru;
+        };
+        using Map = std::unordered_map<string, Entry>;
+
+        FdCache()
+        {
+            max_entries_ = Config::GetConfigData().GetFdCacheMax();
+            ttl_ns_ = (uint64_t)std::max(0, Config::GetConfigData().GetFdCacheTtl()) * 1000000000ull;
+        }
+
+        void EraseLocked(Map::iterator it, std::vector<evbuffer_file_segment *> *garbage)
+        {
+            garbage->push_back(it->second.seg);
+            lru_.erase(it->second.lru);
+            entries_.erase(it);
+        }
+
+        static void Free(std::vector<evbuffer_file_segment *> &segs)
+        {
+            for (auto seg : segs) evbuffer_file_segment_free(seg);
+        }
+
+    private:
+        std::mutex mutex_;
+        Map entries_;
+        std::list<string> lru_;                             // 最近使用的在前，超过上限时淘汰尾部
+        std::vector<evbuffer_file_segment *> dead_;
+        size_t max_entries_;
+        uint64_t ttl_ns_;
+        std::atomic<uint64_t> hits_{0};
+        std::atomic<uint64_t> misses_{0};
+    }; // class FdCache
+}
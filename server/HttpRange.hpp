@@ -0,0 +1,138 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <strings.h>
+
+namespace storage{
+    // Range请求头解析(RFC 7233)，只支持bytes单位，不分配内存。
+    // 支持 first-last、first-(到文件末尾)、-suffix(最后suffix字节) 以及以逗号分隔的多个区间
+    struct ByteRange{
+        uint64_t first;
+        uint64_t last;                                      // 包含
+        uint64_t Length() const { return last - first + 1; }
+    };
+
+    enum class RangeResult{
+        kIgnore,                                            // 无法识别或区间过多，按普通请求发送全文
+        kOk,                                                // 得到至少一个可满足的区间
+        kUnsatisfiable                                      // 语法正确但没有可满足的区间，应回416
+    };
+
+    constexpr size_t kMaxRanges = 16;                       // 超过该数量的多区间请求按全文处理
+
+    namespace range_detail{
+        inline void SkipSpace(const char *&p)
+        {
+            while (*p == ' ' || *p == '\t') p++;
+        }
+
+        // 读取十进制数，溢出或没有数字时返回false
+        inline bool ParseNumber(const char *&p, uint64_t *v)
+        {
+            if (*p < '0' || *p > '9') return false;
+            uint64_t n = 0;
+            while (*p >= '0' && *p <= '9')
+            {
+                uint64_t d = *p - '0';
+                if (n > (UINT64_MAX - d) / 10) return false;
+                n = n * 10 + d;
+                p++;
+            }
+            *v = n;
+            return true;
+        }
+    }
+
+    // 解析header，size为内容长度。结果区间已截断到[0, size)，按出现顺序存放；
+    // 有重叠或相邻的区间时按起点排序并合并，避免同一段数据被反复发送
+    inline RangeResult ParseRange(const char *header, uint64_t size, ByteRange *ranges, size_t *count)
+    {
+        using namespace range_detail;
+        *count = 0;
+        const char *p = header;
+        SkipSpace(p);
+        if (strncasecmp(p, "bytes", 5) != 0) return RangeResult::kIgnore;
+        p += 5;
+        SkipSpace(p);
+        if (*p != '=') return RangeResult::kIgnore;
+        p++;
+
+        size_t n = 0;
+        bool any = false;                                   // 是否至少有一个语法正确的区间
+        while (true)
+        {
+            SkipSpace(p);
+            if (*p == ',') { p++; continue; }               // 允许空元素
+            if (*p == '\0') break;
+
+            uint64_t first = 0, last = 0;
+            bool suffix = false, open = false;
+            if (*p == '-')
+            {
+                p++;
+                if (!ParseNumber(p, &last)) return RangeResult::kIgnore;
+                suffix = true;
+            }
+            else
+            {
+                if (!ParseNumber(p, &first) || *p != '-') return RangeResult::kIgnore;
+                p++;
+                if (*p >= '0' && *p <= '9')
+                {
+                    if (!ParseNumber(p, &last) || last < first) return RangeResult::kIgnore;
+                }
+                else open = true;
+            }
+            SkipSpace(p);
+            if (*p != ',' && *p != '\0') return RangeResult::kIgnore;
+            any = true;
+
+            // 截断到内容范围内，不可满足的区间直接丢弃
+            ByteRange r;
+            if (suffix)
+            {
+                if (last == 0 || size == 0) continue;
+                r.first = last >= size ? 0 : size - last;
+                r.last = size - 1;
+            }
+            else
+            {
+                if (first >= size) continue;
+                r.first = first;
+                r.last = (open || last >= size) ? size - 1 : last;
+            }
+            if (n == kMaxRanges) return RangeResult::kIgnore;
+            ranges[n++] = r;
+        }
+        if (!any) return RangeResult::kIgnore;
+        if (n == 0) return RangeResult::kUnsatisfiable;
+
+        bool overlap = false;
+        for (size_t i = 0; i < n && !overlap; i++)
+            for (size_t j = i + 1; j < n && !overlap; j++)
+                overlap = ranges[i].first <= ranges[j].last + 1 && ranges[j].first <= ranges[i].last + 1;
+        if (overlap)
+        {
+            // 插入排序，区间数很少
+            for (size_t i = 1; i < n; i++)
+                for (size_t j = i; j > 0 && ranges[j].first < ranges[j - 1].first; j--)
+                {
+                    ByteRange t = ranges[j];
+                    ranges[j] = ranges[j - 1];
+                    ranges[j - 1] = t;
+                }
+            size_t m = 0;
+            for (size_t i = 1; i < n; i++)
+            {
+                if (ranges[i].first <= ranges[m].last + 1)
+                {
+                    if (ranges[i].last > ranges[m].last) ranges[m].last = ranges[i].last;
+                }
+                else ranges[++m] = ranges[i];
+            }
+            n = m + 1;
+        }
+        *count = n;
+        return RangeResult::kOk;
+    }
+}
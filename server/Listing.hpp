@@ -0,0 +1,163 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+
+namespace storage{
+    // 分块有序数组，每块不超过kMaxBlock个元素。相比std::set每个元素只占sizeof(Elem)字节，
+    // 插入删除只移动一个块内的数据，按游标翻页为O(log n + limit)。Less可以带状态
+    template <typename Elem, typename Less = std::less<Elem>>
+    class SortedBlocks{
+    public:
+        explicit SortedBlocks(Less less = Less()) : less_(less) {}
+
+        void Insert(const Elem &e)
+        {
+            if (blocks_.empty()) blocks_.emplace_back();
+            size_t b = FindBlock(e);
+            auto &blk = blocks_[b];
+            blk.insert(std::lower_bound(blk.begin(), blk.end(), e, less_), e);
+            if (blk.size() > kMaxBlock)
+            {
+                std::vector<Elem> tail(blk.begin() + blk.size() / 2, blk.end());
+                blk.resize(blk.size() / 2);
+                blocks_.insert(blocks_.begin() + b + 1, std::move(tail));
+            }
+            size_++;
+        }
+
+        bool Erase(const Elem &e)
+        {
+            if (blocks_.empty()) return false;
+            size_t b = FindBlock(e);
+            auto &blk = blocks_[b];
+            auto it = std::lower_bound(blk.begin(), blk.end(), e, less_);
+            if (it == blk.end() || !(*it == e)) return false;
+            blk.erase(it);
+            if (blk.empty() && blocks_.size() > 1) blocks_.erase(blocks_.begin() + b);
+            size_--;
+            return true;
+        }
+
+        // 取after之后(desc为true时之前)的至多limit个行号，after为nullptr时从头(尾)开始
+        void Page(const Elem *after, bool desc, size_t limit, std::vector<uint32_t> *rows, Elem *last) const
+        {
+            if (blocks_.empty() || limit == 0) return;
+            size_t b, i;
+            if (!desc)
+            {
+                if (after == nullptr) { b = 0; i = 0; }
+                else
+                {
+                    b = FindBlock(*after);
+                    i = std::upper_bound(blocks_[b].begin(), blocks_[b].end(), *after, less_) - blocks_[b].begin();
+                }
+                for (; b < blocks_.size(); b++, i = 0)
+                {
+                    for (; i < blocks_[b].size(); i++)
+                    {
+                        rows->push_back(blocks_[b][i].second);
+                        *last = blocks_[b][i];
+                        if (rows->size() >= limit) return;
+                    }
+                }
+                return;
+            }
+
+            // 倒序：i指向下一个要输出元素的后一个位置
+            if (after == nullptr) { b = blocks_.size() - 1; i = blocks_[b].size(); }
+            else
+            {
+                b = FindBlock(*after);
+                i = std::lower_bound(blocks_[b].begin(), blocks_[b].end(), *after, less_) - blocks_[b].begin();
+            }
+            for (;;)
+            {
+                for (; i > 0; i--)
+                {
+                    rows->push_back(blocks_[b][i - 1].second);
+                    *last = blocks_[b][i - 1];
+                    if (rows->size() >= limit) return;
+                }
+                if (b == 0) return;
+                b--;
+                i = blocks_[b].size();
+            }
+        }
+
+        // 从第一个不小于key的元素开始顺序访问，f返回false时停止。
+        // key_less(elem, key)判断元素是否小于key，且需与Less给出的顺序一致
+        template <typename K, typename KeyLess, typename F>
+        void VisitFrom(const K &key, KeyLess key_less, F &&f) const
+        {
+            size_t lo = 0, hi = blocks_.size();
+            while (lo < hi)
+            {
+                size_t mid = (lo + hi) / 2;
+                if (blocks_[mid].empty() || key_less(blocks_[mid].back(), key)) lo = mid + 1;
+                else hi = mid;
+            }
+            for (size_t b = lo; b < blocks_.size(); b++)
+            {
+                auto it = b == lo ? std::lower_bound(blocks_[b].begin(), blocks_[b].end(), key, key_less) : blocks_[b].begin();
+                for (; it != blocks_[b].end(); ++it)
+                    if (!f(*it)) return;
+            }
+        }
+
+        size_t Size() const { return size_; }
+
+    private:
+        static constexpr size_t kMaxBlock = 1024;
+
+        // 第一个最大元素不小于e的块，没有则取最后一块
+        size_t FindBlock(const Elem &e) const
+        {
+            size_t lo = 0, hi = blocks_.size() - 1;
+            while (lo < hi)
+            {
+                size_t mid = (lo + hi) / 2;
+                if (blocks_[mid].empty() || less_(blocks_[mid].back(), e)) lo = mid + 1;
+                else hi = mid;
+            }
+            return lo;
+        }
+
+    private:
+        std::vector<std::vector<Elem>> blocks_;
+        size_t size_ = 0;
+        Less less_;
+    }; // class SortedBlocks
+
+    // 元素为(排序键, 行号)的有序数组
+    template <typename Key>
+    class OrderedRows : public SortedBlocks<std::pair<Key, uint32_t>>{
+    public:
+        using Elem = std::pair<Key, uint32_t>;
+    }; // class OrderedRows
+
+    // 文件列表的排序索引：按修改时间、按大小；按名字的顺序直接由NamespaceIndex给出
+    class ListingIndex{
+    public:
+        void Add(uint32_t row, uint32_t mtime, uint64_t fsize)
+        {
+            by_mtime_.Insert({mtime, row});
+            by_size_.Insert({fsize, row});
+        }
+
+        void Remove(uint32_t row, uint32_t mtime, uint64_t fsize)
+        {
+            by_mtime_.Erase({mtime, row});
+            by_size_.Erase({fsize, row});
+        }
+
+        const OrderedRows<uint32_t> &ByMtime() const { return by_mtime_; }
+        const OrderedRows<uint64_t> &BySize() const { return by_size_; }
+
+    private:
+        OrderedRows<uint32_t> by_mtime_;
+        OrderedRows<uint64_t> by_size_;
+    }; // class ListingIndex
+}
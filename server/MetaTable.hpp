@@ -0,0 +1,265 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+
+namespace storage{
+    // 分块的只追加字符串池，记录中只保存(偏移, 长度)，不再为每个文件名单独分配堆内存
+    // 偏移的高位是块号，低位是块内位置，因此扩容时不需要搬移已有数据
+    class StringArena{
+    public:
+        static constexpr uint32_t kBlockBits = 20;
+        static constexpr uint32_t kBlockSize = 1u << kBlockBits;    // 每块1MB
+        static constexpr uint32_t kMaxLen = 0xFFFF;                  // 单个字符串最大长度
+
+        // 追加一个字符串，返回其偏移，失败返回UINT32_MAX
+        uint32_t Append(std::string_view s)
+        {
+            if (s.size() > kMaxLen) return UINT32_MAX;
+            if (blocks_.empty() || used_ + s.size() > kBlockSize)
+            {
+                if (blocks_.size() >= (1u << (32 - kBlockBits))) return UINT32_MAX;
+                blocks_.emplace_back(new char[kBlockSize]);
+                used_ = 0;
+            }
+            uint32_t off = ((uint32_t)(blocks_.size() - 1) << kBlockBits) | used_;
+            memcpy(blocks_.back().get() + used_, s.data(), s.size());
+            used_ += s.size();
+            live_ += s.size();
+            return off;
+        }
+
+        std::string_view View(uint32_t off, uint16_t len) const
+        {
+            return std::string_view(blocks_[off >> kBlockBits].get() + (off & (kBlockSize - 1)), len);
+        }
+
+        // 字符串不再被引用，只记账，由Compact统一回收
+        void Release(uint16_t len) { live_ -= len; }
+
+        size_t Capacity() const { return blocks_.size() * (size_t)kBlockSize; }
+        size_t LiveBytes() const { return live_; }
+        size_t GarbageBytes() const
+        {
+            size_t total = blocks_.empty() ? 0 : (blocks_.size() - 1) * (size_t)kBlockSize + used_;
+            return total - live_;
+        }
+
+        void Swap(StringArena &other)
+        {
+            blocks_.swap(other.blocks_);
+            std::swap(used_, other.used_);
+            std::swap(live_, other.live_);
+        }
+
+    private:
+        std::vector<std::unique_ptr<char[]>> blocks_;
+        uint32_t used_ = 0;     // 最后一块已使用的字节数
+        size_t live_ = 0;       // 仍被引用的字节数
+    }; // class StringArena
+
+    // 目录前缀驻留表：同一个存储目录在内存中只保存一份
+    class PathInterner{
+    public:
+        uint32_t Intern(std::string_view dir)
+        {
+            auto it = ids_.find(std::string(dir));
+            if (it != ids_.end()) return it->second;
+            uint32_t id = dirs_.size();
+            dirs_.emplace_back(dir);
+            ids_.emplace(dirs_.back(), id);
+            return id;
+        }
+
+        const std::string &Get(uint32_t id) const { return dirs_[id]; }
+        size_t Size() const { return dirs_.size(); }
+
+    private:
+        std::vector<std::string> dirs_;
+        std::unordered_map<std::string, uint32_t> ids_;
+    }; // class PathInterner
+
+    // 紧凑的文件元数据表
+    // 每个对象只保存：驻留目录编号 + 内存池中的对象名 + 定宽数值字段，字段按列(SoA)存放；
+    // 索引是以对象名(string_view)为键的开放寻址哈希表，槽中只保存行号。
+    // storage_path = 目录前缀 + 对象名，url = download_prefix + 对象名，二者都在读取时拼出。
+    // 非线程安全，由DataManager的读写锁保护
+    class MetaTable{
+    public:
+        static constexpr uint32_t npos = UINT32_MAX;
+
+        MetaTable() { slots_.assign(16, kEmpty); }
+
+        size_t Size() const { return size_; }
+
+        uint32_t Find(std::string_view name) const
+        {
+            size_t mask = slots_.size() - 1;
+            for (size_t i = Hash(name) & mask; ; i = (i + 1) & mask)
+            {
+                uint32_t row = slots_[i];
+                if (row == kEmpty) return npos;
+                if (row != kTomb && Name(row) == name) return row;
+            }
+        }
+
+        // 插入或更新一条记录，返回行号，失败返回npos
+        uint32_t Upsert(std::string_view dir, std::string_view name, time_t mtime, time_t atime, uint64_t fsize, uint64_t osize, uint64_t pack = 0)
+        {
+            uint32_t row = Find(name);
+            if (row == npos)
+            {
+                if ((size_ + tombs_ + 1) * 10 > slots_.size() * 7) Rehash(size_ + 1);
+
+                uint32_t off = arena_.Append(name);
+                if (off == UINT32_MAX) return npos;
+                row = AllocRow();
+                name_off_[row] = off;
+                name_len_[row] = name.size();
+                InsertSlot(row);
+                size_++;
+            }
+            dir_[row] = dirs_.Intern(dir);
+            mtime_[row] = (uint32_t)mtime;
+            atime_[row] = (uint32_t)atime;
+            fsize_[row] = fsize;
+            osize_[row] = osize;
+            pack_[row] = pack;
+            return row;
+        }
+
+        bool Erase(std::string_view name)
+        {
+            size_t mask = slots_.size() - 1;
+            for (size_t i = Hash(name) & mask; ; i = (i + 1) & mask)
+            {
+                uint32_t row = slots_[i];
+                if (row == kEmpty) return false;
+                if (row == kTomb || Name(row) != name) continue;
+
+                slots_[i] = kTomb;
+                tombs_++;
+                arena_.Release(name_len_[row]);
+                dir_[row] = kFreeRow;
+                free_rows_.push_back(row);
+                size_--;
+                // 被删除的文件名积累过多时整理内存池
+                if (arena_.GarbageBytes() > StringArena::kBlockSize && arena_.GarbageBytes() > arena_.LiveBytes())
+                    Compact();
+                return true;
+            }
+        }
+
+        std::string_view Name(uint32_t row) const { return arena_.View(name_off_[row], name_len_[row]); }
+        const std::string &Dir(uint32_t row) const { return dirs_.Get(dir_[row]); }
+        uint32_t DirId(uint32_t row) const { return dir_[row]; }
+        time_t Mtime(uint32_t row) const { return mtime_[row]; }
+        time_t Atime(uint32_t row) const { return atime_[row]; }
+        uint64_t Fsize(uint32_t row) const { return fsize_[row]; }
+        uint64_t Osize(uint32_t row) const { return osize_[row]; }
+        uint64_t Pack(uint32_t row) const { return pack_[row]; }
+
+        void SetDir(uint32_t row, std::string_view dir) { dir_[row] = dirs_.Intern(dir); }
+        void SetTimes(uint32_t row, time_t mtime, time_t atime) { mtime_[row] = (uint32_t)mtime; atime_[row] = (uint32_t)atime; }
+        void SetFsize(uint32_t row, uint64_t fsize) { fsize_[row] = fsize; }
+        void SetOsize(uint32_t row, uint64_t osize) { osize_[row] = osize; }
+
+        const PathInterner &Dirs() const { return dirs_; }
+
+        // 遍历所有有效行，f(row)
+        template <typename F>
+        void ForEach(F &&f) const
+        {
+            for (uint32_t row = 0; row < dir_.size(); row++)
+                if (dir_[row] != kFreeRow) f(row);
+        }
+
+        // 估算元数据占用的内存(字节)
+        size_t MemoryBytes() const
+        {
+            size_t rows = dir_.capacity();
+            return rows * (sizeof(uint32_t) * 4 + sizeof(uint64_t) * 3 + sizeof(uint16_t))
+                 + slots_.capacity() * sizeof(uint32_t)
+                 + free_rows_.capacity() * sizeof(uint32_t)
+                 + arena_.Capacity();
+        }
+
+    private:
+        static constexpr uint32_t kEmpty = UINT32_MAX;
+        static constexpr uint32_t kTomb = UINT32_MAX - 1;
+        static constexpr uint32_t kFreeRow = UINT32_MAX;
+
+        static size_t Hash(std::string_view s) { return std::hash<std::string_view>()(s); }
+
+        uint32_t AllocRow()
+        {
+            if (!free_rows_.empty())
+            {
+                uint32_t row = free_rows_.back();
+                free_rows_.pop_back();
+                return row;
+            }
+            mtime_.push_back(0);
+            atime_.push_back(0);
+            fsize_.push_back(0);
+            osize_.push_back(0);
+            pack_.push_back(0);
+            name_off_.push_back(0);
+            name_len_.push_back(0);
+            dir_.push_back(kFreeRow);
+            return dir_.size() - 1;
+        }
+
+        void InsertSlot(uint32_t row)
+        {
+            size_t mask = slots_.size() - 1;
+            size_t i = Hash(Name(row)) & mask;
+            while (slots_[i] != kEmpty && slots_[i] != kTomb) i = (i + 1) & mask;
+            if (slots_[i] == kTomb) tombs_--;
+            slots_[i] = row;
+        }
+
+        // 扩容到负载因子不超过0.5，同时清除墓碑
+        void Rehash(size_t need)
+        {
+            size_t cap = 16;
+            while (cap < need * 2) cap <<= 1;
+            slots_.assign(cap, kEmpty);
+            tombs_ = 0;
+            ForEach([this](uint32_t row){ InsertSlot(row); });
+        }
+
+        // 把仍然有效的文件名重新紧凑地写入新内存池
+        void Compact()
+        {
+            StringArena fresh;
+            ForEach([&](uint32_t row){ name_off_[row] = fresh.Append(Name(row)); });
+            arena_.Swap(fresh);
+        }
+
+    private:
+        // 按列存放的定宽字段，时间以32位无符号秒保存(可表示到2106年)
+        std::vector<uint32_t> mtime_;
+        std::vector<uint32_t> atime_;
+        std::vector<uint64_t> fsize_;
+        std::vector<uint64_t> osize_;       // 压缩前的大小，即下载内容的长度
+        std::vector<uint64_t> pack_;        // 打包存储的位置，见StorageInfo::pack_
+        std::vector<uint32_t> name_off_;
+        std::vector<uint16_t> name_len_;
+        std::vector<uint32_t> dir_;         // 驻留目录编号，kFreeRow表示该行空闲
+        std::vector<uint32_t> free_rows_;
+
+        std::vector<uint32_t> slots_;       // 开放寻址(线性探测)哈希槽，保存行号
+        size_t size_ = 0;
+        size_t tombs_ = 0;
+
+        StringArena arena_;
+        PathInterner dirs_;
+    }; // class MetaTable
+}
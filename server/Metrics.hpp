@@ -0,0 +1,242 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+
+using std::string;
+
+namespace storage{
+    // 计数器、直方图按线程分条(stripe)，每个线程只写自己那一条，记录一次只是一条relaxed原子加，
+    // 没有跨核的缓存行争用；读取(抓取/metrics)时再把各条相加
+    constexpr size_t kMetricStripes = 8;
+
+    inline size_t MetricStripe()
+    {
+        static std::atomic<size_t> next{0};
+        thread_local size_t stripe = next.fetch_add(1, std::memory_order_relaxed) % kMetricStripes;
+        return stripe;
+    }
+
+    inline uint64_t MonotonicNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    class Counter{
+    public:
+        void Add(uint64_t n = 1) { cells_[MetricStripe()].v.fetch_add(n, std::memory_order_relaxed); }
+
+        uint64_t Value() const
+        {
+            uint64_t sum = 0;
+            for (auto &c : cells_) sum += c.v.load(std::memory_order_relaxed);
+            return sum;
+        }
+
+    private:
+        struct alignas(64) Cell{
+            std::atomic<uint64_t> v{0};
+        };
+        Cell cells_[kMetricStripes];
+    }; // class Counter
+
+    // 对数线性直方图(同HDR Histogram)：每个2的幂区间再等分为2^kSubBits个桶，相对误差不超过1/8。
+    // 值的单位由调用者决定，这里用于纳秒
+    class Histogram{
+    public:
+        static constexpr int kSubBits = 3;
+        static constexpr int kSub = 1 << kSubBits;
+        static constexpr int kMaxExp = 40;                  // 超过2^41的值计入最后一个桶
+        static constexpr int kBuckets = kSub + (kMaxExp - kSubBits + 1) * kSub;
+
+        void Record(uint64_t v)
+        {
+            Stripe &s = stripes_[MetricStripe()];
+            s.buckets[Bucket(v)].fetch_add(1, std::memory_order_relaxed);
+            s.sum.fetch_add(v, std::memory_order_relaxed);
+        }
+
+        static int Bucket(uint64_t v)
+        {
+            if (v < (uint64_t)kSub) return (int)v;
+            int exp = 63 - __builtin_clzll(v);
+            if (exp > kMaxExp) return kBuckets - 1;
+            return (exp - kSubBits + 1) * kSub + (int)((v >> (exp - kSubBits)) & (kSub - 1));
+        }
+
+        // 桶b中值的上界(不含)
+        static uint64_t UpperBound(int b)
+        {
+            if (b < kSub) return b + 1;
+            int exp = b / kSub + kSubBits - 1;
+            return (uint64_t)(kSub + b % kSub + 1) << (exp - kSubBits);
+        }
+
+        // 汇总各条，counts的大小为kBuckets
+        void Snapshot(std::vector<uint64_t> *counts, uint64_t *sum) const
+        {
+            counts->assign(kBuckets, 0);
+            *sum = 0;
+            for (auto &s : stripes_)
+            {
+                for (int b = 0; b < kBuckets; b++) (*counts)[b] += s.buckets[b].load(std::memory_order_relaxed);
+                *sum += s.sum.load(std::memory_order_relaxed);
+            }
+        }
+
+        // 由快照估算分位数，取所在桶的上界
+        static uint64_t Quantile(const std::vector<uint64_t> &counts, double q)
+        {
+            uint64_t total = 0;
+            for (auto c : counts) total += c;
+            if (total == 0) return 0;
+            uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * total)), seen = 0;
+            for (int b = 0; b < kBuckets; b++)
+            {
+                seen += counts[b];
+                if (seen >= rank) return UpperBound(b);
+            }
+            return UpperBound(kBuckets - 1);
+        }
+
+    private:
+        struct alignas(64) Stripe{
+            std::atomic<uint64_t> buckets[kBuckets] = {};
+            std::atomic<uint64_t> sum{0};
+        };
+        Stripe stripes_[kMetricStripes];
+    }; // class Histogram
+
+    // 服务端指标，以Prometheus文本格式在/metrics输出
+    class Metrics{
+    public:
+        enum Route { kUpload, kDownload, kDelete, kList, kLogin, kOther, kRouteCount };
+
+        static Metrics& GetMetrics()
+        {
+            static Metrics metrics;
+            return metrics;
+        }
+
+        // 请求完成(响应已写出)时调用，status为HTTP状态码
+        void RequestDone(Route route, int status, uint64_t ns)
+        {
+            int cls = status / 100 - 1;
+            if (cls < 0 || cls > 4) cls = 4;
+            requests_[route][cls].Add();
+            latency_[route].Record(ns);
+        }
+
+        Counter &BytesIn() { return bytes_in_; }
+        Counter &BytesOut() { return bytes_out_; }
+        std::atomic<int64_t> &Connections() { return connections_; }
+        std::atomic<int64_t> &Compressions() { return compressions_; }
+
+        // 注册抓取时才求值的指标，如元数据表大小；由其他模块自行计数的累计值type传"counter"
+        void AddGauge(const string &name, const string &help, std::function<double()> f, const char *type = "gauge")
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            gauges_.push_back({name, help, type, std::move(f)});
+        }
+
+        string Render()
+        {
+            static const char *routes[] = {"upload", "download", "delete", "list", "login", "other"};
+            static const char *classes[] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+            string out;
+            char line[256];
+
+            out += "# HELP storage_requests_total Requests by route and status class.\n"
+                   "# TYPE storage_requests_total counter\n";
+            for (int r = 0; r < kRouteCount; r++)
+                for (int c = 0; c < 5; c++)
+                {
+                    snprintf(line, sizeof(line), "storage_requests_total{route=\"%s\",code=\"%s\"} %llu\n",
+                             routes[r], classes[c], (unsigned long long)requests_[r][c].Value());
+                    out += line;
+                }
+
+            // 导出时只在每个2的幂处给出累计值(细分桶恰好嵌套于其中，结果精确)，避免输出过长；
+            // 细粒度的分位数另外给出
+            out += "# HELP storage_request_duration_seconds Time from request received to response written.\n"
+                   "# TYPE storage_request_duration_seconds histogram\n";
+            std::vector<std::vector<uint64_t>> snaps(kRouteCount);
+            for (int r = 0; r < kRouteCount; r++)
+            {
+                uint64_t sum, cum = 0;
+                auto &counts = snaps[r];
+                latency_[r].Snapshot(&counts, &sum);
+                for (int b = 0; b < Histogram::kBuckets; b++)
+                {
+                    cum += counts[b];
+                    uint64_t ub = Histogram::UpperBound(b);
+                    if (ub < 1024 || (ub & (ub - 1)) != 0 || b == Histogram::kBuckets - 1) continue;  // 从1us起的2的幂
+                    snprintf(line, sizeof(line), "storage_request_duration_seconds_bucket{route=\"%s\",le=\"%.9g\"} %llu\n",
+                             routes[r], ub / 1e9, (unsigned long long)cum);
+                    out += line;
+                }
+                snprintf(line, sizeof(line), "storage_request_duration_seconds_bucket{route=\"%s\",le=\"+Inf\"} %llu\n"
+                         "storage_request_duration_seconds_sum{route=\"%s\"} %.9f\n"
+                         "storage_request_duration_seconds_count{route=\"%s\"} %llu\n",
+                         routes[r], (unsigned long long)cum, routes[r], sum / 1e9, routes[r], (unsigned long long)cum);
+                out += line;
+            }
+
+            out += "# HELP storage_request_duration_quantile_seconds Latency quantiles from the log-linear histogram.\n"
+                   "# TYPE storage_request_duration_quantile_seconds gauge\n";
+            for (int r = 0; r < kRouteCount; r++)
+                for (double q : {0.5, 0.99, 0.999})
+                {
+                    snprintf(line, sizeof(line), "storage_request_duration_quantile_seconds{route=\"%s\",quantile=\"%g\"} %.9g\n",
+                             routes[r], q, Histogram::Quantile(snaps[r], q) / 1e9);
+                    out += line;
+                }
+
+            Append(&out, "storage_received_bytes_total", "Request body bytes received.", "counter", bytes_in_.Value());
+            Append(&out, "storage_sent_bytes_total", "Bytes written to client sockets.", "counter", bytes_out_.Value());
+            Append(&out, "storage_connections", "Open client connections.", "gauge", connections_.load(std::memory_order_relaxed));
+            Append(&out, "storage_compressions_in_flight", "Deep-storage compressions and erasure encodes queued or running.", "gauge", compressions_.load(std::memory_order_relaxed));
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto &g : gauges_) Append(&out, g.name, g.help, g.type, g.f());
+            return out;
+        }
+
+        Metrics(const Metrics&) = delete;
+        Metrics& operator=(const Metrics&) = delete;
+
+    private:
+        Metrics() = default;
+
+        static void Append(string *out, const string &name, const string &help, const char *type, double v)
+        {
+            char line[64];
+            snprintf(line, sizeof(line), " %.17g\n", v);
+            *out += "# HELP " + name + " " + help + "\n# TYPE " + name + " " + type + "\n" + name + line;
+        }
+
+        struct Gauge{
+            string name;
+            string help;
+            const char *type;
+            std::function<double()> f;
+        };
+
+    private:
+        Counter requests_[kRouteCount][5];
+        Histogram latency_[kRouteCount];
+        Counter bytes_in_;
+        Counter bytes_out_;
+        std::atomic<int64_t> connections_{0};
+        std::atomic<int64_t> compressions_{0};
+        std::mutex mutex_;
+        std::vector<Gauge> gauges_;
+    }; // class Metrics
+}
@@ -0,0 +1,361 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include "MetaTable.hpp"
+
+namespace storage{
+    // 目录命名空间索引：按路径分段组织的基数树，把"a/b/c.txt"这样的路径映射到MetaTable的行号
+    // 目录节点保存子目录(按名字有序)和文件(按文件名有序的行号数组)，文件名取自MetaTable中
+    // 对象名的最后一段，因此不额外保存字符串。对象的存储位置与命名空间路径解耦，
+    // 目录重命名只需把节点挂到新的父节点下。非线程安全，由DataManager的读写锁保护
+    class NamespaceIndex{
+    public:
+        static constexpr uint32_t npos = UINT32_MAX;
+        static constexpr uint32_t kRoot = 0;
+
+        explicit NamespaceIndex(const MetaTable *table) : table_(table)
+        {
+            nodes_.emplace_back(new DirNode{"", npos, {}, {}});
+        }
+
+        // 路径中每一段都不能为空、"."或".."
+        static bool ValidPath(std::string_view path)
+        {
+            if (path.empty() || path.front() == '/' || path.back() == '/') return false;
+            size_t begin = 0;
+            while (begin <= path.size())
+            {
+                size_t end = path.find('/', begin);
+                if (end == std::string_view::npos) end = path.size();
+                std::string_view seg = path.substr(begin, end - begin);
+                if (seg.empty() || seg == "." || seg == "..") return false;
+                begin = end + 1;
+            }
+            return true;
+        }
+
+        static std::string_view BaseName(std::string_view path)
+        {
+            size_t pos = path.find_last_of('/');
+            return pos == std::string_view::npos ? path : path.substr(pos + 1);
+        }
+
+        // 在path处登记row，中间目录不存在时自动创建。path的最后一段必须与对象名的最后一段相同
+        bool Add(std::string_view path, uint32_t row)
+        {
+            if (!ValidPath(path) || BaseName(path) != BaseName(table_->Name(row))) return false;
+            size_t pos = path.find_last_of('/');
+            uint32_t dir = pos == std::string_view::npos ? kRoot : MakeDir(path.substr(0, pos));
+
+            auto &files = nodes_[dir]->files;
+            auto it = LowerBound(files, BaseName(path));
+            if (it != files.end() && Leaf(*it) == BaseName(path)) return false;
+            files.insert(it, row);
+            if (row_dir_.size() <= row) row_dir_.resize(row + 1, npos);
+            row_dir_[row] = dir;
+            return true;
+        }
+
+        // 返回path处的行号，不存在返回npos
+        uint32_t Lookup(std::string_view path) const
+        {
+            size_t pos = path.find_last_of('/');
+            uint32_t dir = pos == std::string_view::npos ? kRoot : FindDir(path.substr(0, pos));
+            if (dir == npos) return npos;
+            std::string_view leaf = BaseName(path);
+            auto &files = nodes_[dir]->files;
+            auto it = LowerBound(files, leaf);
+            return (it != files.end() && Leaf(*it) == leaf) ? *it : npos;
+        }
+
+        // 移除row的登记，必须在MetaTable删除该行之前调用；空目录随之回收
+        void Remove(uint32_t row)
+        {
+            if (row >= row_dir_.size() || row_dir_[row] == npos) return;
+            uint32_t dir = row_dir_[row];
+            auto &files = nodes_[dir]->files;
+            auto it = LowerBound(files, Leaf(row));
+            if (it != files.end() && *it == row) files.erase(it);
+            row_dir_[row] = npos;
+            Prune(dir);
+        }
+
+        bool Contains(uint32_t row) const { return row < row_dir_.size() && row_dir_[row] != npos; }
+
+        // row在命名空间中的完整路径
+        std::string PathOf(uint32_t row) const
+        {
+            std::string path(Leaf(row));
+            for (uint32_t dir = row_dir_[row]; dir != kRoot; dir = nodes_[dir]->parent)
+                path = nodes_[dir]->name + "/" + path;
+            return path;
+        }
+
+        // 目录重命名：摘下from对应的节点挂到to的位置，与目录下的对象数无关
+        bool RenameDir(std::string_view from, std::string_view to, std::string *err)
+        {
+            if (!ValidPath(from) || !ValidPath(to)) { *err = "invalid path"; return false; }
+            uint32_t node = FindDir(from);
+            if (node == npos) { *err = "no such directory"; return false; }
+            if (to.size() > from.size() && to.substr(0, from.size()) == from && to[from.size()] == '/')
+            {
+                *err = "can not move a directory into itself";
+                return false;
+            }
+            if (FindDir(to) != npos || Lookup(to) != npos) { *err = "destination exists"; return false; }
+
+            size_t pos = to.find_last_of('/');
+            std::string_view to_name = BaseName(to);
+            // 新父目录不能位于被移动的子树中(上面已排除)，先创建再摘除，避免旧父目录被提前回收
+            uint32_t new_parent = pos == std::string_view::npos ? kRoot : MakeDir(to.substr(0, pos));
+
+            DirNode *n = nodes_[node].get();
+            uint32_t old_parent = n->parent;
+            nodes_[old_parent]->dirs.erase(n->name);
+            n->name = std::string(to_name);
+            n->parent = new_parent;
+            nodes_[new_parent]->dirs.emplace(n->name, node);
+            Prune(old_parent);
+            return true;
+        }
+
+        // 列出prefix下的内容。prefix可以以部分名字结尾(如"docs/rep")，只返回以其开头的项。
+        // recursive为false时只返回一层：先是子目录(以'/'结尾，放入folders)，再是文件(行号放入rows)；
+        // 为true时按Scan的顺序返回前缀下整棵子树的文件。after为上一页最后一项的路径(目录以'/'结尾)，从其后继续；
+        // 目录和文件合计最多取limit个，more为true表示还有后续
+        bool List(std::string_view prefix, bool recursive, std::string_view after, size_t limit,
+                  std::vector<std::string> *folders, std::vector<uint32_t> *rows, bool *more) const
+        {
+            size_t pos = prefix.find_last_of('/');
+            std::string_view dir_path = pos == std::string_view::npos ? std::string_view() : prefix.substr(0, pos);
+            std::string_view partial = pos == std::string_view::npos ? prefix : prefix.substr(pos + 1);
+            uint32_t dir = dir_path.empty() ? kRoot : FindDir(dir_path);
+            if (dir == npos) return false;
+
+            std::string base = dir_path.empty() ? "" : std::string(dir_path) + "/";
+            if (!after.empty() && after.substr(0, base.size()) != base) return false;
+            std::string_view rest = after.empty() ? after : after.substr(base.size());
+            // after指向的项：本目录中的子目录(名字为first，在其子树中的位置为second)或文件(first，second为空)
+            size_t slash = rest.find('/');
+            std::string_view first = rest.substr(0, slash);
+            bool after_dir = slash != std::string_view::npos;
+
+            // 多取一项用来判断是否还有后续
+            size_t want = limit + 1;
+            const DirNode *n = nodes_[dir].get();
+            bool files_only = !rest.empty() && !after_dir;
+            auto dit = n->dirs.lower_bound(std::string(partial));
+            if (after_dir && first >= partial)
+            {
+                dit = n->dirs.upper_bound(std::string(first));
+                auto cur = n->dirs.find(std::string(first));
+                // 递归列出时先把after所在子目录中剩下的部分列完，该目录已不存在时从其后的目录继续
+                if (recursive && cur != n->dirs.end() && first.substr(0, partial.size()) == partial) ScanFrom(cur->second, rest.substr(slash + 1), want, rows);
+            }
+            for (; !files_only && dit != n->dirs.end() && folders->size() + rows->size() < want; ++dit)
+            {
+                if (dit->first.compare(0, partial.size(), partial) != 0) break;
+                if (recursive) Collect(dit->second, want, rows);
+                else folders->push_back(base + dit->first + "/");
+            }
+            auto fit = files_only && first >= partial ? UpperBound(n->files, first) : LowerBound(n->files, partial);
+            for (; fit != n->files.end() && folders->size() + rows->size() < want; ++fit)
+            {
+                if (Leaf(*fit).substr(0, partial.size()) != partial) break;
+                rows->push_back(*fit);
+            }
+
+            *more = folders->size() + rows->size() > limit;
+            if (*more && !rows->empty()) rows->pop_back();
+            else if (*more) folders->pop_back();
+            return true;
+        }
+
+        // 按路径顺序遍历全部文件(每个目录先子目录后文件)，从after之后开始，最多取limit个。
+        // after所在的目录即使已被删除或重命名，也能从最近的仍存在的上级目录继续
+        void Scan(std::string_view after, size_t limit, std::vector<uint32_t> *rows) const
+        {
+            ScanFrom(kRoot, after, limit, rows);
+        }
+
+    private:
+        struct DirNode{
+            std::string name;                       // 本级目录名
+            uint32_t parent;
+            std::map<std::string, uint32_t> dirs;   // 子目录名 -> 节点编号
+            std::vector<uint32_t> files;            // 按文件名有序的行号
+        };
+
+        std::string_view Leaf(uint32_t row) const { return BaseName(table_->Name(row)); }
+
+        std::vector<uint32_t>::const_iterator LowerBound(const std::vector<uint32_t> &files, std::string_view leaf) const
+        {
+            return std::lower_bound(files.begin(), files.end(), leaf,
+                [this](uint32_t row, std::string_view key){ return Leaf(row) < key; });
+        }
+
+        std::vector<uint32_t>::const_iterator UpperBound(const std::vector<uint32_t> &files, std::string_view leaf) const
+        {
+            return std::upper_bound(files.begin(), files.end(), leaf,
+                [this](std::string_view key, uint32_t row){ return key < Leaf(row); });
+        }
+
+        // 按Scan的顺序输出top子树中排在after(相对top的路径)之后的文件，不超出top，达到limit返回false
+        bool ScanFrom(uint32_t top, std::string_view after, size_t limit, std::vector<uint32_t> *rows) const
+        {
+            if (after.empty())
+            {
+                Collect(top, limit, rows);
+                return rows->size() < limit;
+            }
+
+            std::vector<std::string_view> segs;
+            for (size_t begin = 0; begin <= after.size(); )
+            {
+                size_t end = after.find('/', begin);
+                if (end == std::string_view::npos) end = after.size();
+                segs.push_back(after.substr(begin, end - begin));
+                begin = end + 1;
+            }
+
+            // path[i]为第i层目录节点，尽量沿after向下走
+            std::vector<uint32_t> path{top};
+            while (path.size() < segs.size())
+            {
+                auto &dirs = nodes_[path.back()]->dirs;
+                auto it = dirs.find(std::string(segs[path.size() - 1]));
+                if (it == dirs.end()) break;
+                path.push_back(it->second);
+            }
+
+            size_t depth = path.size() - 1;
+            const DirNode *n = nodes_[path.back()].get();
+            if (depth == segs.size() - 1)
+            {
+                // after所在目录仍存在：输出同目录中排在其后的文件
+                for (auto it = UpperBound(n->files, segs.back()); it != n->files.end(); ++it)
+                {
+                    if (rows->size() >= limit) return false;
+                    rows->push_back(*it);
+                }
+            }
+            else
+            {
+                // 目录已不存在：输出排在它之后的兄弟目录以及本目录的文件
+                if (!CollectAfter(path.back(), segs[depth], limit, rows)) return false;
+            }
+
+            for (; depth > 0; depth--)
+                if (!CollectAfter(path[depth - 1], segs[depth - 1], limit, rows)) return false;
+            return rows->size() < limit;
+        }
+
+        // 输出dir中名字大于name的子目录的整棵子树以及dir的全部文件，达到limit返回false
+        bool CollectAfter(uint32_t dir, std::string_view name, size_t limit, std::vector<uint32_t> *rows) const
+        {
+            const DirNode *n = nodes_[dir].get();
+            for (auto it = n->dirs.upper_bound(std::string(name)); it != n->dirs.end(); ++it)
+            {
+                Collect(it->second, limit, rows);
+                if (rows->size() >= limit) return false;
+            }
+            for (uint32_t row : n->files)
+            {
+                if (rows->size() >= limit) return false;
+                rows->push_back(row);
+            }
+            return rows->size() < limit;
+        }
+
+        uint32_t FindDir(std::string_view path) const
+        {
+            uint32_t dir = kRoot;
+            size_t begin = 0;
+            while (begin < path.size())
+            {
+                size_t end = path.find('/', begin);
+                if (end == std::string_view::npos) end = path.size();
+                auto &dirs = nodes_[dir]->dirs;
+                auto it = dirs.find(std::string(path.substr(begin, end - begin)));
+                if (it == dirs.end()) return npos;
+                dir = it->second;
+                begin = end + 1;
+            }
+            return dir;
+        }
+
+        uint32_t MakeDir(std::string_view path)
+        {
+            uint32_t dir = kRoot;
+            size_t begin = 0;
+            while (begin < path.size())
+            {
+                size_t end = path.find('/', begin);
+                if (end == std::string_view::npos) end = path.size();
+                std::string seg(path.substr(begin, end - begin));
+                auto it = nodes_[dir]->dirs.find(seg);
+                if (it != nodes_[dir]->dirs.end()) dir = it->second;
+                else
+                {
+                    uint32_t id = NewNode(seg, dir);
+                    nodes_[dir]->dirs.emplace(std::move(seg), id);
+                    dir = id;
+                }
+                begin = end + 1;
+            }
+            return dir;
+        }
+
+        uint32_t NewNode(const std::string &name, uint32_t parent)
+        {
+            if (!free_nodes_.empty())
+            {
+                uint32_t id = free_nodes_.back();
+                free_nodes_.pop_back();
+                nodes_[id].reset(new DirNode{name, parent, {}, {}});
+                return id;
+            }
+            nodes_.emplace_back(new DirNode{name, parent, {}, {}});
+            return nodes_.size() - 1;
+        }
+
+        // 自下而上回收空目录
+        void Prune(uint32_t dir)
+        {
+            while (dir != kRoot && nodes_[dir]->dirs.empty() && nodes_[dir]->files.empty())
+            {
+                uint32_t parent = nodes_[dir]->parent;
+                nodes_[parent]->dirs.erase(nodes_[dir]->name);
+                nodes_[dir].reset();
+                free_nodes_.push_back(dir);
+                dir = parent;
+            }
+        }
+
+        void Collect(uint32_t dir, size_t limit, std::vector<uint32_t> *rows) const
+        {
+            const DirNode *n = nodes_[dir].get();
+            for (auto &d : n->dirs)
+            {
+                if (limit && rows->size() >= limit) return;
+                Collect(d.second, limit, rows);
+            }
+            for (uint32_t row : n->files)
+            {
+                if (limit && rows->size() >= limit) return;
+                rows->push_back(row);
+            }
+        }
+
+    private:
+        const MetaTable *table_;
+        std::vector<std::unique_ptr<DirNode>> nodes_;   // 0号为根目录
+        std::vector<uint32_t> free_nodes_;
+        std::vector<uint32_t> row_dir_;                 // 行号 -> 所在目录节点
+    }; // class NamespaceIndex
+}
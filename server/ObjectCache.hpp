@@ -0,0 +1,230 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <functional>
+#include "Config.hpp"
+
+namespace storage{
+    // Count-Min Sketch，估计一个键最近被访问的次数。每个计数器最大15，
+    // 累计记录次数达到sample_size后全部减半，使旧的热度逐渐衰减
+    class FrequencySketch{
+    public:
+        explicit FrequencySketch(size_t width)
+        {
+            size_t w = 64;
+            while (w < width) w <<= 1;
+            mask_ = w - 1;
+            for (auto &row : rows_) row.assign(w, 0);
+            sample_size_ = w * 10;
+        }
+
+        void Increment(uint64_t h)
+        {
+            bool added = false;
+            for (int i = 0; i < kDepth; i++)
+            {
+                uint8_t &c = rows_[i][Index(h, i)];
+                if (c < 15) { c++; added = true; }
+            }
+            if (added && ++additions_ >= sample_size_) Reset();
+        }
+
+        int Estimate(uint64_t h) const
+        {
+            int f = 15;
+            for (int i = 0; i < kDepth; i++) f = std::min<int>(f, rows_[i][Index(h, i)]);
+            return f;
+        }
+
+    private:
+        static constexpr int kDepth = 4;
+
+        size_t Index(uint64_t h, int i) const
+        {
+            static const uint64_t seeds[kDepth] = {0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x27D4EB2F165667C5ull};
+            uint64_t x = (h + seeds[i]) * seeds[(i + 1) % kDepth];
+            return (x ^ (x >> 32)) & mask_;
+        }
+
+        void Reset()
+        {
+            for (auto &row : rows_)
+                for (auto &c : row) c >>= 1;
+            additions_ /= 2;
+        }
+
+    private:
+        std::vector<uint8_t> rows_[kDepth];
+        size_t mask_;
+        size_t sample_size_;
+        size_t additions_ = 0;
+    }; // class FrequencySketch
+
+    // 小文件内容缓存，按字节数限制容量，采用W-TinyLFU：
+    //   新对象先进入占总容量1%的窗口LRU；被挤出窗口时，与主区(SLRU：试用段+保护段)的淘汰候选比较
+    //   近期访问频率，频率更高者留下。这样一次性的大量访问不会冲掉真正的热点。
+    // 键为下载URL，条目同时记下ETag，ETag不符(文件已被覆盖)的条目视为失效。
+    // 内容以shared_ptr持有，发送时通过evbuffer_add_reference引用，响应发完才释放
+    class ObjectCache{
+    public:
+        using Data = std::shared_ptr<const string>;
+
+        static ObjectCache& GetObjectCache()
+        {
+            static ObjectCache cache;
+            return cache;
+        }
+
+        // 命中时返回内容，并记录一次访问
+        Data Get(const string &url, const string &etag)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            sketch_.Increment(Hash(url));
+            auto it = index_.find(url);
+            if (it == index_.end())
+            {
+                misses_.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            auto e = it->second;
+            if (e->etag != etag)
+            {
+                EraseLocked(e);
+                misses_.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            Touch(e);
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return e->data;
+        }
+
+        // 未命中后是否值得把内容读入缓存：大小合适且最近被访问过不止一次
+        bool ShouldAdmit(const string &url, size_t size)
+        {
+            if (size > max_object_ || size > window_cap_ + main_cap_) return false;
+            std::lock_guard<std::mutex> lock(mutex_);
+            return sketch_.Estimate(Hash(url)) >= 2;
+        }
+
+        void Put(const string &url, const string &etag, Data data)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = index_.find(url);
+            if (it != index_.end()) EraseLocked(it->second);
+            window_.push_front({url, etag, std::move(data), kWindow});
+            index_[url] = window_.begin();
+            window_used_ += window_.front().data->size();
+            while (window_used_ > window_cap_ && !window_.empty()) EvictFromWindow();
+        }
+
+        void Invalidate(const string &url)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = index_.find(url);
+            if (it != index_.end()) EraseLocked(it->second);
+        }
+
+        size_t Bytes()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return window_used_ + probation_used_ + protected_used_;
+        }
+
+        uint64_t Hits() const { return hits_.load(std::memory_order_relaxed); }
+        uint64_t Misses() const { return misses_.load(std::memory_order_relaxed); }
+
+        ObjectCache(const ObjectCache&) = delete;
+        ObjectCache& operator=(const ObjectCache&) = delete;
+
+    private:
+        enum Segment { kWindow, kProbation, kProtected };
+
+        struct Entry{
+            string url;
+            string etag;
+            Data data;
+            Segment segment;
+        };
+        using List = std::list<Entry>;
+
+        ObjectCache()
+            : sketch_(std::max<size_t>(1024, (size_t)Config::GetConfigData().GetObjectCacheBytes() / 4096))
+        {
+            size_t total = Config::GetConfigData().GetObjectCacheBytes();
+            max_object_ = Config::GetConfigData().GetObjectCacheMaxObject();
+            window_cap_ = std::max(total / 100, std::min(total, max_object_));
+            main_cap_ = total > window_cap_ ? total - window_cap_ : 0;
+            protected_cap_ = main_cap_ / 5 * 4;
+        }
+
+        static uint64_t Hash(const string &url) { return std::hash<string>()(url); }
+
+        List &ListOf(Segment s) { return s == kWindow ? window_ : (s == kProbation ? probation_ : protected_); }
+        size_t &UsedOf(Segment s) { return s == kWindow ? window_used_ : (s == kProbation ? probation_used_ : protected_used_); }
+
+        // 把条目移到segment段的最前端
+        void MoveTo(List::iterator e, Segment s)
+        {
+            size_t size = e->data->size();
+            UsedOf(e->segment) -= size;
+            UsedOf(s) += size;
+            ListOf(s).splice(ListOf(s).begin(), ListOf(e->segment), e);
+            e->segment = s;
+        }
+
+        // 命中：窗口和保护段内移到最前，试用段的晋升到保护段，保护段超限时把最久未用的降回试用段
+        void Touch(List::iterator e)
+        {
+            if (e->segment == kWindow) { MoveTo(e, kWindow); return; }
+            MoveTo(e, kProtected);
+            while (protected_used_ > protected_cap_ && protected_.size() > 1)
+                MoveTo(std::prev(protected_.end()), kProbation);
+        }
+
+        // 窗口最久未用的条目作为候选进入主区；主区放不下时，候选与主区的淘汰对象比较访问频率
+        void EvictFromWindow()
+        {
+            auto cand = std::prev(window_.end());
+            int cand_freq = sketch_.Estimate(Hash(cand->url));
+            size_t size = cand->data->size();
+            while (probation_used_ + protected_used_ + size > main_cap_)
+            {
+                List &from = probation_.empty() ? protected_ : probation_;
+                if (from.empty()) break;
+                auto victim = std::prev(from.end());
+                if (cand_freq <= sketch_.Estimate(Hash(victim->url)))
+                {
+                    EraseLocked(cand);
+                    return;
+                }
+                EraseLocked(victim);
+            }
+            if (probation_used_ + protected_used_ + size > main_cap_) EraseLocked(cand);
+            else MoveTo(cand, kProbation);
+        }
+
+        void EraseLocked(List::iterator e)
+        {
+            UsedOf(e->segment) -= e->data->size();
+            index_.erase(e->url);
+            ListOf(e->segment).erase(e);
+        }
+
+    private:
+        std::mutex mutex_;
+        FrequencySketch sketch_;
+        std::unordered_map<string, List::iterator> index_;
+        List window_, probation_, protected_;
+        size_t window_used_ = 0, probation_used_ = 0, protected_used_ = 0;
+        size_t window_cap_, main_cap_, protected_cap_;
+        size_t max_object_;                                 // 超过该大小的文件不缓存
+        std::atomic<uint64_t> hits_{0};
+        std::atomic<uint64_t> misses_{0};
+    }; // class ObjectCache
+}
@@ -0,0 +1,221 @@
+#pragma once
+#include <ctime>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "DataManager.hpp"
+
+namespace storage{
+    // 小文件打包存储(类似Haystack)：小对象依次追加到大的段文件中，每个对象不再单独占用inode和目录项，
+    // 下载时按元数据中的(段号, 偏移, 长度)直接从段文件发送。段写满后换新段，已写满的段只读。
+    // 删除或覆盖只是不再引用段中的数据，后台整理把引用比例过低的段中仍有效的对象搬到当前段，再删除旧段。
+    // 段中只有对象数据，位置记录在元数据中
+    class PackStore{
+    public:
+        static PackStore& GetPackStore()
+        {
+            static PackStore store;
+            return store;
+        }
+
+        bool Accepts(size_t len) const { return max_object_ > 0 && len <= max_object_; }
+
+        // 追加一个对象，成功时location为其位置(见StorageInfo::pack_)
+        bool Append(const char *data, size_t len, uint64_t *location)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if ((fd_ == -1 || (size_ > 0 && size_ + len > segment_bytes_)) && !RollLocked()) return false;
+            size_t done = 0;
+            while (done < len)
+            {
+                ssize_t n = pwrite(fd_, data + done, len - done, size_ + done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0)
+                {
+                    mylog::GetLogger("asynclogger")->Error("append to pack segment %u failed: %s", segment_, strerror(errno));
+                    return false;                           // 写了一部分的数据由下一次追加覆盖
+                }
+                done += n;
+            }
+            *location = StorageInfo::PackLocation(segment_, size_);
+            size_ += len;
+            return true;
+        }
+
+        void Start()
+        {
+            if (compact_interval_ <= 0) return;
+            std::thread([this]{
+                while (true)
+                {
+                    std::this_thread::sleep_for(std::chrono::seconds(compact_interval_));
+                    Compact();
+                }
+            }).detach();
+        }
+
+        // 整理一遍已写满的段，返回回收的字节数
+        uint64_t Compact()
+        {
+            DataManager &dm = DataManager::GetDataManager();
+            std::unordered_map<uint32_t, uint64_t> live;
+            dm.PackLiveBytes(&live);
+            uint32_t active;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                active = segment_;
+            }
+
+            uint64_t reclaimed = 0;
+            time_t now = time(nullptr);
+            for (uint32_t seg : ListSegments())
+            {
+                if (seg == active) continue;
+                struct stat st;
+                string path = StorageInfo::PackSegmentPath(seg);
+                // 刚换下的段上可能还有写入完成、尚未登记到元数据的对象
+                if (stat(path.c_str(), &st) == -1 || st.st_mtime + kSettleSecs > now) continue;
+                uint64_t used = live.count(seg) ? live[seg] : 0;
+                if (used > 0 && (double)used >= (double)st.st_size * compact_ratio_) continue;
+                if (used > 0 && !MoveLive(seg)) continue;
+
+                // 搬走后再确认没有记录引用该段(如搬移期间被改名的对象)
+                std::unordered_map<uint32_t, uint64_t> check;
+                dm.PackLiveBytes(&check);
+                if (check.count(seg)) continue;
+                if (unlink(path.c_str()) == 0)              // 正在发送该段的下载已打开fd，不受影响
+                {
+                    reclaimed += st.st_size - used;
+                    mylog::GetLogger("asynclogger")->Info("pack segment %u compacted, %lu of %lu bytes were live",
+                        seg, (unsigned long)used, (unsigned long)st.st_size);
+                }
+            }
+            reclaimed_.fetch_add(reclaimed, std::memory_order_relaxed);
+            return reclaimed;
+        }
+
+        size_t Segments() { return ListSegments().size(); }
+        uint64_t Reclaimed() const { return reclaimed_.load(std::memory_order_relaxed); }
+
+        PackStore(const PackStore&) = delete;
+        PackStore& operator=(const PackStore&) = delete;
+
+    private:
+        static constexpr time_t kSettleSecs = 60;
+        static constexpr uint32_t kMaxSegment = (1u << 24) - 1;
+
+        PackStore()
+        {
+            Config &cf = Config::GetConfigData();
+            dir_ = cf.GetPackDir();
+            max_object_ = cf.GetPackMaxObject();
+            segment_bytes_ = cf.GetPackSegmentBytes();
+            compact_ratio_ = cf.GetPackCompactRatio();
+            compact_interval_ = cf.GetPackCompactInterval();
+            // 重启后不再向旧段追加，从新段开始，旧段末尾可能有未登记的数据
+            for (uint32_t seg : ListSegments()) segment_ = std::max(segment_, seg);
+        }
+
+        ~PackStore() { if (fd_ != -1) close(fd_); }
+
+        bool RollLocked()
+        {
+            if (segment_ >= kMaxSegment)
+            {
+                mylog::GetLogger("asynclogger")->Error("pack segment numbers exhausted");
+                return false;
+            }
+            FileUtil(dir_).CreateDirectory();
+            string path = StorageInfo::PackSegmentPath(segment_ + 1);
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd == -1)
+            {
+                mylog::GetLogger("asynclogger")->Error("open pack segment %s failed: %s", path.c_str(), strerror(errno));
+                return false;
+            }
+            if (fd_ != -1) close(fd_);
+            fd_ = fd;
+            segment_++;
+            size_ = 0;
+            return true;
+        }
+
+        // 把段中仍被引用的对象追加到当前段并更新元数据，全部成功时返回true
+        bool MoveLive(uint32_t seg)
+        {
+            std::vector<StorageInfo> files;
+            DataManager::GetDataManager().PackedIn(seg, &files);
+            int fd = open(StorageInfo::PackSegmentPath(seg).c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1) return false;
+            std::vector<std::pair<StorageInfo, StorageInfo>> moves;
+            string data;
+            bool ok = true;
+            for (auto &f : files)
+            {
+                data.resize(f.fsize_);
+                uint64_t location;
+                if (!ReadAt(fd, &data[0], f.fsize_, f.PackOffset()) || !Append(data.data(), data.size(), &location))
+                {
+                    ok = false;
+                    break;
+                }
+                StorageInfo moved = f;
+                moved.pack_ = location;
+                moves.emplace_back(f, moved);
+            }
+            close(fd);
+            // 搬移期间被删除或覆盖的对象不再替换，追加的副本成为新段中的无效数据
+            std::vector<bool> done;
+            DataManager::GetDataManager().ReplaceIf(moves, &done);
+            return ok;
+        }
+
+        static bool ReadAt(int fd, char *buf, size_t len, uint64_t offset)
+        {
+            size_t done = 0;
+            while (done < len)
+            {
+                ssize_t n = pread(fd, buf + done, len - done, offset + done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                done += n;
+            }
+            return true;
+        }
+
+        // 目录中已有的段号
+        std::vector<uint32_t> ListSegments()
+        {
+            std::vector<uint32_t> segs;
+            std::vector<string> paths;
+            if (!FileUtil(dir_).Exists() || !FileUtil(dir_).ScanDirectory(&paths)) return segs;
+            for (auto &path : paths)
+            {
+                unsigned seg;
+                char tail[8];
+                if (sscanf(path.c_str() + path.find_last_of('/') + 1, "%u.%7s", &seg, tail) == 2 && strcmp(tail, "pack") == 0 && seg > 0)
+                    segs.push_back(seg);
+            }
+            return segs;
+        }
+
+    private:
+        std::mutex mutex_;                                  // 保护当前段
+        string dir_;
+        uint32_t segment_ = 0;                              // 当前段号，0表示还没有打开
+        int fd_ = -1;
+        uint64_t size_ = 0;                                 // 当前段已写入的字节数
+        size_t max_object_;
+        size_t segment_bytes_;
+        double compact_ratio_;
+        int compact_interval_;
+        std::atomic<uint64_t> reclaimed_{0};
+    }; // class PackStore
+}
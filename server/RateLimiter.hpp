@@ -0,0 +1,115 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <event2/event.h>
+#include <event2/bufferevent.h>
+#include "Config.hpp"
+
+namespace storage{
+    // 令牌桶限速，由libevent在读写socket时执行：
+    //   全局：所有连接加入同一个bufferevent_rate_limit_group，共享总带宽；
+    //   每个客户端IP：该IP的带宽平均分给它的各个连接，连接建立或断开时重新分配，
+    //   开多个连接不能多占带宽。
+    // 读方向即上传的请求体，写方向即下载的响应，分别配置。只在事件循环线程中使用
+    class RateLimiter{
+    public:
+        static RateLimiter& GetRateLimiter()
+        {
+            static RateLimiter limiter;
+            return limiter;
+        }
+
+        void Init(event_base *base)
+        {
+            Config &cf = Config::GetConfigData();
+            global_up_ = cf.GetGlobalUploadRate();
+            global_down_ = cf.GetGlobalDownloadRate();
+            client_up_ = cf.GetClientUploadRate();
+            client_down_ = cf.GetClientDownloadRate();
+            if (global_up_ == 0 && global_down_ == 0) return;
+            ev_token_bucket_cfg *cfg = NewCfg(global_up_, global_down_);
+            group_ = bufferevent_rate_limit_group_new(base, cfg);   // group保存cfg的副本
+            ev_token_bucket_cfg_free(cfg);
+            // 每个连接每次至少分到一个TCP报文的量，避免总带宽紧张时产生大量小包
+            if (group_) bufferevent_rate_limit_group_set_min_share(group_, 1460);
+        }
+
+        // 新连接，此时还不知道对端地址
+        void AddConnection(bufferevent *bev)
+        {
+            if (group_) bufferevent_add_to_rate_limit_group(bev, group_);
+        }
+
+        // 得知连接的对端IP后调用，与Detach成对
+        void Attach(const string &ip, bufferevent *bev)
+        {
+            if (client_up_ == 0 && client_down_ == 0) return;
+            Client &c = clients_[ip];
+            c.conns.push_back(bev);
+            Rebalance(&c);
+        }
+
+        void Detach(const string &ip, bufferevent *bev)
+        {
+            auto it = clients_.find(ip);
+            if (it == clients_.end()) return;
+            Client &c = it->second;
+            auto pos = std::find(c.conns.begin(), c.conns.end(), bev);
+            if (pos == c.conns.end()) return;
+            c.conns.erase(pos);
+            bufferevent_set_rate_limit(bev, nullptr);
+            if (c.conns.empty())
+            {
+                ev_token_bucket_cfg_free(c.cfg);
+                clients_.erase(it);
+                return;
+            }
+            Rebalance(&c);
+        }
+
+        size_t Clients() const { return clients_.size(); }
+
+        RateLimiter(const RateLimiter&) = delete;
+        RateLimiter& operator=(const RateLimiter&) = delete;
+
+    private:
+        static constexpr long kTickMs = 100;                // 令牌每100ms补充一次，使速率平滑
+
+        struct Client{
+            std::vector<bufferevent *> conns;
+            ev_token_bucket_cfg *cfg = nullptr;             // conns共用，替换前须先让所有连接改用新的
+        };
+
+        RateLimiter() = default;
+
+        // rate为每秒字节数，0表示不限；桶容量为两个tick的量
+        static ev_token_bucket_cfg *NewCfg(size_t up, size_t down)
+        {
+            size_t up_tick = up ? std::max<size_t>(1, up * kTickMs / 1000) : EV_RATE_LIMIT_MAX;
+            size_t down_tick = down ? std::max<size_t>(1, down * kTickMs / 1000) : EV_RATE_LIMIT_MAX;
+            size_t up_burst = up ? up_tick * 2 : EV_RATE_LIMIT_MAX;
+            size_t down_burst = down ? down_tick * 2 : EV_RATE_LIMIT_MAX;
+            timeval tick = {0, kTickMs * 1000};
+            return ev_token_bucket_cfg_new(up_tick, up_burst, down_tick, down_burst, &tick);
+        }
+
+        void Rebalance(Client *c)
+        {
+            size_t n = c->conns.size();
+            ev_token_bucket_cfg *cfg = NewCfg(client_up_ ? std::max<size_t>(1, client_up_ / n) : 0,
+                                              client_down_ ? std::max<size_t>(1, client_down_ / n) : 0);
+            if (cfg == nullptr) return;
+            for (auto bev : c->conns) bufferevent_set_rate_limit(bev, cfg);
+            if (c->cfg) ev_token_bucket_cfg_free(c->cfg);
+            c->cfg = cfg;
+        }
+
+    private:
+        size_t global_up_ = 0, global_down_ = 0;
+        size_t client_up_ = 0, client_down_ = 0;
+        bufferevent_rate_limit_group *group_ = nullptr;
+        std::unordered_map<string, Client> clients_;
+    }; // class RateLimiter
+}
@@ -0,0 +1,160 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include "MetaTable.hpp"
+#include "Namespace.hpp"
+#include "Listing.hpp"
+
+namespace storage{
+    // 文件名搜索索引，按文件名(路径最后一段，不区分ASCII大小写)建立：
+    //   1. 按名字排序的行号数组，用于前缀匹配；
+    //   2. 三元组(连续3字节)倒排表，每个三元组对应按行号有序的数组，用于子串匹配。
+    // 名字取自MetaTable，目录重命名不影响索引。非线程安全，由DataManager的读写锁保护
+    class SearchIndex{
+    public:
+        explicit SearchIndex(const MetaTable *table)
+            : table_(table), by_name_(NameLess{table}) {}
+
+        // 新行写入MetaTable之后调用
+        void Add(uint32_t row)
+        {
+            by_name_.Insert(row);
+            std::string name = Lower(Leaf(table_, row));
+            for (uint32_t tri : Trigrams(name))
+            {
+                auto &list = postings_[tri];
+                list.insert(std::lower_bound(list.begin(), list.end(), row), row);
+            }
+        }
+
+        // 必须在MetaTable删除该行之前调用
+        void Remove(uint32_t row)
+        {
+            by_name_.Erase(row);
+            std::string name = Lower(Leaf(table_, row));
+            for (uint32_t tri : Trigrams(name))
+            {
+                auto it = postings_.find(tri);
+                if (it == postings_.end()) continue;
+                auto &list = it->second;
+                auto pos = std::lower_bound(list.begin(), list.end(), row);
+                if (pos != list.end() && *pos == row) list.erase(pos);
+                if (list.empty()) postings_.erase(it);
+            }
+        }
+
+        // 返回按相关度排序的至多limit个行号：完全匹配 > 前缀匹配 > 子串匹配，同级按名字短者优先
+        void Search(std::string_view query, size_t limit, std::vector<uint32_t> *rows) const
+        {
+            std::string q = Lower(query);
+            if (q.empty() || limit == 0) return;
+
+            // 前缀匹配：在有序数组中从q开始顺序取，完全匹配自然排在最前
+            std::vector<uint32_t> prefix;
+            by_name_.VisitFrom(q, KeyLess{table_}, [&](uint32_t row){
+                std::string name = Lower(Leaf(table_, row));
+                if (name.compare(0, q.size(), q) != 0 || prefix.size() >= limit) return false;
+                prefix.push_back(row);
+                return true;
+            });
+            std::stable_sort(prefix.begin(), prefix.end(), [this](uint32_t a, uint32_t b){
+                return Leaf(table_, a).size() < Leaf(table_, b).size();
+            });
+            rows->insert(rows->end(), prefix.begin(), prefix.end());
+            if (rows->size() >= limit || q.size() < 3) return;
+
+            // 子串匹配：求各三元组倒排表的交集，再逐个确认
+            std::vector<const std::vector<uint32_t> *> lists;
+            for (uint32_t tri : Trigrams(q))
+            {
+                auto it = postings_.find(tri);
+                if (it == postings_.end()) return;
+                lists.push_back(&it->second);
+            }
+            std::sort(lists.begin(), lists.end(), [](auto a, auto b){ return a->size() < b->size(); });
+
+            std::vector<std::pair<size_t, uint32_t>> found;  // (名字长度, 行号)
+            size_t checked = 0;
+            for (uint32_t row : *lists[0])
+            {
+                if (checked++ >= kMaxCandidates) break;
+                bool in_all = true;
+                for (size_t i = 1; i < lists.size() && in_all; i++)
+                    in_all = std::binary_search(lists[i]->begin(), lists[i]->end(), row);
+                if (!in_all) continue;
+                std::string name = Lower(Leaf(table_, row));
+                if (name.find(q) == std::string::npos || name.compare(0, q.size(), q) == 0) continue;
+                found.emplace_back(name.size(), row);
+            }
+            size_t want = std::min(found.size(), limit - rows->size());
+            std::partial_sort(found.begin(), found.begin() + want, found.end());
+            for (size_t i = 0; i < want; i++) rows->push_back(found[i].second);
+        }
+
+    private:
+        static constexpr size_t kMaxCandidates = 50000;     // 单次查询最多确认的候选数，限制最坏耗时
+
+        static std::string_view Leaf(const MetaTable *table, uint32_t row)
+        {
+            return NamespaceIndex::BaseName(table->Name(row));
+        }
+
+        static std::string Lower(std::string_view s)
+        {
+            std::string out(s);
+            for (auto &c : out) if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+            return out;
+        }
+
+        static int CompareLower(std::string_view a, std::string_view b)
+        {
+            size_t n = std::min(a.size(), b.size());
+            for (size_t i = 0; i < n; i++)
+            {
+                unsigned char x = a[i], y = b[i];
+                if (x >= 'A' && x <= 'Z') x += 'a' - 'A';
+                if (y >= 'A' && y <= 'Z') y += 'a' - 'A';
+                if (x != y) return x < y ? -1 : 1;
+            }
+            return a.size() == b.size() ? 0 : (a.size() < b.size() ? -1 : 1);
+        }
+
+        // 去重后的三元组
+        static std::vector<uint32_t> Trigrams(const std::string &s)
+        {
+            std::vector<uint32_t> tris;
+            for (size_t i = 0; i + 3 <= s.size(); i++)
+                tris.push_back((uint8_t)s[i] << 16 | (uint8_t)s[i + 1] << 8 | (uint8_t)s[i + 2]);
+            std::sort(tris.begin(), tris.end());
+            tris.erase(std::unique(tris.begin(), tris.end()), tris.end());
+            return tris;
+        }
+
+        // 按(小写名字, 行号)排序，保证同名文件也能被精确删除
+        struct NameLess{
+            const MetaTable *table;
+            bool operator()(uint32_t a, uint32_t b) const
+            {
+                int c = CompareLower(Leaf(table, a), Leaf(table, b));
+                return c != 0 ? c < 0 : a < b;
+            }
+        };
+
+        struct KeyLess{
+            const MetaTable *table;
+            bool operator()(uint32_t row, const std::string &key) const
+            {
+                return CompareLower(Leaf(table, row), key) < 0;
+            }
+        };
+
+    private:
+        const MetaTable *table_;
+        SortedBlocks<uint32_t, NameLess> by_name_;
+        std::unordered_map<uint32_t, std::vector<uint32_t>> postings_;
+    }; // class SearchIndex
+}
@@ -1,5 +1,19 @@
 #pragma once
 #include "DataManager.hpp"
+#include "Session.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "ObjectCache.hpp"
+#include "FdCache.hpp"
+#include "StaticAssets.hpp"
+#include "Template.hpp"
+#include "HttpRange.hpp"
+#include "RateLimiter.hpp"
+#include "Admission.hpp"
+#include "Tiering.hpp"
+#include "PackStore.hpp"
+#include "StorageRoots.hpp"
+#include "ErasureStore.hpp"
 
 #include <sys/queue.h>
 #include <event.h>
@@ -8,15 +22,27 @@
 #include <event2/http.h>
 
 #include <fcntl.h>
+#include <sys/eventfd.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 
-#include <regex> // 正则表达式
 #include <queue>
+#include <mutex>
+#include <functional>
+#include <unordered_set>
 
 #include "base64.h"
 
 namespace storage{
     class Server{
+        using SegmentPtr = std::unique_ptr<evbuffer_file_segment, void (*)(evbuffer_file_segment *)>;
+        // 响应内容的一段：seg中从base开始的len字节。纠删码存储的对象每个数据分片一段，其余存储只有一段
+        struct BodyPiece{
+            evbuffer_file_segment *seg;
+            int fd;                                         // seg所属的fd，用于pread
+            size_t base;
+            size_t len;
+        };
     public:
         Server()
         {
@@ -27,6 +53,7 @@ namespace storage{
             server_port_ = cf_data.GetServerPort();
             server_ip_ = cf_data.GetServerIP();
             download_prefix_ = cf_data.GetDownLoadPrefix();
+            max_connections_ = cf_data.GetMaxConnections();
 #ifdef DEBUG_LOG
             mylog::GetLogger("asynclogger")->Debug("Server Construct end");
 #endif
@@ -50,6 +77,71 @@ namespace storage{
 
             // 设置全局回调函数对所有的URL响应
             evhttp_set_gencb(httpd, GenHandler, nullptr);
+            // 连接的bufferevent由这里创建，在读入第一个字节之前就加入限速
+            RateLimiter::GetRateLimiter().Init(base);
+            evhttp_set_bevcb(httpd, NewConnection, nullptr);
+            // 请求大小和读写超时由libevent执行，超过时直接回413或断开连接
+            Config &cf = Config::GetConfigData();
+            evhttp_set_max_body_size(httpd, cf.GetMaxBodySize());
+            evhttp_set_max_headers_size(httpd, cf.GetMaxHeadersSize());
+            timeval http_timeout = {cf.GetHttpTimeout(), 0};
+            evhttp_set_timeout_tv(httpd, &http_timeout);
+
+            SessionManager::GetSessionManager();   // 启动会话过期线程
+            Tracer::GetTracer();                   // 校准TSC
+            Metrics &metrics = Metrics::GetMetrics();
+            metrics.AddGauge("storage_files", "Files tracked in metadata.", []{ return (double)DataManager::GetDataManager().Size(); });
+            metrics.AddGauge("storage_metadata_bytes", "Memory used by the metadata table.", []{ return (double)DataManager::GetDataManager().MetadataBytes(); });
+            metrics.AddGauge("storage_sessions", "Live login sessions.", []{ return (double)SessionManager::GetSessionManager().Size(); });
+            metrics.AddGauge("storage_object_cache_bytes", "Bytes held by the hot-object cache.", []{ return (double)ObjectCache::GetObjectCache().Bytes(); });
+            metrics.AddGauge("storage_object_cache_hits_total", "Downloads served from the hot-object cache.", []{ return (double)ObjectCache::GetObjectCache().Hits(); }, "counter");
+            metrics.AddGauge("storage_object_cache_misses_total", "Downloads not found in the hot-object cache.", []{ return (double)ObjectCache::GetObjectCache().Misses(); }, "counter");
+            metrics.AddGauge("storage_low_bytes", "Bytes stored in low (uncompressed) storage.", []{ return (double)DataManager::GetDataManager().GetUsage(DataManager::kLow).bytes; });
+            metrics.AddGauge("storage_deep_bytes", "Bytes stored in deep (compressed) storage.", []{ return (double)DataManager::GetDataManager().GetUsage(DataManager::kDeep).bytes; });
+            metrics.AddGauge("storage_ec_bytes", "Bytes stored in erasure-coded storage, before coding.", []{ return (double)DataManager::GetDataManager().GetUsage(DataManager::kErasure).bytes; });
+            metrics.AddGauge("storage_ec_degraded_reads_total", "Erasure-coded downloads that had to reconstruct data fragments.", []{ return (double)ErasureStore::GetErasureStore().DegradedReads(); }, "counter");
+            metrics.AddGauge("storage_ec_repaired_fragments_total", "Erasure fragments rebuilt by the repair job.", []{ return (double)ErasureStore::GetErasureStore().Repaired(); }, "counter");
+            metrics.AddGauge("storage_ec_lost_objects", "Erasure-coded objects with fewer than k intact fragments at the last repair.", []{ return (double)ErasureStore::GetErasureStore().Lost(); });
+            metrics.AddGauge("storage_tier_promoted_total", "Files moved from deep to low storage because they are hot.", []{ return (double)Tiering::GetTiering().Promoted(); }, "counter");
+            metrics.AddGauge("storage_tier_demoted_total", "Files moved from low to deep storage because they are cold.", []{ return (double)Tiering::GetTiering().Demoted(); }, "counter");
+            metrics.AddGauge("storage_pack_reclaimed_bytes_total", "Bytes reclaimed by pack segment compaction.", []{ return (double)PackStore::GetPackStore().Reclaimed(); }, "counter");
+            metrics.AddGauge("storage_upload_sessions", "Chunked uploads in progress.", []{ return (double)Admission::GetAdmission().Uploads(); });
+            metrics.AddGauge("storage_shed_requests_total", "Requests rejected with 503 by admission control.", []{ return (double)Admission::GetAdmission().Shed().load(std::memory_order_relaxed); }, "counter");
+            metrics.AddGauge("storage_fd_cache_files", "Open files held by the download fd cache.", []{ return (double)FdCache::GetFdCache().Size(); });
+            metrics.AddGauge("storage_fd_cache_hits_total", "Downloads that reused a cached fd.", []{ return (double)FdCache::GetFdCache().Hits(); }, "counter");
+            metrics.AddGauge("storage_fd_cache_misses_total", "Downloads that had to open the file.", []{ return (double)FdCache::GetFdCache().Misses(); }, "counter");
+            // 文件被覆盖或删除时使缓存失效
+            DataManager::GetDataManager().AddChangeListener([](const string &url, const string &path){
+                if (!url.empty())
+                {
+                    ObjectCache::GetObjectCache().Invalidate(url);
+                    file_fragments_.Invalidate(url);
+                }
+                FdCache::GetFdCache().Invalidate(path);
+            });
+            // 页面预加载到内存，login.html同时生成压缩版本
+            StaticAssets::GetStaticAssets().Load("./login.html", "text/html;charset=utf-8", true);
+            StaticAssets::GetStaticAssets().Load("./index.html", "text/html;charset=utf-8", false);
+            // 定时关闭过期的缓存fd，重新加载有改动的页面
+            event *sweep = event_new(base, -1, EV_PERSIST, [](evutil_socket_t, short, void *){
+                FdCache::GetFdCache().Sweep();
+                StaticAssets::GetStaticAssets().Refresh();
+                Admission::GetAdmission().Sweep();
+            }, nullptr);
+            timeval sweep_tv = {1, 0};
+            event_add(sweep, &sweep_tv);
+            // 后台线程的结果由RunInLoop交回事件循环线程处理
+            loop_wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            event *wake = event_new(base, loop_wake_fd_, EV_READ | EV_PERSIST, [](evutil_socket_t, short, void *){
+                RunLoopTasks();
+            }, nullptr);
+            event_add(wake, nullptr);
+
+            // 元数据已加载，与磁盘的核对在后台进行，不阻塞服务启动
+            DataManager::GetDataManager().StartReconcile();
+            Tiering::GetTiering().Start();
+            PackStore::GetPackStore().Start();
+            ErasureStore::GetErasureStore().Start();
 
             if (base)
             {
@@ -61,6 +153,9 @@ namespace storage{
                     mylog::GetLogger("asynclogger")->Debug("event_base_dispatch error");
                 }              
             }
+            event_free(sweep);
+            event_free(wake);
+            close(loop_wake_fd_);
             if (httpd) evhttp_free(httpd);
             if (base) event_base_free(base);
             return true;
@@ -69,25 +164,65 @@ namespace storage{
     private:
         static void GenHandler(evhttp_request *req, void *args)
         {
+            uint64_t start_ns = MonotonicNs();
             string path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req));
             path = UrlDecode(path); // 解码
             mylog::GetLogger("asynclogger")->Info("get req, uri_path: %s", path.c_str());
 
             char *client_ip;
             uint16_t client_port;
-            evhttp_connection_get_peer(evhttp_request_get_connection(req), &client_ip, &client_port);
-            LoginManager::GetLoginManager().UpdateRegister();
-            if (std::string(client_ip) == "127.0.0.1" || std::string(client_ip) == "172.18.45.218" || LoginManager::GetLoginManager().CheckLoggedIn(client_ip))
+            evhttp_connection *conn = evhttp_request_get_connection(req);
+            evhttp_connection_get_peer(conn, &client_ip, &client_port);
+            TrackConnection(conn);
+            Metrics::GetMetrics().BytesIn().Add(evbuffer_get_length(evhttp_request_get_input_buffer(req)));
+
+            // 请求头阶段已决定拒绝的上传，请求体已被去掉
+            auto early = early_rejects_.find(conn);
+            if (early != early_rejects_.end())
+            {
+                EarlyReject reject = early->second;
+                early_rejects_.erase(early);
+                evhttp_request_set_on_complete_cb(req, RequestDone, EncodeRequestTag(start_ns, Metrics::kUpload));
+                RejectUpload(req, reject.code, reject.reason);
+                return;
+            }
+
+            Metrics::Route route = Metrics::kOther;
+            if (connections_.size() > max_connections_)
             {
-                if (path.find("/download") != string::npos) Download(req, args);
-                else if (path.find("/delete") != string::npos) Delete(req, args);
+                evhttp_request_set_on_complete_cb(req, RequestDone, EncodeRequestTag(start_ns, route));
+                Shed(req, "too many connections");
+                return;
+            }
+            string sid = SessionId(req);
+            if (Authorized(client_ip, sid))
+            {
+                if (path.compare(0, 10, "/download/") == 0) route = Metrics::kDownload;
+                else if (path.compare(0, 8, "/delete/") == 0) route = Metrics::kDelete;
+                else if (path == "/upload") route = Metrics::kUpload;
+                else if (path == "/list" || path == "/api/files" || path == "/api/search" || path == "/api/usage" || path == "/") route = Metrics::kList;
+                else if (path == "/logOut") route = Metrics::kLogin;
+                // 在处理函数发送响应之前挂上，响应写完时记录耗时
+                evhttp_request_set_on_complete_cb(req, RequestDone, EncodeRequestTag(start_ns, route));
+
+                if (path.compare(0, 10, "/download/") == 0) Download(req, args);
+                else if (path.compare(0, 8, "/delete/") == 0) Delete(req, args);
                 else if (path == "/upload") Upload(req, args);
-                else if (path == "/logOut") LogOut(req, args, client_ip);
+                else if (path == "/list") ListDir(req, args);
+                else if (path == "/api/files") FilesPage(req, args);
+                else if (path == "/api/search") SearchFiles(req, args);
+                else if (path == "/api/usage") UsagePage(req, args);
+                else if (path == "/rename") RenameDir(req, args);
+                else if (path == "/logOut") LogOut(req, args, client_ip, sid);
+                else if (path == "/metrics") MetricsPage(req, args);
+                else if (path == "/admin/trace") TracePage(req, args);
                 else if (path == "/")  ListShow(req, args);    
                 else evhttp_send_error(req, HTTP_NOTFOUND, "Not Found");
             }
             else
             {
+                if (path == "/login") route = Metrics::kLogin;
+                evhttp_request_set_on_complete_cb(req, RequestDone, EncodeRequestTag(start_ns, route));
                 if (path == "/login") 
                     LogIn(req, args);
                 else
@@ -95,9 +230,278 @@ namespace storage{
             }
         }
 
-        static void LogOut(evhttp_request *req, void *args, const char *client_ip)
+        // 开始时间与路由编码进回调参数，避免为每个请求分配内存
+        static void *EncodeRequestTag(uint64_t start_ns, Metrics::Route route)
         {
-            LoginManager::GetLoginManager().LogOut(client_ip);
+            return (void *)(uintptr_t)(start_ns << 3 | route);
+        }
+
+        static void RequestDone(evhttp_request *req, void *arg)
+        {
+            uint64_t tag = (uintptr_t)arg;
+            Metrics::GetMetrics().RequestDone((Metrics::Route)(tag & 7), evhttp_request_get_response_code(req), MonotonicNs() - (tag >> 3));
+        }
+
+        // 过载时拒绝请求：503并建议客户端稍后重试，同时关闭连接以释放资源
+        static void Shed(evhttp_request *req, const char *reason)
+        {
+            Admission::GetAdmission().Shed().fetch_add(1, std::memory_order_relaxed);
+            evkeyvalq *output_headers = evhttp_request_get_output_headers(req);
+            evhttp_add_header(output_headers, "Retry-After", std::to_string(Config::GetConfigData().GetRetryAfter()).c_str());
+            evhttp_add_header(output_headers, "Connection", "close");
+            mylog::GetLogger("asynclogger")->Warn("request shed: %s", reason);
+            // evhttp_send_error会清掉已设置的响应头，这里自己发送
+            evbuffer_add_printf(evhttp_request_get_output_buffer(req), "%s\n", reason);
+            evhttp_send_reply(req, HTTP_SERVUNAVAIL, reason, nullptr);
+        }
+
+        // 连接上字节流的解析位置
+        struct RequestStream{
+            string head;                                    // 正在收集的请求头
+            uint64_t body_left = 0;                         // 当前请求体还没收到的字节数
+            bool off = false;                               // 无法继续跟踪(如分块传输的请求体)
+        };
+        struct EarlyReject{
+            int code;
+            const char *reason;                             // 字符串常量
+        };
+
+        static bufferevent *NewConnection(event_base *base, void *)
+        {
+            bufferevent *bev = bufferevent_socket_new(base, -1, BEV_OPT_CLOSE_ON_FREE);
+            if (bev == nullptr) return nullptr;
+            RateLimiter::GetRateLimiter().AddConnection(bev);
+            evbuffer_add_cb(bufferevent_get_input(bev), InputArrived, bev);
+            return bev;
+        }
+
+        // 连接上读到数据，在evhttp解析之前调用。此时evhttp已设置好bufferevent的回调，回调参数即evhttp_connection
+        static void InputArrived(evbuffer *buf, const evbuffer_cb_info *info, void *arg)
+        {
+            if (info->n_added == 0) return;
+            void *conn = nullptr;
+            bufferevent_getcb((bufferevent *)arg, nullptr, nullptr, nullptr, &conn);
+            if (conn == nullptr) return;
+            TrackConnection((evhttp_connection *)conn);
+            ScanRequestHeads((evhttp_connection *)conn, buf, info->n_added);
+        }
+
+        // 跟踪连接上的字节流，找出每个请求头(请求体的内容不能当作请求头)。
+        // 带Expect: 100-continue的上传在evhttp回100 Continue之前就检查请求头，不能接受的
+        // 把请求改写为无请求体并关闭连接，客户端收到最终状态码后不再发送请求体，被拒绝的分片只花一个往返。
+        // 请求头分多次到达、evhttp已读走一部分时无法改写，按普通流程在收完请求体后拒绝
+        static void ScanRequestHeads(evhttp_connection *conn, evbuffer *buf, size_t n_added)
+        {
+            auto it = streams_.find(conn);
+            if (it == streams_.end()) return;
+            RequestStream &st = it->second;
+            size_t len = evbuffer_get_length(buf);
+            size_t pos = len - n_added;                     // 新数据在buf中的起点
+            size_t max_head = Config::GetConfigData().GetMaxHeadersSize();
+            while (pos < len && !st.off)
+            {
+                if (st.body_left > 0)
+                {
+                    size_t n = std::min<uint64_t>(st.body_left, len - pos);
+                    st.body_left -= n;
+                    pos += n;
+                    continue;
+                }
+                size_t old = st.head.size();
+                size_t n = std::min(len - pos, max_head + 1 - old);
+                evbuffer_ptr from;
+                evbuffer_ptr_set(buf, &from, pos, EVBUFFER_PTR_SET);
+                st.head.resize(old + n);
+                evbuffer_copyout_from(buf, &from, &st.head[old], n);
+                size_t end = st.head.find("\r\n\r\n", old > 3 ? old - 3 : 0);
+                if (end == string::npos)
+                {
+                    if (st.head.size() > max_head) st.off = true;   // evhttp会拒绝该请求
+                    break;
+                }
+                size_t head_len = end + 4;
+                pos += head_len - old;
+                // 整个请求头都还在buf开头、evhttp尚未读取时才能改写
+                bool intact = pos == head_len;
+                CheckRequestHead(conn, buf, &st, intact);
+                st.head.clear();
+            }
+        }
+
+        // 解析一个完整的请求头，记下请求体长度；需要时提前拒绝上传
+        static void CheckRequestHead(evhttp_connection *conn, evbuffer *buf, RequestStream *st, bool intact)
+        {
+            const string &head = st->head;
+            size_t head_len = head.find("\r\n\r\n") + 4;
+            size_t line_end = head.find("\r\n");
+            string first_line = head.substr(0, line_end);
+            evkeyvalq headers;
+            TAILQ_INIT(&headers);
+            std::vector<std::pair<size_t, size_t>> lines;   // 各请求头行在head中的位置，改写时使用
+            for (size_t p = line_end + 2; p < head_len - 2;)
+            {
+                size_t e = head.find("\r\n", p);
+                lines.push_back({p, e - p});
+                size_t colon = head.find(':', p);
+                if (colon < e)
+                {
+                    size_t v = colon + 1;
+                    while (v < e && (head[v] == ' ' || head[v] == '\t')) v++;
+                    size_t ve = e;
+                    while (ve > v && (head[ve - 1] == ' ' || head[ve - 1] == '\t')) ve--;
+                    evhttp_add_header(&headers, head.substr(p, colon - p).c_str(), head.substr(v, ve - v).c_str());
+                }
+                p = e + 2;
+            }
+
+            const char *te = evhttp_find_header(&headers, "Transfer-Encoding");
+            const char *cl = evhttp_find_header(&headers, "Content-Length");
+            uint64_t body = 0;
+            if (te != nullptr || (cl != nullptr && !ParseDecimal(cl, &body)))
+                st->off = true;                             // 无法确定请求体长度，不再跟踪该连接
+            st->body_left = body;
+
+            const char *expect = evhttp_find_header(&headers, "Expect");
+            if (intact && expect != nullptr && strcasecmp(expect, "100-continue") == 0 &&
+                first_line.compare(0, 13, "POST /upload ") == 0 && !st->off)
+            {
+                int code = HTTP_OK;
+                const char *reason = nullptr;
+                char *client_ip;
+                uint16_t client_port;
+                evhttp_connection_get_peer(conn, &client_ip, &client_port);
+                UploadHead u;
+                if (!Authorized(client_ip, SessionId(evhttp_find_header(&headers, "Cookie"))))
+                {
+                    code = 401;
+                    reason = "Login required";
+                }
+                else if (connections_.size() > max_connections_)
+                {
+                    code = HTTP_SERVUNAVAIL;
+                    reason = "too many connections";
+                }
+                else CheckUploadHead(&headers, &u, &code, &reason);
+
+                if (reason != nullptr)
+                {
+                    // 去掉请求体和Expect，evhttp不会再回100 Continue，由GenHandler发送拒绝
+                    string rewritten = first_line + "\r\n";
+                    for (auto &l : lines)
+                    {
+                        string line = head.substr(l.first, l.second);
+                        if (strncasecmp(line.c_str(), "Expect:", 7) == 0 || strncasecmp(line.c_str(), "Content-Length:", 15) == 0 ||
+                            strncasecmp(line.c_str(), "Connection:", 11) == 0)
+                            continue;
+                        rewritten += line + "\r\n";
+                    }
+                    rewritten += "Content-Length: 0\r\nConnection: close\r\n\r\n";
+                    // 响应后连接即关闭，其后的数据不再处理。先停止跟踪并摘掉本连接的回调再改写，
+                    // 否则prepend会再次触发InputArrived，把改写出的字节当作新到的数据扫描
+                    st->off = true;
+                    st->body_left = 0;
+                    st->head.clear();
+                    evbuffer_remove_cb(buf, InputArrived, evhttp_connection_get_bufferevent(conn));
+                    evbuffer_drain(buf, head_len);
+                    evbuffer_prepend(buf, rewritten.data(), rewritten.size());
+                    early_rejects_[conn] = {code, reason};
+                    mylog::GetLogger("asynclogger")->Warn("upload rejected before body from %s: %d %s", client_ip, code, reason);
+                }
+            }
+            evhttp_clear_headers(&headers);
+        }
+
+        static bool ParseDecimal(const char *s, uint64_t *v)
+        {
+            if (*s < '0' || *s > '9') return false;
+            errno = 0;
+            char *end;
+            unsigned long long n = strtoull(s, &end, 10);
+            if (errno != 0 || *end != '\0') return false;
+            *v = n;
+            return true;
+        }
+
+        // 连接第一次收到数据时计入连接数、按对端IP限速，并统计其后写到socket的字节数。只在事件循环线程中调用
+        static void TrackConnection(evhttp_connection *conn)
+        {
+            if (!connections_.insert(conn).second) return;
+            Metrics::GetMetrics().Connections().fetch_add(1, std::memory_order_relaxed);
+            char *ip;
+            uint16_t port;
+            evhttp_connection_get_peer(conn, &ip, &port);
+            RateLimiter::GetRateLimiter().Attach(ip, evhttp_connection_get_bufferevent(conn));
+            streams_.emplace(conn, RequestStream());
+            evhttp_connection_set_closecb(conn, [](evhttp_connection *c, void *){
+                connections_.erase(c);
+                streams_.erase(c);
+                early_rejects_.erase(c);
+                waiting_.erase(c);
+                Metrics::GetMetrics().Connections().fetch_sub(1, std::memory_order_relaxed);
+                char *ip;
+                uint16_t port;
+                evhttp_connection_get_peer(c, &ip, &port);
+                RateLimiter::GetRateLimiter().Detach(ip, evhttp_connection_get_bufferevent(c));
+            }, nullptr);
+            evbuffer_add_cb(bufferevent_get_output(evhttp_connection_get_bufferevent(conn)),
+                [](evbuffer *, const evbuffer_cb_info *info, void *){
+                    if (info->n_deleted) Metrics::GetMetrics().BytesOut().Add(info->n_deleted);
+                }, nullptr);
+        }
+
+        // GET /admin/trace[?clear=1] 导出慢请求的各阶段耗时
+        static void TracePage(evhttp_request *req, void *args)
+        {
+            evkeyvalq params;
+            evhttp_parse_query_str(evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req)), &params);
+            const char *clear = evhttp_find_header(&params, "clear");
+            string body = Tracer::GetTracer().Dump(clear != nullptr && string(clear) == "1");
+            evhttp_clear_headers(&params);
+            evbuffer_add(evhttp_request_get_output_buffer(req), body.data(), body.size());
+            evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type", "application/json;charset=utf-8");
+            evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+        }
+
+        static void MetricsPage(evhttp_request *req, void *args)
+        {
+            string body = Metrics::GetMetrics().Render();
+            evbuffer_add(evhttp_request_get_output_buffer(req), body.data(), body.size());
+            evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+            evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+        }
+
+        // 本机和内网前端免登录，其余请求需要有效的会话
+        static bool Authorized(const char *client_ip, const string &sid)
+        {
+            return std::string(client_ip) == "127.0.0.1" || std::string(client_ip) == "172.18.45.218" || SessionManager::GetSessionManager().Check(sid);
+        }
+
+        static string SessionId(evhttp_request *req)
+        {
+            return SessionId(evhttp_find_header(evhttp_request_get_input_headers(req), "Cookie"));
+        }
+
+        // 从Cookie头中取出会话令牌sid
+        static string SessionId(const char *cookie)
+        {
+            if (cookie == nullptr) return "";
+            std::string_view sv(cookie);
+            while (!sv.empty())
+            {
+                size_t end = sv.find(';');
+                std::string_view item = sv.substr(0, end);
+                while (!item.empty() && item.front() == ' ') item.remove_prefix(1);
+                if (item.compare(0, 4, "sid=") == 0) return string(item.substr(4));
+                if (end == std::string_view::npos) break;
+                sv.remove_prefix(end + 1);
+            }
+            return "";
+        }
+
+        static void LogOut(evhttp_request *req, void *args, const char *client_ip, const string &sid)
+        {
+            SessionManager::GetSessionManager().Destroy(sid);
+            evhttp_add_header(evhttp_request_get_output_headers(req), "Set-Cookie", "sid=; Path=/; Max-Age=0; HttpOnly; SameSite=Strict");
             mylog::GetLogger("asynclogger")->Info("IP: %s log out", client_ip);
             LoginPage(req, args);
         }
@@ -128,7 +532,14 @@ namespace storage{
                 return;
             }
 
-            LoginManager::GetLoginManager().Login(client_ip);
+            string sid;
+            if (!SessionManager::GetSessionManager().Create(&sid))
+            {
+                evhttp_send_error(req, HTTP_SERVUNAVAIL, "too many sessions");
+                return;
+            }
+            string cookie = "sid=" + sid + "; Path=/; Max-Age=" + std::to_string(SessionManager::GetSessionManager().Timeout()) + "; HttpOnly; SameSite=Strict";
+            evhttp_add_header(evhttp_request_get_output_headers(req), "Set-Cookie", cookie.c_str());
             mylog::GetLogger("asynclogger")->Info("IP: %s register", client_ip);
             evhttp_send_reply(req, HTTP_OK, "Ok", nullptr);
             // ListShow(req, args);
@@ -136,106 +547,404 @@ namespace storage{
 
         static void LoginPage(evhttp_request *req, void *args)
         {
-            if (!FileUtil("./login.html").Exists())
+            StaticAssets::AssetPtr page = StaticAssets::GetStaticAssets().Get("./login.html");
+            if (!page)
             {
                 mylog::GetLogger("asynclogger")->Error("login.html not exist!");
                 evhttp_send_error(req, HTTP_INTERNAL, "server error");
                 return;
             }
+            SendAsset(req, *page);
+            mylog::GetLogger("asynclogger")->Info("login page show");
+        }
+
+        // 发送预加载的静态文件：按Accept-Encoding选择压缩版本，If-None-Match匹配时回304
+        static void SendAsset(evhttp_request *req, const StaticAssets::Asset &asset)
+        {
+            evkeyvalq *input_headers = evhttp_request_get_input_headers(req);
+            evkeyvalq *output_headers = evhttp_request_get_output_headers(req);
+            const char *accept = evhttp_find_header(input_headers, "Accept-Encoding");
+            const StaticAssets::Body *body = &asset.identity;
+            const char *encoding = nullptr;
+            if (asset.br && AcceptsEncoding(accept, "br")) { body = &asset.br; encoding = "br"; }
+            else if (asset.gzip && AcceptsEncoding(accept, "gzip")) { body = &asset.gzip; encoding = "gzip"; }
+            // 不同编码是不同的表示，ETag也要区分
+            string etag = asset.etag;
+            if (encoding) etag.insert(etag.size() - 1, string("-") + encoding);
 
-            int fd = open("login.html", O_RDONLY);
-            if (fd == -1)
+            evhttp_add_header(output_headers, "ETag", etag.c_str());
+            evhttp_add_header(output_headers, "Vary", "Accept-Encoding");
+            evhttp_add_header(output_headers, "Cache-Control", "no-cache");
+            if (ETagMatches(evhttp_find_header(input_headers, "If-None-Match"), etag))
             {
-                mylog::GetLogger("asynclogger")->Error("login.html open failed");
+                evhttp_send_reply(req, HTTP_NOTMODIFIED, "Not Modified", nullptr);
+                return;
+            }
+            evhttp_add_header(output_headers, "Content-Type", asset.content_type.c_str());
+            if (encoding) evhttp_add_header(output_headers, "Content-Encoding", encoding);
+            auto *ref = new StaticAssets::Body(*body);
+            if (evbuffer_add_reference(evhttp_request_get_output_buffer(req), (*body)->data(), (*body)->size(), ReleaseCached, ref) != 0)
+            {
+                delete ref;
                 evhttp_send_error(req, HTTP_INTERNAL, "server error");
                 return;
             }
+            evhttp_send_reply(req, HTTP_OK, "OK", nullptr);
+        }
 
-            evbuffer *output_buf = evhttp_request_get_output_buffer(req);
-            evbuffer_add_file(output_buf, fd, 0, FileUtil("./login.html").FileSize());
-            evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type", "text/html;charset=utf-8");
-            evhttp_send_reply(req, HTTP_OK, nullptr, nullptr);
-            mylog::GetLogger("asynclogger")->Info("login page show");
+        // Accept-Encoding中是否接受coding，忽略q=0的项
+        static bool AcceptsEncoding(const char *header, const char *coding)
+        {
+            if (header == nullptr) return false;
+            std::string_view sv(header);
+            while (!sv.empty())
+            {
+                size_t end = sv.find(',');
+                std::string_view item = sv.substr(0, end);
+                sv.remove_prefix(end == std::string_view::npos ? sv.size() : end + 1);
+                while (!item.empty() && item.front() == ' ') item.remove_prefix(1);
+                size_t semi = item.find(';');
+                std::string_view name = item.substr(0, semi);
+                while (!name.empty() && name.back() == ' ') name.remove_suffix(1);
+                if (name != "*" && !(name.size() == strlen(coding) && strncasecmp(name.data(), coding, name.size()) == 0)) continue;
+                if (semi != std::string_view::npos)
+                {
+                    std::string_view param = item.substr(semi + 1);
+                    while (!param.empty() && param.front() == ' ') param.remove_prefix(1);
+                    if (param.compare(0, 2, "q=") == 0 && atof(string(param.substr(2)).c_str()) <= 0) return false;
+                }
+                return true;
+            }
+            return false;
         }
 
-        static void CompressTempFileAndFinalize(string upload_id, string filename)
+        // If-None-Match为"*"或其列表中有与etag相同的项(弱比较)
+        static bool ETagMatches(const char *header, const string &etag)
+        {
+            if (header == nullptr) return false;
+            std::string_view sv(header);
+            while (!sv.empty())
+            {
+                size_t end = sv.find(',');
+                std::string_view item = sv.substr(0, end);
+                sv.remove_prefix(end == std::string_view::npos ? sv.size() : end + 1);
+                while (!item.empty() && item.front() == ' ') item.remove_prefix(1);
+                while (!item.empty() && item.back() == ' ') item.remove_suffix(1);
+                if (item == "*") return true;
+                if (item.compare(0, 2, "W/") == 0) item.remove_prefix(2);
+                if (item == etag) return true;
+            }
+            return false;
+        }
+
+        // 登记新写入的文件，覆盖了单独存放在别处(如另一块盘)的同名文件时，登记成功后删除旧文件
+        static bool InsertReplacing(const StorageInfo &info)
+        {
+            StorageInfo old;
+            bool replace_file = DataManager::GetDataManager().GetOneByURL(info.url_, &old) && !old.Packed() &&
+                                old.storage_path_ != info.storage_path_;
+            if (!DataManager::GetDataManager().Insert(info)) return false;
+            if (replace_file && old.Erasure()) ErasureStore::GetErasureStore().Remove(old.ErasureName());
+            else if (replace_file) remove(old.storage_path_.c_str());
+            return true;
+        }
+
+        // 普通存储上传写入的根目录：会话选定的根目录；会话已不存在(如服务重启后继续上传)时取已有该上传暂存文件的根目录
+        static string LowUploadDir(const string &session)
+        {
+            StorageRoots::Root *root = Admission::GetAdmission().UploadRoot(session);
+            if (root != nullptr) return root->path;
+            for (auto &r : StorageRoots::GetStorageRoots().Roots())
+                if (!r->deep && FileUtil(PartialPath(r->path, session)).Exists()) return r->path;
+            return Config::GetConfigData().GetLowStorageDir();
+        }
+
+        // 上传的暂存文件(普通存储的上传内容、深度存储的压缩结果)，与最终路径在同一根目录(同一文件系统)下，完成时改名即可
+        static string PartialPath(const string &root, const string &session)
+        {
+            return root + StorageInfo::kPartialDir + session;
+        }
+
+        // 深度存储上传压缩写入的根目录，会话已不存在时重新选择
+        static StorageRoots::Root *DeepUploadRoot(const string &session, uint64_t bytes)
+        {
+            StorageRoots &roots = StorageRoots::GetStorageRoots();
+            StorageRoots::Root *root = Admission::GetAdmission().UploadRoot(session);
+            if (root == nullptr) root = roots.Pick(true, bytes, 0);
+            if (root == nullptr) root = roots.Find(Config::GetConfigData().GetDeepStorageDir());
+            return root != nullptr && root->pool ? root : nullptr;
+        }
+
+        static void CompressTempFileAndFinalize(string upload_id, string filename, string storage_name, string final_storage_dir)
         {
             mylog::GetLogger("asynclogger")->Info("Starting background compression for Upload-ID: %s", upload_id.c_str());
+            TraceRequest trace("compress");
+            trace.SetDetail(filename);
+            TraceStages stage("compress.compress");
 
             string temp_file_path = Config::GetConfigData().GetTemporaryFileDir() + upload_id + ".tmp";
-            string final_storage_dir = Config::GetConfigData().GetDeepStorageDir();
-            FileUtil(final_storage_dir).CreateDirectory();
-            string final_storage_path = final_storage_dir + filename;
+            string final_storage_path = final_storage_dir + storage_name;
+            // 先压缩到根目录下的暂存文件，写完再改名：核对扫描不会收录写了一半的文件，覆盖时正在下载的旧文件也不会被截断
+            string partial_path = PartialPath(final_storage_dir, upload_id);
+            FileUtil(ParentDir(partial_path)).CreateDirectory();
+            FileUtil(ParentDir(final_storage_path)).CreateDirectory();
 
-            // 调用流式压缩函数，源是临时文件，目标是最终文件
-            if (!FileUtil(final_storage_path).Compress(temp_file_path)) {
+            // 调用流式压缩函数，源是临时文件，目标是暂存文件
+            size_t original_size = FileUtil(temp_file_path).FileSize();
+            if (!FileUtil(partial_path).Compress(temp_file_path)) {
                 mylog::GetLogger("asynclogger")->Error("Background compression failed for %s", filename.c_str());
                 remove(temp_file_path.c_str()); // 清理
+                remove(partial_path.c_str());
                 return;
             }
 
             // 清理临时文件
+            stage.Next("compress.cleanup");
             remove(temp_file_path.c_str());
+            if (rename(partial_path.c_str(), final_storage_path.c_str()) == -1) {
+                mylog::GetLogger("asynclogger")->Error("rename %s to %s failed: %s", partial_path.c_str(), final_storage_path.c_str(), strerror(errno));
+                remove(partial_path.c_str());
+                return;
+            }
 
             // 更新文件元数据
+            stage.Next("compress.insert");
             StorageInfo info;
-            if (info.NewStorageInfo(final_storage_path)) {
-                DataManager::GetDataManager().Insert(info);
+            if (info.NewStorageInfo(final_storage_path, filename)) {
+                info.osize_ = original_size;
+                InsertReplacing(info);
             }
             mylog::GetLogger("asynclogger")->Info("Background compression successful for %s", filename.c_str());
         }
         
-        static void Upload(evhttp_request *req, void *args)
+        static void EncodeTempFileAndFinalize(string upload_id, string filename, string storage_name)
         {
-            // 若客户端发来的请求中包含“low_storage"，则说明请求中存在文件数据，且需要普通存储
-            // 若包含“deep_storage”，则压缩后存储
+            TraceRequest trace("erasure_encode");
+            trace.SetDetail(filename);
+            TraceStages stage("erasure.encode");
+
+            string temp_file_path = Config::GetConfigData().GetTemporaryFileDir() + upload_id + ".tmp";
+            uint64_t size;
+            bool ok = ErasureStore::GetErasureStore().Encode(temp_file_path, storage_name, &size);
+            remove(temp_file_path.c_str());
+            if (!ok) {
+                mylog::GetLogger("asynclogger")->Error("Erasure encoding failed for %s", filename.c_str());
+                return;
+            }
+
+            stage.Next("erasure.insert");
+            StorageInfo info;
+            info.mtime_ = info.atime_ = time(nullptr);
+            info.fsize_ = info.osize_ = size;
+            info.storage_path_ = StorageInfo::kErasureRoot + storage_name;
+            info.url_ = Config::GetConfigData().GetDownLoadPrefix() + filename;
+            InsertReplacing(info);
+            mylog::GetLogger("asynclogger")->Info("Erasure encoding successful for %s", filename.c_str());
+        }
+
+        static bool PackUpload(const string &filename, const string &storage_name, evbuffer *body)
+        {
+            size_t len = evbuffer_get_length(body);
+            uint64_t location;
+            if (!PackStore::GetPackStore().Append((const char *)evbuffer_pullup(body, -1), len, &location)) return false;
+            evbuffer_drain(body, len);
+
+            Config &cf = Config::GetConfigData();
+            StorageInfo info;
+            info.mtime_ = info.atime_ = time(nullptr);
+            info.fsize_ = info.osize_ = len;
+            info.storage_path_ = cf.GetPackDir() + storage_name;
+            info.url_ = cf.GetDownLoadPrefix() + filename;
+            info.pack_ = location;
+            if (!InsertReplacing(info)) return false;
+            mylog::GetLogger("asynclogger")->Info("Upload completed for %s, packed into segment %u at %lu.",
+                filename.c_str(), info.PackSegment(), (unsigned long)info.PackOffset());
+            return true;
+        }
 
-            /* 获取http头中携带的信息 */
-            const char* filename_c = evhttp_find_header(req->input_headers, "FileName");         
-            const char* storage_type_c = evhttp_find_header(req->input_headers, "StorageType");
-            const char* upload_id_c = evhttp_find_header(req->input_headers,"Upload-Id");
-            const char* chunk_index_c = evhttp_find_header(req->input_headers,"Chunk-Index");
-            const char* total_chunks_c = evhttp_find_header(req->input_headers,"Total-Chunks");
-            const char* chunk_size_c = evhttp_find_header(req->input_headers, "Chunk-Size"); 
-            const char* total_size_c = evhttp_find_header(req->input_headers, "Total-Size"); 
+        // StorageType对应的存储类别："low"为普通存储，"ec"为纠删码存储，其余为深度存储
+        static DataManager::StorageClass UploadClass(const string &storage_type)
+        {
+            if (storage_type == "low") return DataManager::kLow;
+            if (storage_type == "ec") return DataManager::kErasure;
+            return DataManager::kDeep;
+        }
+
+        // 上传分片的请求头
+        struct UploadHead{
+            string filename;                                // 已解码，可以带目录
+            string storage_type;
+            string upload_id;
+            int chunk_index = 0;
+            int total_chunks = 0;
+            size_t chunk_size = 0;
+            size_t total_size = 0;
+        };
+
+        // 只凭请求头检查上传分片：请求头是否齐全合法，第一个分片还要检查能否开始新的上传会话、配额和磁盘空间是否足够。
+        // Upload和收到请求体之前的提前检查共用，失败时给出状态码和原因
+        static bool CheckUploadHead(evkeyvalq *headers, UploadHead *u, int *code, const char **reason)
+        {
+            const char* filename_c = evhttp_find_header(headers, "FileName");
+            const char* storage_type_c = evhttp_find_header(headers, "StorageType");
+            const char* upload_id_c = evhttp_find_header(headers, "Upload-Id");
+            const char* chunk_index_c = evhttp_find_header(headers, "Chunk-Index");
+            const char* total_chunks_c = evhttp_find_header(headers, "Total-Chunks");
+            const char* chunk_size_c = evhttp_find_header(headers, "Chunk-Size");
+            const char* total_size_c = evhttp_find_header(headers, "Total-Size");
+            *code = HTTP_BADREQUEST;
 
             if (!filename_c || !storage_type_c || !upload_id_c || !chunk_index_c || !total_chunks_c || !chunk_size_c || !total_size_c) {
                 mylog::GetLogger("asynclogger")->Error("Upload failed: Missing required headers.");
-                evhttp_send_reply(req, HTTP_BADREQUEST, "Missing required headers", nullptr);
-                return;
+                *reason = "Missing required headers";
+                return false;
             }
-
-            string filename;
             try {
-                string encoded_filename(filename_c);
-                filename = base64_decode(encoded_filename); // 解码文件名
+                u->filename = base64_decode(string(filename_c)); // 解码文件名
             } catch (const std::runtime_error& e) {
                 mylog::GetLogger("asynclogger")->Error("Failed to decode FileName header: %s", e.what());
-                evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid Base64 in FileName header", nullptr);
-                return; 
+                *reason = "Invalid Base64 in FileName header";
+                return false;
+            }
+            // 文件名可以带目录，如"docs/2024/report.pdf"
+            while (!u->filename.empty() && u->filename.front() == '/') u->filename.erase(0, 1);
+            if (!NamespaceIndex::ValidPath(u->filename)) {
+                mylog::GetLogger("asynclogger")->Error("Upload failed: invalid file path %s", u->filename.c_str());
+                *reason = "Invalid file path";
+                return false;
+            }
+            for (const char *p = upload_id_c; *p; p++) {
+                if (!isalnum((unsigned char)*p) && *p != '-' && *p != '_') {
+                    *reason = "Invalid Upload-Id";
+                    return false;
+                }
+            }
+            uint64_t chunk_index, total_chunks, chunk_size, total_size;
+            if (!ParseDecimal(chunk_index_c, &chunk_index) || !ParseDecimal(total_chunks_c, &total_chunks) ||
+                !ParseDecimal(chunk_size_c, &chunk_size) || !ParseDecimal(total_size_c, &total_size) ||
+                total_chunks > INT_MAX || chunk_index >= total_chunks) {
+                *reason = "Invalid chunk headers";
+                return false;
+            }
+            u->storage_type = storage_type_c;
+            u->upload_id = upload_id_c;
+            u->chunk_index = (int)chunk_index;
+            u->total_chunks = (int)total_chunks;
+            u->chunk_size = chunk_size;
+            u->total_size = total_size;
+            if (u->storage_type == "ec" && !ErasureStore::GetErasureStore().Enabled()) {
+                *reason = "Erasure coding not configured";
+                return false;
+            }
+
+            if (u->chunk_index == 0)
+                return Admitted(Admission::GetAdmission().CanBegin(TempUploadId(u->upload_id, u->filename), UploadClass(u->storage_type), total_size), code, reason);
+            return true;
+        }
+
+        // 把准入结果转换为状态码：过载503，超出配额或磁盘空间不足507
+        static bool Admitted(Admission::Verdict v, int *code, const char **reason)
+        {
+            switch (v)
+            {
+            case Admission::kAdmit: return true;
+            case Admission::kBusy: *code = HTTP_SERVUNAVAIL; *reason = "server busy"; break;
+            case Admission::kOverQuota: *code = 507; *reason = "Storage quota exceeded"; break;
+            case Admission::kNoSpace: *code = 507; *reason = "Insufficient Storage"; break;
+            }
+            return false;
+        }
+
+        static void RejectUpload(evhttp_request *req, int code, const char *reason)
+        {
+            if (code == HTTP_SERVUNAVAIL) Shed(req, reason);
+            else evhttp_send_reply(req, code, reason, nullptr);
+        }
+
+        // 上传请求出错返回时结束其上传会话，成功时由active = false解除
+        struct UploadGuard{
+            Admission &admission;
+            const string &session;
+            bool active = true;
+            ~UploadGuard() { if (active) admission.EndUpload(session); }
+        };
+
+        static void Upload(evhttp_request *req, void *args)
+        {
+            // 若客户端发来的请求中包含“low_storage"，则说明请求中存在文件数据，且需要普通存储
+            // 若包含“deep_storage”，则压缩后存储
+
+            TraceRequest trace("upload");
+            TraceStages stage("upload.headers");
+
+            UploadHead u;
+            int code;
+            const char *reason = nullptr;
+            if (!CheckUploadHead(req->input_headers, &u, &code, &reason))
+            {
+                RejectUpload(req, code, reason);
+                return;
+            }
+            const string &filename = u.filename;
+            const string &storage_type = u.storage_type;
+            int chunk_index = u.chunk_index;
+            int total_chunks = u.total_chunks;
+            size_t chunk_size = u.chunk_size;
+            size_t total_size = u.total_size;
+            trace.SetDetail(filename);
+            stage.Next("upload.prepare");
+            string storage_name = DataManager::GetDataManager().StorageNameFor(filename, u.upload_id);
+
+            // 过载时不再开始新的上传，已开始的上传可以继续完成
+            string session = TempUploadId(u.upload_id, filename);
+            Admission &admission = Admission::GetAdmission();
+            if (chunk_index == 0)
+            {
+                if (!Admitted(admission.BeginUpload(session, UploadClass(storage_type), total_size), &code, &reason))
+                {
+                    RejectUpload(req, code, reason);
+                    return;
+                }
+            }
+            else admission.TouchUpload(session);
+            // 之后任何出错返回都结束会话，不让失败的上传占着名额和预留的配额直到超时
+            UploadGuard guard{admission, session};
+
+            // 一次传完的小文件追加到打包段文件中，不单独创建文件
+            evbuffer *body = evhttp_request_get_input_buffer(req);
+            if (storage_type == "low" && total_chunks == 1 && PackStore::GetPackStore().Accepts(evbuffer_get_length(body)))
+            {
+                stage.Next("upload.pack");
+                admission.EndUpload(session);
+                if (!PackUpload(filename, storage_name, body))
+                {
+                    evhttp_send_reply(req, HTTP_INTERNAL, "Server error: pack append failed", nullptr);
+                    return;
+                }
+                stage.Next("upload.reply");
+                evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+                return;
             }
-            string storage_type(storage_type_c);
-            int chunk_index = atoi(chunk_index_c);
-            int total_chunks = atoi(total_chunks_c);
-            size_t chunk_size = std::stoull(chunk_size_c);
-            size_t total_size = std::stoull(total_size_c);
 
             string final_storage_dir;
             string final_storage_path;
 
+            string low_root;
             if (storage_type == "low") {
-                final_storage_dir = Config::GetConfigData().GetLowStorageDir();
-                final_storage_path = final_storage_dir + filename;
-            } else { // deep storage
-                // 对于压缩存储，写入一个临时文件
-                string upload_id = string(upload_id_c) + "-" + filename;
+                // 普通存储先写入暂存文件，写完最后一个分片再改名，未完成的上传不会被当作文件读取或被核对收录
+                low_root = LowUploadDir(session);
+                final_storage_dir = low_root + StorageInfo::kPartialDir;
+                final_storage_path = PartialPath(low_root, session);
+            } else { // deep storage and erasure coding
+                // 对于压缩存储和纠删码存储，写入一个临时文件
                 final_storage_dir = Config::GetConfigData().GetTemporaryFileDir();
-                final_storage_path = final_storage_dir + upload_id + ".tmp"; // 单一临时文件
+                final_storage_path = final_storage_dir + session + ".tmp"; // 单一临时文件
             }
             FileUtil(final_storage_dir).CreateDirectory();
 
             // 如果是第一个分片，预分配空间
             if (chunk_index == 0) {
+                stage.Next("upload.preallocate");
                 mylog::GetLogger("asynclogger")->Info("Upload start for %s, pre-allocating %lu bytes to %s.", 
                     filename.c_str(), total_size, final_storage_path.c_str());
                 if (!FileUtil(final_storage_path).PreAllocate(total_size)) {
@@ -245,6 +954,7 @@ namespace storage{
             }
 
             // 打开文件，准备写入
+            stage.Next("upload.open");
             std::ofstream target_file(final_storage_path, std::ios::binary | std::ios::in | std::ios::out);
             if (!target_file.is_open()) 
             {
@@ -255,6 +965,7 @@ namespace storage{
             size_t offset = (size_t)chunk_index * chunk_size;
             target_file.seekp(offset);
 
+            stage.Next("upload.write");
             evbuffer* buf = evhttp_request_get_input_buffer(req);
             char buffer[8192];
             int n_read = 0;
@@ -265,53 +976,113 @@ namespace storage{
             
             // 如果是最后一个分片，根据存储类型决定下一步操作
             if (chunk_index == total_chunks - 1) {
+                stage.Next("upload.finalize");
+                StorageRoots::Root *deep_root = UploadClass(storage_type) == DataManager::kDeep ? DeepUploadRoot(session, total_size) : nullptr;
+                admission.EndUpload(session);
                 if (storage_type == "low") {
                     // 普通存储：工作已完成，直接更新元数据
                     mylog::GetLogger("asynclogger")->Info("Upload completed for %s.", filename.c_str());
+                    string stored_path = low_root + storage_name;
+                    FileUtil(ParentDir(stored_path)).CreateDirectory();
+                    if (rename(final_storage_path.c_str(), stored_path.c_str()) == -1) {
+                        mylog::GetLogger("asynclogger")->Error("rename %s to %s failed: %s", final_storage_path.c_str(), stored_path.c_str(), strerror(errno));
+                        remove(final_storage_path.c_str());
+                        evhttp_send_reply(req, HTTP_INTERNAL, "Server error: rename failed", nullptr);
+                        return;
+                    }
                     StorageInfo info;
-                    if (info.NewStorageInfo(final_storage_path)) {
-                        DataManager::GetDataManager().Insert(info);
+                    if (info.NewStorageInfo(stored_path, filename)) {
+                        InsertReplacing(info);
                     }
+                } else if (storage_type == "ec") {
+                    // 纠删码存储：交给编码线程，把临时文件编码为分片写到各块盘
+                    Metrics::GetMetrics().Compressions().fetch_add(1, std::memory_order_relaxed);
+                    ErasureStore::GetErasureStore().Pool().enqueue([=]{
+                        EncodeTempFileAndFinalize(session, filename, storage_name);
+                        Metrics::GetMetrics().Compressions().fetch_sub(1, std::memory_order_relaxed);
+                    });
+                } else if (deep_root == nullptr) {
+                    mylog::GetLogger("asynclogger")->Error("Upload failed for %s: no deep storage root", filename.c_str());
+                    remove(final_storage_path.c_str());
+                    evhttp_send_reply(req, HTTP_INTERNAL, "Server error: no deep storage root", nullptr);
+                    return;
                 } else { // deep storage
-                    // 压缩存储：启动后台线程，对刚刚写入临时文件进行流式压缩
-                    string upload_id = string(upload_id_c) + "-" + filename;
-                    std::thread(CompressTempFileAndFinalize, upload_id, filename).detach();
+                    // 压缩存储：交给选定的盘的压缩线程，对刚刚写入临时文件进行流式压缩
+                    Metrics::GetMetrics().Compressions().fetch_add(1, std::memory_order_relaxed);
+                    deep_root->pending.fetch_add(1, std::memory_order_relaxed);
+                    deep_root->pool->enqueue([=]{
+                        CompressTempFileAndFinalize(session, filename, storage_name, deep_root->path);
+                        deep_root->pending.fetch_sub(1, std::memory_order_relaxed);
+                        Metrics::GetMetrics().Compressions().fetch_sub(1, std::memory_order_relaxed);
+                    });
                 }
             }
             
+            guard.active = false;
+            stage.Next("upload.reply");
             evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
         }
 
 
-        static std::string GenerateModernFileList(const std::vector<StorageInfo> &files_info)
+        // 服务端只渲染第一页，后续页面由index.html通过/api/files按游标加载
+        static void AppendFileList(evbuffer *out, const std::vector<StorageInfo> &files_info, const string &next_cursor)
         {
-            std::stringstream ss;
-            ss << "<div class = \"file-list\"><h3>云盘文件</h3>";
-
-            for (const auto file : files_info)
-            {
-                string file_name = FileUtil(file.storage_path_).FileName();
-
-                string storage_type = "low";
-                if (file.storage_path_.find("deep_storage/") != string::npos) storage_type = "deep";
-
-                ss << "<div class='file-item'>"
-                   << "<div class='file-info'>"
-                   << "<span>📄" << file_name << "</span>"
-                   << "<span class='file-type'>"
-                   << (storage_type == "deep" ? "压缩存储" : "普通存储")
-                   << "</span>"
-                   << "<span>" << FormatSize(file.fsize_) << "</span>"
-                   << "<span>" << std::ctime(&file.mtime_) << "</span>"
-                   << "</div>"
-                   << "<div class='file-actions'>"
-                   << "<button onclick=\"DeleteFile('" << "/delete/" <<file_name << "')\"> 删除</button>"
-                   << "<button onclick=\"window.location='" << file.url_ << "'\">下载</button>"
-                   << "</div>"
-                   << "</div>";
-            }
-            ss << "</div=>";
-            return ss.str();
+            evbuffer_add_printf(out, "<div class=\"file-list\" id=\"fileList\" data-next=\"%s\">", next_cursor.c_str());
+            static const char header[] =
+                "<div class=\"file-list-header\"><h3>云盘文件</h3>"
+                "<input id=\"searchInput\" type=\"search\" placeholder=\"搜索文件名\" oninput=\"searchFiles(this.value)\">"
+                "<select id=\"sortSelect\" onchange=\"changeSort(this.value)\">"
+                "<option value=\"name\">按名称</option>"
+                "<option value=\"-mtime\">最近修改</option>"
+                "<option value=\"-size\">最大文件</option>"
+                "</select></div><div id=\"fileItems\">";
+            evbuffer_add(out, header, sizeof(header) - 1);
+
+            for (const auto &file : files_info)
+            {
+                DataManager::StorageClass c = StorageClassOf(file);
+                uint64_t version = (uint64_t)file.fsize_ * 0x9E3779B97F4A7C15ull ^ ((uint64_t)file.mtime_ << 2) ^ c;
+                if (file_fragments_.AppendTo(file.url_, version, out)) continue;
+                string html = RenderFileItem(file, c);
+                evbuffer_add(out, html.data(), html.size());
+                file_fragments_.Put(file.url_, version, html);
+            }
+
+            evbuffer_add_printf(out, "</div><div class=\"button-container\"><button id=\"loadMoreBtn\" onclick=\"loadFiles(false)\"%s>加载更多</button></div></div>",
+                                next_cursor.empty() ? " style=\"display:none\"" : "");
+        }
+
+        // 文件列表中的一行
+        static DataManager::StorageClass StorageClassOf(const StorageInfo &file)
+        {
+            if (file.Erasure()) return DataManager::kErasure;
+            return StorageRoots::GetStorageRoots().IsDeep(file.storage_path_) ? DataManager::kDeep : DataManager::kLow;
+        }
+
+        static string RenderFileItem(const StorageInfo &file, DataManager::StorageClass c)
+        {
+            string file_name = file.url_.substr(Config::GetConfigData().GetDownLoadPrefix().size());
+            char mtime[64];
+            struct tm tm_buf;
+            strftime(mtime, sizeof(mtime), "%a %b %e %H:%M:%S %Y", localtime_r(&file.mtime_, &tm_buf));
+
+            string html;
+            html.reserve(384 + 2 * file.url_.size());
+            html += "<div class='file-item'><div class='file-info'><span>📄";
+            html += file_name;
+            html += "</span><span class='file-type'>";
+            static const char *labels[DataManager::kClasses] = {"普通存储", "压缩存储", "纠删码存储"};
+            html += labels[c];
+            html += "</span><span>";
+            html += FormatSize(file.fsize_);
+            html += "</span><span>";
+            html += mtime;
+            html += "</span></div><div class='file-actions'><button onclick=\"DeleteFile('/delete/";
+            html += file_name;
+            html += "')\"> 删除</button><button onclick=\"window.location='";
+            html += file.url_;
+            html += "'\">下载</button></div></div>";
+            return html;
         }
 
         static string FormatSize(size_t bytes)
@@ -333,6 +1104,8 @@ namespace storage{
         static void Download(evhttp_request *req, void *args)
         {
             mylog::GetLogger("asynclogger")->Info("Download start");
+            TraceRequest trace("download");
+            TraceStages stage("download.lookup");
             string url_path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req));
             url_path = UrlDecode(url_path);
             StorageInfo file_info;
@@ -342,124 +1115,401 @@ namespace storage{
                 return;
             }
             mylog::GetLogger("asynclogger")->Info("requeset url_path: %s", url_path.c_str());
+            trace.SetDetail(url_path);
+            if (evhttp_request_get_command(req) != EVHTTP_REQ_HEAD) Tiering::GetTiering().RecordAccess(url_path);
+            string etag = GetETag(file_info);
 
-            string download_path = file_info.storage_path_;
-            if (file_info.storage_path_.find(Config::GetConfigData().GetDeepStorageDir()) != string::npos)
+            // 设置通用响应头
+            evkeyvalq *output_headers =  evhttp_request_get_output_headers(req);
+            evhttp_add_header(output_headers, "Accept-Ranges", "bytes");
+            evhttp_add_header(output_headers, "ETag", etag.c_str());
+            evhttp_add_header(output_headers, "Last-Modified", HttpDate(file_info.mtime_).c_str());
+            evhttp_add_header(output_headers, "Content-Type", "application/octet-stream");
+
+            // 重新验证和HEAD只需要元数据，不打开、不解压文件
+            if (NotModified(req, etag, file_info.mtime_))
             {
-                FileUtil fu(file_info.storage_path_);
-                download_path = Config::GetConfigData().GetTemporaryFileDir() + fu.FileName();
-                // 若临时文件文件夹不存在，需要先创建
-                FileUtil(Config::GetConfigData().GetTemporaryFileDir()).CreateDirectory();
-                fu.UnCompress(download_path);
+                evhttp_send_reply(req, HTTP_NOTMODIFIED, "Not Modified", nullptr);
+                return;
+            }
+            if (evhttp_request_get_command(req) == EVHTTP_REQ_HEAD && file_info.osize_ != StorageInfo::kUnknownSize)
+            {
+                evhttp_add_header(output_headers, "Content-Length", std::to_string(file_info.osize_).c_str());
+                evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+                return;
             }
 
-            FileUtil fu(download_path);
-            if (!fu.Exists() && file_info.storage_path_.find("deep_storage/") != string::npos)
+            // 热点小文件直接从内存发送，不做任何文件操作
+            stage.Next("download.cache");
+            ObjectCache &cache = ObjectCache::GetObjectCache();
+            ObjectCache::Data cached = cache.Get(url_path, etag);
+            string download_path = file_info.storage_path_;
+            FdCache::Handle file;                           // 要发送的文件，普通存储的由FdCache持有
+            SegmentPtr temp_seg(nullptr, evbuffer_file_segment_free); // 深度存储解压出的临时文件，随函数返回释放本函数的引用
+            std::vector<SegmentPtr> ec_segs;                // 纠删码存储各数据分片的segment，同样随函数返回释放
+            std::vector<BodyPiece> pieces;                  // file以外的内容来源，目前只有纠删码存储
+            size_t total_size = 0;
+            size_t base = 0;                                // 内容在file中的起始位置
+            if (cached)
             {
-                evhttp_send_error(req, HTTP_INTERNAL, "uncompress error");
+                total_size = cached->size();
             }
-            else if (!fu.Exists() && file_info.storage_path_.find("low_storage/") != string::npos)
+            else if (file_info.Packed())
             {
-                evhttp_send_error(req, HTTP_BADREQUEST, "file not exist");
+                // 打包存储：段文件只追加，缓存的fd只要覆盖到该对象即可复用
+                stage.Next("download.open");
+                base = file_info.PackOffset();
+                total_size = file_info.fsize_;
+                string segment = StorageInfo::PackSegmentPath(file_info.PackSegment());
+                if (!FdCache::GetFdCache().Acquire(segment, base + total_size, &file, true) || file.size < base + total_size)
+                {
+                    mylog::GetLogger("asynclogger")->Error("open pack segment %s for %s error: %s", segment.c_str(), url_path.c_str(), strerror(errno));
+                    evhttp_send_error(req, HTTP_INTERNAL, "pack segment unavailable");
+                    return;
+                }
             }
-
-            // 确认是否需要断点续传 //  
-            bool retrans = false;
-            // If-Range 携带ETag
-            auto if_range = evhttp_find_header(evhttp_request_get_input_headers(req), "If-Range");
-            if (if_range)
+            else if (file_info.Erasure())
             {
-                if (string(if_range) == GetETag(file_info))
+                // 纠删码存储：数据分片齐全时各分片文件中的内容依次作为响应的各段，不复制；
+                // 缺少数据分片时交给纠删码线程解码，解码完成后再回复
+                stage.Next("download.open");
+                std::vector<ErasureStore::Piece> parts;
+                bool degraded;
+                if (!ErasureStore::GetErasureStore().OpenPieces(file_info.ErasureName(), file_info.fsize_, false, &parts, &degraded))
+                {
+                    if (degraded) DownloadDegraded(req, file_info, url_path, etag);
+                    else evhttp_send_error(req, HTTP_INTERNAL, "erasure-coded object unavailable");
+                    return;
+                }
+                if (!ErasureSegments(parts, &ec_segs, &pieces))
                 {
-                    retrans = true;
-                    mylog::GetLogger("asynclogger")->Info("%s need breakpoint continuous transmission", download_path.c_str());
+                    evhttp_send_error(req, HTTP_INTERNAL, "evbuffer_file_segment_new failed");
+                    return;
                 }
+                total_size = file_info.fsize_;
             }
-
-            evbuffer *output_buf = evhttp_request_get_output_buffer(req);
-            int fd = open(download_path.c_str(), O_RDONLY);
-            if (fd == -1)
+            else if (!StorageRoots::GetStorageRoots().IsDeep(file_info.storage_path_))
             {
-                mylog::GetLogger("asynclogger")->Error("open file %s error: %s", download_path.c_str(), strerror(errno));
-                evhttp_send_error(req, HTTP_INTERNAL, strerror(errno));
-                return;
+                // 普通存储：打开过的文件直接复用fd，热点文件不再open/stat
+                stage.Next("download.open");
+                if (!FdCache::GetFdCache().Acquire(download_path, file_info.fsize_, &file))
+                {
+                    mylog::GetLogger("asynclogger")->Error("open file %s error: %s", download_path.c_str(), strerror(errno));
+                    if (errno == ENOENT) evhttp_send_error(req, HTTP_BADREQUEST, "file not exist");
+                    else evhttp_send_error(req, HTTP_INTERNAL, strerror(errno));
+                    return;
+                }
+                total_size = file.size;
             }
+            else
+            {
+                download_path = Config::GetConfigData().GetTemporaryFileDir() + TempUploadId("download", url_path);
+                // 若临时文件文件夹不存在，需要先创建
+                FileUtil(Config::GetConfigData().GetTemporaryFileDir()).CreateDirectory();
+                stage.Next("download.uncompress");
+                FileUtil(file_info.storage_path_).UnCompress(download_path);
 
-            // 设置通用响应头
-            evkeyvalq *output_headers =  evhttp_request_get_output_headers(req);
-            evhttp_add_header(output_headers, "Accept-Ranges", "bytes");
-            evhttp_add_header(output_headers, "ETag", GetETag(file_info).c_str());
-            evhttp_add_header(output_headers, "Content-Type", "application/octet-stream");
+                FileUtil fu(download_path);
+                if (!fu.Exists())
+                {
+                    evhttp_send_error(req, HTTP_INTERNAL, "uncompress error");
+                    return;
+                }
 
-            if (retrans) //断点续传
-            {
-                auto input_header = evhttp_request_get_input_headers(req);
-                const char* range_value = evhttp_find_header(input_header,"Range");
-                if (range_value == nullptr)
+                stage.Next("download.open");
+                int fd = open(download_path.c_str(), O_RDONLY);
+                if (fd == -1)
                 {
-                    retrans = false; // 退化为全文件传输
+                    mylog::GetLogger("asynclogger")->Error("open file %s error: %s", download_path.c_str(), strerror(errno));
+                    evhttp_send_error(req, HTTP_INTERNAL, strerror(errno));
+                    remove(download_path.c_str());
+                    return;
                 }
-                else
+                total_size = fu.FileSize();
+                remove(download_path.c_str()); // 删除临时文件，已打开的fd仍可读
+                temp_seg.reset(evbuffer_file_segment_new(fd, 0, total_size, EVBUF_FS_CLOSE_ON_FREE));
+                if (!temp_seg)
                 {
-                    const string range_str(range_value);
-                    std::smatch match;
-                    std::regex str_regex("byte=(\\d+)-(\\d*)"); // \d+表示出现至少一个数字 \d*表示出现0个或多个数字
-                    if (std::regex_search(range_str, match, str_regex) && !match[1].str().empty()) // 找到匹配内容且捕获组1的内容不为空
+                    close(fd);
+                    evhttp_send_error(req, HTTP_INTERNAL, "evbuffer_file_segment_new failed");
+                    return;
+                }
+                file = {temp_seg.get(), fd, total_size};
+            }
+
+            if (pieces.empty() && !cached) pieces.push_back({file.seg, file.fd, base, total_size});
+            SendFile(req, file_info, url_path, etag, cached, pieces, total_size, &stage);
+        }
+
+        // 纠删码存储缺少数据分片的对象：在纠删码线程中解码，完成后回到事件循环线程发送。
+        // 期间连接关闭时丢弃结果
+        static void DownloadDegraded(evhttp_request *req, const StorageInfo &file_info, const string &url_path, const string &etag)
+        {
+            evhttp_connection *conn = evhttp_request_get_connection(req);
+            uint64_t seq = ++waiting_seq_;
+            waiting_[conn] = seq;
+            ErasureStore::GetErasureStore().Pool().enqueue([=]{
+                auto parts = std::make_shared<std::vector<ErasureStore::Piece>>();
+                bool ok;
+                {
+                    TraceRequest trace("erasure_reconstruct");
+                    trace.SetDetail(url_path);
+                    TraceStages stage("erasure.reconstruct");
+                    bool degraded;
+                    ok = ErasureStore::GetErasureStore().OpenPieces(file_info.ErasureName(), file_info.fsize_, true, parts.get(), &degraded);
+                }
+                RunInLoop([=]{
+                    auto it = waiting_.find(conn);
+                    if (it == waiting_.end() || it->second != seq)
                     {
-                        long long start_byte = std::stoll(match[1].str());
-                        long long end_byte = -1;
-                        if (match.size() > 2 && !match[2].str().empty()) end_byte = std::stoll(match[2].str());
-
-                        size_t total_size = fu.FileSize();
-                        if (end_byte == -1 || end_byte >= total_size) end_byte = total_size - 1;
-
-                        size_t request_len = end_byte - start_byte + 1;
-                        if (start_byte >= total_size || request_len <= 0)
-                        {
-                            evhttp_add_header(output_headers, "Content-Range", ("bytes */" + std::to_string(total_size)).c_str());
-                            evhttp_send_reply(req, 416, "Range Not Saticfiable", nullptr);
-                            close(fd);
-                            return;
-                        }
-                        string cr_str = "bytes " + std::to_string(start_byte) + \
-                                        "-" + std::to_string(end_byte) + "/" +  std::to_string(total_size);
-                        
-                        evhttp_add_header(output_headers, "Content-Range", cr_str.c_str());
-                        if (-1 == evbuffer_add_file(output_buf, fd, start_byte, request_len))
-                        {
-                            mylog::GetLogger("asynclogger")->Error("evbuffer_add_file partial content: %s error", 
-                                download_path.c_str(), strerror(errno));
-                            evhttp_send_error(req, HTTP_INTERNAL, "evbuffer_add_file partial content error");
-                            close(fd);
-                            return;
-                        }
-
-                        evhttp_send_reply(req, 206, "Partial content", nullptr);
-                        mylog::GetLogger("asynclogger")->Info("send file with breakpoint continuous transmission");
+                        for (auto &p : *parts) close(p.fd);
+                        return;
                     }
-                    else
+                    waiting_.erase(it);
+                    TraceRequest trace("download");
+                    trace.SetDetail(url_path);
+                    TraceStages stage("download.open");
+                    std::vector<SegmentPtr> segs;
+                    std::vector<BodyPiece> pieces;
+                    if (!ok)
                     {
-                        retrans = false;
-                    }             
-                }            
+                        evhttp_send_error(req, HTTP_INTERNAL, "erasure-coded object unavailable");
+                        return;
+                    }
+                    if (!ErasureSegments(*parts, &segs, &pieces))
+                    {
+                        evhttp_send_error(req, HTTP_INTERNAL, "evbuffer_file_segment_new failed");
+                        return;
+                    }
+                    SendFile(req, file_info, url_path, etag, nullptr, pieces, file_info.fsize_, &stage);
+                });
+            });
+        }
+
+        // 为纠删码对象的各段创建segment，segment关闭对应的fd；失败时关闭所有fd
+        static bool ErasureSegments(const std::vector<ErasureStore::Piece> &parts, std::vector<SegmentPtr> *segs, std::vector<BodyPiece> *pieces)
+        {
+            for (size_t i = 0; i < parts.size(); i++)
+            {
+                const ErasureStore::Piece &p = parts[i];
+                SegmentPtr seg(evbuffer_file_segment_new(p.fd, 0, p.offset + p.len, EVBUF_FS_CLOSE_ON_FREE), evbuffer_file_segment_free);
+                if (!seg)
+                {
+                    for (size_t j = i; j < parts.size(); j++) close(parts[j].fd);
+                    pieces->clear();
+                    return false;
+                }
+                pieces->push_back({seg.get(), p.fd, p.offset, p.len});
+                segs->push_back(std::move(seg));
             }
+            return true;
+        }
 
-            // 如果不需要断点续传，直接传输整个文件
-            if (!retrans)
+        // 发送已打开的文件内容：cached非空时从内存发送，否则依次发送pieces中的各段。处理HEAD和Range
+        static void SendFile(evhttp_request *req, const StorageInfo &file_info, const string &url_path, const string &etag,
+                             ObjectCache::Data cached, const std::vector<BodyPiece> &pieces, size_t total_size, TraceStages *stage)
+        {
+            evkeyvalq *output_headers = evhttp_request_get_output_headers(req);
+            ObjectCache &cache = ObjectCache::GetObjectCache();
+            // 被反复下载的小文件读入缓存，本次也直接从内存发送
+            if (!cached && cache.ShouldAdmit(url_path, total_size))
             {
-                if (-1 == evbuffer_add_file(output_buf, fd, 0, fu.FileSize()))
+                stage->Next("download.fill_cache");
+                auto data = std::make_shared<string>(total_size, '\0');
+                if (ReadPieces(pieces, &(*data)[0]))
                 {
-                    mylog::GetLogger("asynclogger")->Error("evbuffer_add_file %s error: %s", 
-                        download_path.c_str(), strerror(errno));
-                    evhttp_send_error(req, HTTP_INTERNAL, "evbuffer_add_file failed");
+                    cached = data;
+                    cache.Put(url_path, etag, cached);
                 }
+            }
+            // 元数据中没有内容长度的旧记录，HEAD只能在打开(解压)文件后回答
+            if (evhttp_request_get_command(req) == EVHTTP_REQ_HEAD)
+            {
+                evhttp_add_header(output_headers, "Content-Length", std::to_string(total_size).c_str());
+                evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+                return;
+            }
+
+            // 断点续传、多线程下载：If-Range(若有)与当前版本一致时才按Range发送
+            ByteRange ranges[kMaxRanges];
+            size_t range_count = 0;
+            RangeResult range_result = RangeResult::kIgnore;
+            evkeyvalq *input_headers = evhttp_request_get_input_headers(req);
+            const char *range_value = evhttp_find_header(input_headers, "Range");
+            if (range_value && IfRangeMatches(evhttp_find_header(input_headers, "If-Range"), etag, file_info.mtime_))
+                range_result = ParseRange(range_value, total_size, ranges, &range_count);
+
+            stage->Next("download.send");
+            evbuffer *output_buf = evhttp_request_get_output_buffer(req);
+            char line[160];
+            if (range_result == RangeResult::kUnsatisfiable)
+            {
+                snprintf(line, sizeof(line), "bytes */%zu", total_size);
+                evhttp_add_header(output_headers, "Content-Range", line);
+                evhttp_send_reply(req, 416, "Range Not Satisfiable", nullptr);
+                return;
+            }
+
+            bool ok = true;
+            if (range_result == RangeResult::kIgnore)
+            {
+                ok = AddBody(output_buf, cached, pieces, 0, total_size);
+            }
+            else if (range_count == 1)
+            {
+                snprintf(line, sizeof(line), "bytes %llu-%llu/%zu",
+                         (unsigned long long)ranges[0].first, (unsigned long long)ranges[0].last, total_size);
+                evhttp_add_header(output_headers, "Content-Range", line);
+                ok = AddBody(output_buf, cached, pieces, ranges[0].first, ranges[0].Length());
+            }
+            else
+            {
+                // multipart/byteranges：每段一个分隔头，数据仍以segment或引用加入，不复制
+                char boundary[40];
+                snprintf(boundary, sizeof(boundary), "%016llx%08x", (unsigned long long)boot_time_, ++range_boundary_seq_);
+                snprintf(line, sizeof(line), "multipart/byteranges; boundary=%s", boundary);
+                evhttp_remove_header(output_headers, "Content-Type");
+                evhttp_add_header(output_headers, "Content-Type", line);
+                for (size_t i = 0; i < range_count && ok; i++)
+                {
+                    evbuffer_add_printf(output_buf, "%s--%s\r\nContent-Type: application/octet-stream\r\nContent-Range: bytes %llu-%llu/%zu\r\n\r\n",
+                                        i == 0 ? "" : "\r\n", boundary,
+                                        (unsigned long long)ranges[i].first, (unsigned long long)ranges[i].last, total_size);
+                    ok = AddBody(output_buf, cached, pieces, ranges[i].first, ranges[i].Length());
+                }
+                evbuffer_add_printf(output_buf, "\r\n--%s--\r\n", boundary);
+            }
+            if (!ok)
+            {
+                mylog::GetLogger("asynclogger")->Error("add body of %s error: %s", url_path.c_str(), strerror(errno));
+                evhttp_send_error(req, HTTP_INTERNAL, "evbuffer_add_file failed");
+                return;
+            }
+            if (range_result == RangeResult::kIgnore)
+            {
                 evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
                 mylog::GetLogger("asynclogger")->Info("send file without breakpoint continuous transmission");
             }
+            else
+            {
+                evhttp_send_reply(req, 206, "Partial Content", nullptr);
+                mylog::GetLogger("asynclogger")->Info("send %lu ranges of file", range_count);
+            }
+        }
+
+        // If-Range可以是ETag或HTTP时间，没有该头时总是满足
+        static bool IfRangeMatches(const char *if_range, const string &etag, time_t mtime)
+        {
+            if (if_range == nullptr) return true;
+            if (etag == if_range) return true;
+            struct tm tm_buf = {};
+            const char *end = strptime(if_range, "%a, %d %b %Y %H:%M:%S GMT", &tm_buf);
+            return end != nullptr && *end == '\0' && timegm(&tm_buf) == mtime;
+        }
 
-            if (download_path != file_info.storage_path_) remove(download_path.c_str()); // 删除临时文件
+        // 把[offset, offset+len)加入响应：内存中的内容以引用方式加入，文件则为所跨的每段加一份segment引用
+        static bool AddBody(evbuffer *buf, const ObjectCache::Data &cached, const std::vector<BodyPiece> &pieces, size_t offset, size_t len)
+        {
+            if (cached)
+            {
+                auto *ref = new ObjectCache::Data(cached);
+                if (evbuffer_add_reference(buf, cached->data() + offset, len, ReleaseCached, ref) == 0) return true;
+                delete ref;
+                return false;
+            }
+            for (auto &p : pieces)
+            {
+                if (offset >= p.len)
+                {
+                    offset -= p.len;
+                    continue;
+                }
+                size_t n = std::min(len, p.len - offset);
+                if (evbuffer_add_file_segment(buf, p.seg, p.base + offset, n) != 0) return false;
+                len -= n;
+                offset = 0;
+                if (len == 0) break;
+            }
+            return len == 0;
+        }
+
+        // 依次读出各段的全部内容
+        static bool ReadPieces(const std::vector<BodyPiece> &pieces, char *buf)
+        {
+            for (auto &p : pieces)
+            {
+                if (!ReadAll(p.fd, buf, p.len, p.base)) return false;
+                buf += p.len;
+            }
+            return true;
+        }
+
+        // 在事件循环线程中执行f，可在任意线程调用
+        static void RunInLoop(std::function<void()> f)
+        {
+            {
+                std::lock_guard<std::mutex> lock(loop_tasks_mutex_);
+                loop_tasks_.push_back(std::move(f));
+            }
+            uint64_t one = 1;
+            if (write(loop_wake_fd_, &one, sizeof(one)) == -1 && errno != EAGAIN)
+                mylog::GetLogger("asynclogger")->Error("wake event loop failed: %s", strerror(errno));
+        }
+
+        static void RunLoopTasks()
+        {
+            uint64_t n;
+            if (read(loop_wake_fd_, &n, sizeof(n)) == -1 && errno != EAGAIN) return;
+            std::vector<std::function<void()>> tasks;
+            {
+                std::lock_guard<std::mutex> lock(loop_tasks_mutex_);
+                tasks.swap(loop_tasks_);
+            }
+            for (auto &task : tasks) task();
+        }
+
+        // 释放evbuffer_add_reference持有的内容引用，ObjectCache::Data与StaticAssets::Body是同一类型
+        static void ReleaseCached(const void *, size_t, void *arg)
+        {
+            delete (ObjectCache::Data *)arg;
+        }
+
+        static bool ReadAll(int fd, char *buf, size_t len, size_t base = 0)
+        {
+            size_t done = 0;
+            while (done < len)
+            {
+                ssize_t n = pread(fd, buf + done, len - done, base + done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                done += n;
+            }
+            return true;
         }
         
+        // If-None-Match优先；没有时比较If-Modified-Since与文件修改时间
+        static bool NotModified(evhttp_request *req, const string &etag, time_t mtime)
+        {
+            evkeyvalq *input_headers = evhttp_request_get_input_headers(req);
+            const char *inm = evhttp_find_header(input_headers, "If-None-Match");
+            if (inm) return ETagMatches(inm, etag);
+            const char *ims = evhttp_find_header(input_headers, "If-Modified-Since");
+            if (ims == nullptr) return false;
+            struct tm tm_buf = {};
+            const char *end = strptime(ims, "%a, %d %b %Y %H:%M:%S GMT", &tm_buf);
+            if (end == nullptr || *end != '\0') return false;
+            return mtime <= timegm(&tm_buf);
+        }
+
+        // RFC 7231格式的时间，如"Sun, 06 Nov 1994 08:49:37 GMT"
+        static string HttpDate(time_t t)
+        {
+            char buf[64];
+            struct tm tm_buf;
+            strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&t, &tm_buf));
+            return buf;
+        }
+
         static std::string GetETag(const StorageInfo &info)
         {
             string etag = FileUtil(info.storage_path_).FileName()
@@ -473,15 +1523,15 @@ namespace storage{
             mylog::GetLogger("asynclogger")->Info("Delete start");
             string delete_path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req));
             delete_path = UrlDecode(delete_path);
-            auto pos = delete_path.find_last_of("/");
-            if (pos == string::npos)
+            const size_t prefix_len = string("/delete/").size();
+            if (delete_path.size() <= prefix_len)
             {
                 mylog::GetLogger("asynclogger")->Info("Invalid URL format");
                 evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid URL format", nullptr);
                 return;
             }
 
-            string url_path = Config::GetConfigData().GetDownLoadPrefix() + delete_path.substr(pos + 1);
+            string url_path = Config::GetConfigData().GetDownLoadPrefix() + delete_path.substr(prefix_len);
 
             StorageInfo file_info;
             if (!DataManager::GetDataManager().GetOneByURL(url_path,&file_info))
@@ -492,6 +1542,24 @@ namespace storage{
                 return;
             }
 
+            if (file_info.Packed())
+            {
+                // 打包存储的对象只删除记录，段中的空间由后台整理回收
+                DataManager::GetDataManager().Remove(file_info.url_);
+                evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+                mylog::GetLogger("asynclogger")->Info("delete packed file %s successfully", file_info.url_.c_str());
+                return;
+            }
+
+            if (file_info.Erasure())
+            {
+                DataManager::GetDataManager().Remove(file_info.url_);
+                ErasureStore::GetErasureStore().Remove(file_info.ErasureName());
+                evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+                mylog::GetLogger("asynclogger")->Info("delete erasure-coded file %s successfully", file_info.url_.c_str());
+                return;
+            }
+
             if (!FileUtil(file_info.storage_path_).Exists())
             {
                 // 文件不存在，直接返回成功
@@ -511,33 +1579,295 @@ namespace storage{
             mylog::GetLogger("asynclogger")->Info("delete file %s successfully", file_info.storage_path_.c_str());
         }
         
+        // GET /list?prefix=docs/&delimiter=/&limit=&after= 按目录逐层列出文件，delimiter为空时列出前缀下的整棵子树。
+        // 目录和文件合计每页最多limit项，next非空时以after=next取下一页
+        static void ListDir(evhttp_request *req, void *args)
+        {
+            evkeyvalq params;
+            evhttp_parse_query_str(evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req)), &params);
+            const char *prefix_c = evhttp_find_header(&params, "prefix");
+            const char *delimiter_c = evhttp_find_header(&params, "delimiter");
+            const char *limit_c = evhttp_find_header(&params, "limit");
+            const char *after_c = evhttp_find_header(&params, "after");
+            string prefix = prefix_c ? prefix_c : "";
+            string after = after_c ? after_c : "";
+            bool recursive = delimiter_c && string(delimiter_c).empty();
+            size_t limit = limit_c ? strtoul(limit_c, nullptr, 10) : kListPageSize;
+            evhttp_clear_headers(&params);
+            if (limit == 0 || limit > kMaxListPageSize) limit = kListPageSize;
+            while (!prefix.empty() && prefix.front() == '/') prefix.erase(0, 1);
+
+            // 续页的位置必须在所列的目录中
+            string dir = prefix.substr(0, prefix.find_last_of('/') + 1);
+            if (!after.empty() && after.compare(0, dir.size(), dir) != 0)
+            {
+                evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid after", nullptr);
+                return;
+            }
+
+            std::vector<string> folders;
+            std::vector<StorageInfo> files;
+            bool more = false;
+            if (!DataManager::GetDataManager().List(prefix, recursive, after, limit, &folders, &files, &more))
+            {
+                evhttp_send_error(req, HTTP_NOTFOUND, "No such directory");
+                return;
+            }
+
+            // 最后一项的路径作为下一页的起点，文件排在目录之后
+            string next;
+            if (more && !files.empty()) next = files.back().url_.substr(Config::GetConfigData().GetDownLoadPrefix().size());
+            else if (more) next = folders.back();
+
+            Json::Value root;
+            root["prefix"] = prefix;
+            root["next"] = next;
+            root["folders"] = Json::Value(Json::arrayValue);
+            for (auto &folder : folders) root["folders"].append(folder);
+            root["files"] = FilesToJson(files);
+            SendJson(req, root);
+        }
+
+        // POST /rename?from=docs&to=archive/docs 目录重命名，不移动磁盘上的文件
+        static void RenameDir(evhttp_request *req, void *args)
+        {
+            evkeyvalq params;
+            evhttp_parse_query_str(evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req)), &params);
+            const char *from_c = evhttp_find_header(&params, "from");
+            const char *to_c = evhttp_find_header(&params, "to");
+            string from = from_c ? from_c : "", to = to_c ? to_c : "";
+            evhttp_clear_headers(&params);
+
+            string err;
+            if (!DataManager::GetDataManager().RenameDir(from, to, &err))
+            {
+                mylog::GetLogger("asynclogger")->Info("rename %s to %s failed: %s", from.c_str(), to.c_str(), err.c_str());
+                evhttp_send_reply(req, HTTP_BADREQUEST, err.c_str(), nullptr);
+                return;
+            }
+            mylog::GetLogger("asynclogger")->Info("rename directory %s to %s", from.c_str(), to.c_str());
+            evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+        }
+
+        // GET /api/files?cursor=&limit=&sort= 分页返回文件列表(JSON)，
+        // ETag为文件列表版本，列表未变化时对If-None-Match返回304
+        static void FilesPage(evhttp_request *req, void *args)
+        {
+            evkeyvalq *output_headers = evhttp_request_get_output_headers(req);
+            string etag = "\"" + std::to_string(boot_time_) + "-" + std::to_string(DataManager::GetDataManager().ListingVersion()) + "\"";
+            evhttp_add_header(output_headers, "ETag", etag.c_str());
+            evhttp_add_header(output_headers, "Cache-Control", "no-cache");
+            const char *if_none_match = evhttp_find_header(evhttp_request_get_input_headers(req), "If-None-Match");
+            if (if_none_match && etag == if_none_match)
+            {
+                evhttp_send_reply(req, HTTP_NOTMODIFIED, "Not Modified", nullptr);
+                return;
+            }
+
+            evkeyvalq params;
+            evhttp_parse_query_str(evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req)), &params);
+            const char *cursor_c = evhttp_find_header(&params, "cursor");
+            const char *limit_c = evhttp_find_header(&params, "limit");
+            const char *sort_c = evhttp_find_header(&params, "sort");
+            string cursor = cursor_c ? cursor_c : "";
+            string sort = sort_c && *sort_c ? sort_c : "name";
+            size_t limit = limit_c ? strtoul(limit_c, nullptr, 10) : kListPageSize;
+            evhttp_clear_headers(&params);
+            if (limit == 0 || limit > kMaxListPageSize) limit = kListPageSize;
+
+            std::vector<StorageInfo> files;
+            string next_cursor;
+            if (!DataManager::GetDataManager().Page(sort, cursor, limit, &files, &next_cursor))
+            {
+                evhttp_send_reply(req, HTTP_BADREQUEST, "Invalid sort or cursor", nullptr);
+                return;
+            }
+
+            Json::Value root;
+            root["next"] = next_cursor;
+            root["files"] = FilesToJson(files);
+            SendJson(req, root);
+        }
+
+        // GET /api/search?q=&limit= 按文件名搜索
+        static void SearchFiles(evhttp_request *req, void *args)
+        {
+            evkeyvalq params;
+            evhttp_parse_query_str(evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req)), &params);
+            const char *q_c = evhttp_find_header(&params, "q");
+            const char *limit_c = evhttp_find_header(&params, "limit");
+            string q = q_c ? q_c : "";
+            size_t limit = limit_c ? strtoul(limit_c, nullptr, 10) : kListPageSize;
+            evhttp_clear_headers(&params);
+            if (limit == 0 || limit > kMaxListPageSize) limit = kListPageSize;
+
+            std::vector<StorageInfo> files;
+            DataManager::GetDataManager().Search(q, limit, &files);
+            Json::Value root;
+            root["files"] = FilesToJson(files);
+            SendJson(req, root);
+        }
+
+        // GET /api/usage 各存储类别的用量、配额和所在磁盘的剩余空间，用量来自计数器，不遍历文件
+        static void UsagePage(evhttp_request *req, void *args)
+        {
+            Admission &admission = Admission::GetAdmission();
+            Json::Value root;
+            const char *names[DataManager::kClasses] = {"low", "deep", "ec"};
+            for (int i = 0; i < DataManager::kClasses; i++)
+            {
+                DataManager::StorageClass c = (DataManager::StorageClass)i;
+                DataManager::Usage usage = DataManager::GetDataManager().GetUsage(c);
+                Json::Value item;
+                item["files"] = (Json::UInt64)usage.files;
+                item["bytes"] = (Json::UInt64)usage.bytes;
+                item["reserved"] = (Json::UInt64)admission.Reserved(c);    // 进行中的上传
+                item["quota"] = (Json::UInt64)admission.Quota(c);          // 0表示不限
+                // 各根目录所在的盘，同一文件系统上的根目录只计一次
+                uint64_t disk_free = 0, disk_total = 0;
+                std::unordered_set<dev_t> devs;
+                Json::Value roots(Json::arrayValue);
+                auto add_disk = [&](Json::Value disk){
+                    struct statvfs vfs;
+                    if (statvfs(disk["path"].asCString(), &vfs) == 0)
+                    {
+                        disk["disk_free"] = (Json::UInt64)((uint64_t)vfs.f_bavail * vfs.f_frsize);
+                        disk["disk_total"] = (Json::UInt64)((uint64_t)vfs.f_blocks * vfs.f_frsize);
+                    }
+                    struct stat st;
+                    if (stat(disk["path"].asCString(), &st) == 0 && devs.insert(st.st_dev).second)
+                    {
+                        disk_free += disk["disk_free"].asUInt64();
+                        disk_total += disk["disk_total"].asUInt64();
+                    }
+                    roots.append(disk);
+                };
+                for (auto &r : StorageRoots::GetStorageRoots().Roots())
+                {
+                    if (c == DataManager::kErasure || r->deep != (c == DataManager::kDeep)) continue;
+                    Json::Value disk;
+                    disk["path"] = r->path;
+                    disk["weight"] = r->weight;
+                    disk["pending"] = r->pending.load(std::memory_order_relaxed);
+                    add_disk(disk);
+                }
+                if (c == DataManager::kErasure)
+                {
+                    ErasureStore &ec = ErasureStore::GetErasureStore();
+                    item["enabled"] = ec.Enabled();
+                    item["data_fragments"] = ec.K();
+                    item["parity_fragments"] = ec.M();
+                    for (auto &path : ec.Roots())
+                    {
+                        Json::Value disk;
+                        disk["path"] = path;
+                        add_disk(disk);
+                    }
+                }
+                item["disk_free"] = (Json::UInt64)disk_free;
+                item["disk_total"] = (Json::UInt64)disk_total;
+                item["roots"] = roots;
+                root[names[i]] = item;
+            }
+            root["disk_reserve"] = (Json::UInt64)admission.ReserveBytes();
+            SendJson(req, root);
+        }
+
+        static Json::Value FilesToJson(const std::vector<StorageInfo> &files)
+        {
+            Json::Value arr(Json::arrayValue);
+            size_t prefix_len = Config::GetConfigData().GetDownLoadPrefix().size();
+            for (auto &file : files)
+            {
+                Json::Value item;
+                item["name"] = file.url_.substr(prefix_len);
+                item["url"] = file.url_;
+                item["size"] = (Json::UInt64)file.fsize_;
+                item["mtime"] = (Json::Int64)file.mtime_;
+                static const char *types[DataManager::kClasses] = {"low", "deep", "ec"};
+                item["storage"] = types[StorageClassOf(file)];
+                arr.append(item);
+            }
+            return arr;
+        }
+
+        static void SendJson(evhttp_request *req, const Json::Value &root)
+        {
+            string body;
+            JsonUtil::Serialize(root, &body, true);
+            evbuffer_add(evhttp_request_get_output_buffer(req), body.data(), body.size());
+            evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type", "application/json;charset=utf-8");
+            evhttp_send_reply(req, HTTP_OK, "Success", nullptr);
+        }
+
+        static string ParentDir(const string &path)
+        {
+            auto pos = path.find_last_of('/');
+            return pos == string::npos ? "./" : path.substr(0, pos + 1);
+        }
+
+        // 临时文件名中不能带目录分隔符
+        static string TempUploadId(const string &upload_id, string filename)
+        {
+            std::replace(filename.begin(), filename.end(), '/', '_');
+            return upload_id + "-" + filename;
+        }
+
         static void ListShow(evhttp_request *req, void *args)
         {
             mylog::GetLogger("asynclogger")->Info("ListShow start");
 
+            // 文件与磁盘的核对在后台进行，这里只取第一页，耗时与文件总数无关
             std::vector<StorageInfo> files_info;
-            DataManager::GetDataManager().Update();
-            DataManager::GetDataManager().GetAll(files_info);
-
-            std::ifstream templateFile("index.html");
-            string tpContent(
-                (std::istreambuf_iterator<char>(templateFile)), 
-                std::istreambuf_iterator<char>());
-
-            tpContent = std::regex_replace(tpContent, 
-                                            std::regex("\\{\\{FILE_LIST\\}\\}"),
-                                            GenerateModernFileList(files_info));
-            tpContent = std::regex_replace(tpContent, 
-                                            std::regex("\\{\\{BACKEND_URL\\}\\}"),
-                                            "http://" + Config::GetConfigData().GetServerIP() + ":" + \
-                                            std::to_string(Config::GetConfigData().GetServerPort()));                                
-            
-            evbuffer_add(evhttp_request_get_output_buffer(req), tpContent.data(), tpContent.size());
+            string next_cursor;
+            DataManager::GetDataManager().Page("name", "", kListPageSize, &files_info, &next_cursor);
+
+            StaticAssets::AssetPtr page = StaticAssets::GetStaticAssets().Get("./index.html");
+            if (!page)
+            {
+                mylog::GetLogger("asynclogger")->Error("index.html not exist!");
+                evhttp_send_error(req, HTTP_INTERNAL, "server error");
+                return;
+            }
+            // 模板只在index.html变化后重新解析
+            if (page != index_page_)
+            {
+                index_template_.Parse(*page->identity);
+                index_page_ = page;
+            }
+
+            evbuffer *out = evhttp_request_get_output_buffer(req);
+            index_template_.Render(out, [&](const string &name, evbuffer *buf){
+                if (name == "FILE_LIST")
+                    AppendFileList(buf, files_info, next_cursor);
+                else if (name == "BACKEND_URL")
+                    evbuffer_add_printf(buf, "http://%s:%d", Config::GetConfigData().GetServerIP().c_str(), (int)Config::GetConfigData().GetServerPort());
+                else
+                    return false;
+                return true;
+            });
             evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type", "text/html;charset=utf-8");
             evhttp_send_reply(req, HTTP_OK, nullptr, nullptr);
             mylog::GetLogger("asynclogger")->Info("LishShow completed");
         }
     private:
+        static constexpr size_t kListPageSize = 50;        // 文件列表每页条数
+        static constexpr size_t kMaxListPageSize = 1000;
+        static inline const time_t boot_time_ = time(nullptr); // 区分不同进程生成的列表ETag
+        static inline uint32_t range_boundary_seq_ = 0;    // 多区间响应的分隔符序号，仅事件循环线程访问
+        static inline std::unordered_set<evhttp_connection *> connections_;   // 已计入指标的连接，仅事件循环线程访问
+        static inline size_t max_connections_ = SIZE_MAX;   // 构造时从配置读取
+        static inline std::unordered_map<evhttp_connection *, RequestStream> streams_;   // 仅事件循环线程访问
+        static inline std::unordered_map<evhttp_connection *, EarlyReject> early_rejects_;  // 已在请求头阶段拒绝的上传
+        static inline StaticAssets::AssetPtr index_page_;  // index_template_解析自的页面内容，仅事件循环线程访问
+        static inline PageTemplate index_template_;
+        static inline FragmentCache file_fragments_{65536}; // 文件列表中每个文件渲染好的一行
+        static inline int loop_wake_fd_ = -1;               // RunInLoop唤醒事件循环的eventfd
+        static inline std::mutex loop_tasks_mutex_;
+        static inline std::vector<std::function<void()>> loop_tasks_;
+        static inline std::unordered_map<evhttp_connection *, uint64_t> waiting_;  // 等待后台线程结果的请求所在连接 -> 序号，仅事件循环线程访问
+        static inline uint64_t waiting_seq_ = 0;
+
         uint16_t server_port_;
         string server_ip_;
         string download_prefix_;
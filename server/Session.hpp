@@ -0,0 +1,313 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <sys/random.h>
+#include "Config.hpp"
+
+namespace storage{
+    // 分层时间轮：kLevels层、每层64格，第0层一格为一个tick。
+    // 添加、到期均为O(1)，高层格子到点时整体下沉一层(cascade)。非线程安全
+    template <typename Entry>
+    class TimerWheel{
+    public:
+        explicit TimerWheel(uint64_t now) : now_(now) {}
+
+        uint64_t Now() const { return now_; }
+
+        // 在第expire个tick到期，已过期的放到下一个tick
+        void Add(uint64_t expire, const Entry &e)
+        {
+            Place(std::max(expire, now_ + 1), e);
+        }
+
+        // 推进到tick，对每个到期项调用f
+        template <typename F>
+        void Advance(uint64_t tick, F &&f)
+        {
+            while (now_ < tick)
+            {
+                now_++;
+                // 低层转完一圈时，从高到低把上一层对应格子里的项重新分配下来
+                int top = 0;
+                while (top < kLevels - 1 && ((now_ >> (kBits * top)) & kMask) == 0) top++;
+                for (int level = top; level >= 1; level--)
+                {
+                    auto items = std::move(wheel_[level][(now_ >> (kBits * level)) & kMask]);
+                    wheel_[level][(now_ >> (kBits * level)) & kMask].clear();
+                    for (auto &it : items) Place(it.expire, it.entry);
+                }
+                auto items = std::move(wheel_[0][now_ & kMask]);
+                wheel_[0][now_ & kMask].clear();
+                for (auto &it : items) f(it.entry);
+            }
+        }
+
+    private:
+        // expire不早于now_，等于now_时放入当前格，随后在本tick触发
+        void Place(uint64_t expire, const Entry &e)
+        {
+            uint64_t diff = expire - now_;
+            int level = 0;
+            while (level < kLevels - 1 && diff >= (1ull << (kBits * (level + 1)))) level++;
+            if (diff >= (1ull << (kBits * kLevels))) expire = now_ + (1ull << (kBits * kLevels)) - 1;
+            wheel_[level][(expire >> (kBits * level)) & kMask].push_back({expire, e});
+        }
+
+        static constexpr int kBits = 6;
+        static constexpr int kLevels = 4;                   // 以秒为tick时可覆盖约194天
+        static constexpr uint64_t kMask = (1ull << kBits) - 1;
+
+        struct Item{
+            uint64_t expire;
+            Entry entry;
+        };
+        std::vector<Item> wheel_[kLevels][1 << kBits];
+        uint64_t now_;
+    }; // class TimerWheel
+
+    // 基于随机令牌的会话管理。令牌为128位随机数，以32位十六进制字符串放在名为sid的cookie中。
+    // 会话表分为kShards个分片，每个分片是定长的开放寻址数组，探测长度不超过kMaxProbe：
+    //   - 查询不加锁：每个槽位用序号(seqlock)保护，读到奇数或前后序号不一致即视为不匹配；
+    //     命中后只写一次原子的最后访问时间；
+    //   - 登录、登出、过期删除在分片的互斥锁下修改槽位。
+    // 过期由后台线程的时间轮驱动，到期时若期间有过访问则按最后访问时间重新挂入，请求路径上不碰时间轮
+    class SessionManager{
+    public:
+        static SessionManager& GetSessionManager()
+        {
+            // 后台线程持续引用该对象，故不在进程退出时析构
+            static SessionManager *session_manager = new SessionManager();
+            return *session_manager;
+        }
+
+        // 创建会话，成功时返回令牌
+        bool Create(string *token)
+        {
+            uint64_t hi, lo;
+            do
+            {
+                if (!Random(&hi) || !Random(&lo)) return false;
+            } while ((hi | lo) == 0);
+
+            Shard &shard = shards_[lo & (kShards - 1)];
+            uint32_t index, gen;
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                size_t home = (lo >> kShardBits) & shard.mask;
+                size_t i = 0;
+                for (; i < kMaxProbe; i++)
+                {
+                    index = (home + i) & shard.mask;
+                    if ((shard.slots[index].hi.load(std::memory_order_relaxed) | shard.slots[index].lo.load(std::memory_order_relaxed)) == 0) break;
+                }
+                if (i == kMaxProbe)
+                {
+                    mylog::GetLogger("asynclogger")->Warn("session table full");
+                    return false;
+                }
+                shard.slots[index].last_access.store(now_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                gen = Write(&shard.slots[index], hi, lo);
+                size_++;
+            }
+            {
+                std::lock_guard<std::mutex> lock(wheel_mutex_);
+                wheel_.Add(wheel_.Now() + timeout_, {(uint32_t)(&shard - shards_), index, gen});
+            }
+
+            char buf[33];
+            snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)hi, (unsigned long long)lo);
+            *token = buf;
+            return true;
+        }
+
+        // 令牌有效时刷新其最后访问时间并返回true，不加锁
+        bool Check(const string &token)
+        {
+            uint64_t hi, lo;
+            if (!Parse(token, &hi, &lo)) return false;
+            Shard &shard = shards_[lo & (kShards - 1)];
+            size_t home = (lo >> kShardBits) & shard.mask;
+            for (size_t i = 0; i < kMaxProbe; i++)
+            {
+                Slot &slot = shard.slots[(home + i) & shard.mask];
+                uint32_t seq = slot.seq.load(std::memory_order_acquire);
+                if (seq & 1) continue;
+                bool match = slot.hi.load(std::memory_order_relaxed) == hi && slot.lo.load(std::memory_order_relaxed) == lo;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (match && slot.seq.load(std::memory_order_relaxed) == seq)
+                {
+                    uint32_t now = now_.load(std::memory_order_relaxed);
+                    if (slot.last_access.load(std::memory_order_relaxed) != now)
+                        slot.last_access.store(now, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void Destroy(const string &token)
+        {
+            uint64_t hi, lo;
+            if (!Parse(token, &hi, &lo)) return;
+            Shard &shard = shards_[lo & (kShards - 1)];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            size_t home = (lo >> kShardBits) & shard.mask;
+            for (size_t i = 0; i < kMaxProbe; i++)
+            {
+                Slot &slot = shard.slots[(home + i) & shard.mask];
+                if (slot.hi.load(std::memory_order_relaxed) == hi && slot.lo.load(std::memory_order_relaxed) == lo)
+                {
+                    Write(&slot, 0, 0);
+                    size_--;
+                    return;
+                }
+            }
+        }
+
+        size_t Size() const { return size_.load(std::memory_order_relaxed); }
+
+        uint32_t Timeout() const { return timeout_; }
+
+        SessionManager(const SessionManager&) = delete;
+        SessionManager& operator=(const SessionManager&) = delete;
+
+    private:
+        static constexpr size_t kShardBits = 4;
+        static constexpr size_t kShards = 1 << kShardBits;
+        static constexpr size_t kMaxProbe = 32;
+
+        struct Slot{
+            std::atomic<uint32_t> seq{0};           // 奇数表示正在修改
+            std::atomic<uint32_t> last_access{0};   // 相对启动时刻的秒数
+            std::atomic<uint64_t> hi{0};
+            std::atomic<uint64_t> lo{0};            // hi、lo全为0表示空槽
+        };
+
+        struct Shard{
+            std::mutex mutex;
+            std::unique_ptr<Slot[]> slots;
+            size_t mask = 0;
+        };
+
+        struct Timer{
+            uint32_t shard;
+            uint32_t index;
+            uint32_t gen;                           // 挂入时槽位的序号，槽位被复用后旧定时器作废
+        };
+
+        SessionManager()
+            : timeout_(std::max(1, Config::GetConfigData().GetSessionTimeout())), wheel_(0)
+        {
+            // 每个分片的槽数取2的幂，负载不超过一半
+            size_t per_shard = 1;
+            while (per_shard < 2 * (size_t)Config::GetConfigData().GetMaxSessions() / kShards) per_shard <<= 1;
+            per_shard = std::max(per_shard, kMaxProbe);
+            for (auto &shard : shards_)
+            {
+                shard.slots.reset(new Slot[per_shard]);
+                shard.mask = per_shard - 1;
+            }
+            std::thread(&SessionManager::ExpireLoop, this).detach();
+        }
+
+        // 修改槽位内容，返回修改后的序号
+        static uint32_t Write(Slot *slot, uint64_t hi, uint64_t lo)
+        {
+            uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+            slot->seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot->hi.store(hi, std::memory_order_relaxed);
+            slot->lo.store(lo, std::memory_order_relaxed);
+            slot->seq.store(seq + 2, std::memory_order_release);
+            return seq + 2;
+        }
+
+        void ExpireLoop()
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (;;)
+            {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                uint32_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start).count();
+                now_.store(now, std::memory_order_relaxed);
+
+                std::vector<Timer> expired;
+                {
+                    std::lock_guard<std::mutex> lock(wheel_mutex_);
+                    wheel_.Advance(now, [&](const Timer &t){ expired.push_back(t); });
+                }
+                for (auto &t : expired) Expire(t, now);
+            }
+        }
+
+        // 定时器到期：会话仍在且期间无访问则删除，否则按最后访问时间重新挂入
+        void Expire(const Timer &t, uint32_t now)
+        {
+            Shard &shard = shards_[t.shard];
+            Slot &slot = shard.slots[t.index];
+            uint32_t deadline;
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                if (slot.seq.load(std::memory_order_relaxed) != t.gen) return;
+                deadline = slot.last_access.load(std::memory_order_relaxed) + timeout_;
+                if (deadline <= now)
+                {
+                    Write(&slot, 0, 0);
+                    size_--;
+                    return;
+                }
+            }
+            std::lock_guard<std::mutex> lock(wheel_mutex_);
+            wheel_.Add(deadline, t);
+        }
+
+        static bool Random(uint64_t *out)
+        {
+            size_t got = 0;
+            while (got < sizeof(*out))
+            {
+                ssize_t n = getrandom((char *)out + got, sizeof(*out) - got, 0);
+                if (n < 0)
+                {
+                    if (errno == EINTR) continue;
+                    mylog::GetLogger("asynclogger")->Error("getrandom failed: %s", strerror(errno));
+                    return false;
+                }
+                got += n;
+            }
+            return true;
+        }
+
+        static bool Parse(const string &token, uint64_t *hi, uint64_t *lo)
+        {
+            if (token.size() != 32) return false;
+            uint64_t v[2] = {0, 0};
+            for (size_t i = 0; i < 32; i++)
+            {
+                char c = token[i];
+                int d;
+                if (c >= '0' && c <= '9') d = c - '0';
+                else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+                else return false;
+                v[i / 16] = v[i / 16] << 4 | d;
+            }
+            *hi = v[0];
+            *lo = v[1];
+            return (*hi | *lo) != 0;
+        }
+
+    private:
+        Shard shards_[kShards];
+        std::atomic<size_t> size_{0};
+        std::atomic<uint32_t> now_{0};              // 后台线程每秒更新，请求路径不必取系统时间
+        const uint32_t timeout_;                    // 会话空闲超时(秒)
+        std::mutex wheel_mutex_;
+        TimerWheel<Timer> wheel_;
+    }; // class SessionManager
+}
@@ -0,0 +1,151 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+#include "Util.hpp"
+
+namespace storage{
+    // 页面等静态文件，启动时读入内存并预先生成gzip、brotli压缩版本，
+    // 请求时只需按Accept-Encoding选出一份，以引用方式加入响应，不做任何文件操作。
+    // 文件的mtime或大小变化后(由事件循环定时调用Refresh检查)重新加载
+    class StaticAssets{
+    public:
+        using Body = std::shared_ptr<const string>;
+
+        struct Asset{
+            string content_type;
+            string etag;                                    // 未压缩内容的ETag，压缩版本在引号内追加后缀
+            time_t mtime = 0;
+            off_t size = -1;
+            Body identity;
+            Body gzip;                                      // 未开启预压缩或压缩后不更小时为空
+            Body br;
+        };
+        using AssetPtr = std::shared_ptr<const Asset>;
+
+        static StaticAssets& GetStaticAssets()
+        {
+            static StaticAssets assets;
+            return assets;
+        }
+
+        // 登记并加载一个文件，precompress为false时只缓存原文(如需要服务端渲染的模板)
+        bool Load(const string &path, const string &content_type, bool precompress)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                specs_[path] = {content_type, precompress};
+            }
+            return Reload(path);
+        }
+
+        AssetPtr Get(const string &path)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = assets_.find(path);
+            return it == assets_.end() ? nullptr : it->second;
+        }
+
+        // 重新加载有变化的文件
+        void Refresh()
+        {
+            std::vector<string> changed;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (auto &kv : specs_)
+                {
+                    struct stat st;
+                    if (stat(kv.first.c_str(), &st) == -1) continue;   // 文件暂时不可读时继续使用旧内容
+                    auto it = assets_.find(kv.first);
+                    if (it == assets_.end() || it->second->mtime != st.st_mtime || it->second->size != st.st_size)
+                        changed.push_back(kv.first);
+                }
+            }
+            for (auto &path : changed) Reload(path);
+        }
+
+        StaticAssets(const StaticAssets&) = delete;
+        StaticAssets& operator=(const StaticAssets&) = delete;
+
+    private:
+        struct Spec{
+            string content_type;
+            bool precompress;
+        };
+
+        StaticAssets() = default;
+
+        bool Reload(const string &path)
+        {
+            Spec spec;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                spec = specs_[path];
+            }
+            struct stat st;
+            string content;
+            if (stat(path.c_str(), &st) == -1 || !FileUtil(path).GetContent(&content))
+            {
+                mylog::GetLogger("asynclogger")->Error("load static file %s failed", path.c_str());
+                return false;
+            }
+
+            auto asset = std::make_shared<Asset>();
+            asset->content_type = spec.content_type;
+            asset->mtime = st.st_mtime;
+            asset->size = st.st_size;
+            char etag[64];
+            snprintf(etag, sizeof(etag), "\"%lx-%lx\"", (unsigned long)st.st_size, (unsigned long)st.st_mtime);
+            asset->etag = etag;
+            if (spec.precompress)
+            {
+                string gz, br;
+                if (Gzip(content, &gz) && gz.size() < content.size()) asset->gzip = std::make_shared<const string>(std::move(gz));
+                if (Brotli(content, &br) && br.size() < content.size()) asset->br = std::make_shared<const string>(std::move(br));
+            }
+            asset->identity = std::make_shared<const string>(std::move(content));
+            mylog::GetLogger("asynclogger")->Info("static file %s loaded, %ld bytes, gzip %ld, br %ld", path.c_str(), (long)st.st_size,
+                asset->gzip ? (long)asset->gzip->size() : -1L, asset->br ? (long)asset->br->size() : -1L);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            assets_[path] = std::move(asset);
+            return true;
+        }
+
+        static bool Gzip(const string &in, string *out)
+        {
+            z_stream zs = {};
+            if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+            out->resize(deflateBound(&zs, in.size()) + 32);
+            zs.next_in = (Bytef *)in.data();
+            zs.avail_in = in.size();
+            zs.next_out = (Bytef *)&(*out)[0];
+            zs.avail_out = out->size();
+            int ret = deflate(&zs, Z_FINISH);
+            out->resize(zs.total_out);
+            deflateEnd(&zs);
+            return ret == Z_STREAM_END;
+        }
+
+        static bool Brotli(const string &in, string *out)
+        {
+            size_t len = BrotliEncoderMaxCompressedSize(in.size());
+            if (len == 0) return false;
+            out->resize(len);
+            if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                                       in.size(), (const uint8_t *)in.data(), &len, (uint8_t *)&(*out)[0]))
+                return false;
+            out->resize(len);
+            return true;
+        }
+
+    private:
+        std::mutex mutex_;
+        std::unordered_map<string, Spec> specs_;
+        std::unordered_map<string, AssetPtr> assets_;
+    }; // class StaticAssets
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <sys/statvfs.h>
+#include "Config.hpp"
+#include "../log_system/logs_code/ThreadPool.hpp"
+
+namespace storage{
+    // 多块盘：普通存储和深度存储各自可以有多个根目录(通常每块盘一个挂载点)。
+    // 新文件放在哪个根目录由权重、剩余空间和该盘当前排队的I/O决定，同一时刻的大量上传会分散到各块盘；
+    // 每个文件所在的根目录就是其存储路径的前缀，随元数据持久化，读取时不需要再查找。
+    // 每个深度存储根目录有自己的压缩线程，一块慢盘只拖慢写往它的文件
+    class StorageRoots{
+    public:
+        struct Root{
+            string path;                                    // 以'/'结尾
+            bool deep;
+            double weight;                                  // 为0时不再放置新文件，已有文件照常读写
+            std::atomic<int> pending{0};                    // 写往该盘的进行中上传和排队压缩数
+            std::unique_ptr<ThreadPool> pool;               // 压缩线程，只有深度存储根目录有
+
+            uint64_t Free() const
+            {
+                struct statvfs vfs;
+                return statvfs(path.c_str(), &vfs) == 0 ? (uint64_t)vfs.f_bavail * vfs.f_frsize : 0;
+            }
+        };
+
+        static StorageRoots& GetStorageRoots()
+        {
+            static StorageRoots roots;
+            return roots;
+        }
+
+        // 为bytes字节的新文件选择根目录：放下后仍留有reserve的盘中，
+        // 按 权重 * 放下后的剩余空间 / (1 + 排队数) 取最大者，得分相差不到1%(如同一文件系统上的根目录)时轮流选择。
+        // 都放不下时返回nullptr
+        Root *Pick(bool deep, uint64_t bytes, uint64_t reserve)
+        {
+            Root *best = nullptr;
+            double best_score = 0;
+            size_t start = next_[deep].fetch_add(1, std::memory_order_relaxed);
+            for (size_t i = 0; i < roots_.size(); i++)
+            {
+                Root *r = roots_[(start + i) % roots_.size()].get();
+                if (r->deep != deep || r->weight <= 0) continue;
+                uint64_t free = r->Free();
+                if (free < bytes + reserve) continue;
+                double score = r->weight * (double)(free - bytes - reserve + 1) / (1 + r->pending.load(std::memory_order_relaxed));
+                if (best == nullptr || score > best_score * 1.01)
+                {
+                    best = r;
+                    best_score = score;
+                }
+            }
+            return best;
+        }
+
+        // 是否有能放下bytes字节并留有reserve的根目录，不影响轮流选择
+        bool Fits(bool deep, uint64_t bytes, uint64_t reserve) const
+        {
+            for (auto &r : roots_)
+                if (r->deep == deep && r->weight > 0 && r->Free() >= bytes + reserve) return true;
+            return false;
+        }
+
+        // 存储路径所在的根目录(最长前缀)，不在任何根目录下时返回nullptr
+        Root *RootOf(const string &path) const
+        {
+            Root *found = nullptr;
+            for (auto &r : roots_)
+                if (path.size() > r->path.size() && path.compare(0, r->path.size(), r->path) == 0 &&
+                    (found == nullptr || r->path.size() > found->path.size()))
+                    found = r.get();
+            return found;
+        }
+
+        // 根目录为path的Root
+        Root *Find(const string &path) const
+        {
+            for (auto &r : roots_)
+                if (r->path == path) return r.get();
+            return nullptr;
+        }
+
+        bool IsDeep(const string &storage_path) const
+        {
+            Root *r = RootOf(storage_path);
+            return r != nullptr && r->deep;
+        }
+
+        const std::vector<std::unique_ptr<Root>> &Roots() const { return roots_; }
+
+        StorageRoots(const StorageRoots&) = delete;
+        StorageRoots& operator=(const StorageRoots&) = delete;
+
+    private:
+        StorageRoots()
+        {
+            Config &cf = Config::GetConfigData();
+            Add(cf.GetLowStorageRoots(), false, 0);
+            Add(cf.GetDeepStorageRoots(), true, std::max(1, cf.GetCompressThreads()));
+        }
+
+        void Add(const std::vector<RootSpec> &specs, bool deep, int threads)
+        {
+            for (auto &spec : specs)
+            {
+                if (Find(spec.path) != nullptr)
+                {
+                    mylog::GetLogger("asynclogger")->Error("storage root %s configured twice, ignored", spec.path.c_str());
+                    continue;
+                }
+                std::unique_ptr<Root> r(new Root);
+                r->path = spec.path;
+                r->deep = deep;
+                r->weight = spec.weight;
+                FileUtil(r->path).CreateDirectory();
+                if (threads > 0) r->pool.reset(new ThreadPool(threads));
+                mylog::GetLogger("asynclogger")->Info("%s storage root %s, weight %.2f", deep ? "deep" : "low", spec.path.c_str(), spec.weight);
+                roots_.push_back(std::move(r));
+            }
+        }
+
+    private:
+        std::vector<std::unique_ptr<Root>> roots_;
+        std::atomic<size_t> next_[2] = {};                 // 普通、深度存储各自轮流的起点
+    }; // class StorageRoots
+}
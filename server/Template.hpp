@@ -0,0 +1,106 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+#include <event2/buffer.h>
+
+using std::string;
+
+namespace storage{
+    // 页面模板，占位符形如{{FILE_LIST}}(大写字母、数字和下划线)。
+    // 解析一次得到字面量与占位符交替的片段，渲染时字面量直接写入evbuffer，占位符交给调用者填充
+    class PageTemplate{
+    public:
+        // 对每个占位符调用，返回false表示不认识该占位符，原样输出
+        using Filler = std::function<bool(const string &name, evbuffer *out)>;
+
+        PageTemplate() = default;
+        explicit PageTemplate(const string &src) { Parse(src); }
+
+        void Parse(const string &src)
+        {
+            segments_.clear();
+            size_t pos = 0, literal_begin = 0;
+            while ((pos = src.find("{{", pos)) != string::npos)
+            {
+                size_t end = pos + 2;
+                while (end < src.size() && (isupper((unsigned char)src[end]) || isdigit((unsigned char)src[end]) || src[end] == '_')) end++;
+                if (end == pos + 2 || src.compare(end, 2, "}}") != 0)
+                {
+                    pos += 2;
+                    continue;
+                }
+                if (pos > literal_begin) segments_.push_back({false, src.substr(literal_begin, pos - literal_begin)});
+                segments_.push_back({true, src.substr(pos + 2, end - pos - 2)});
+                pos = literal_begin = end + 2;
+            }
+            if (literal_begin < src.size()) segments_.push_back({false, src.substr(literal_begin)});
+        }
+
+        void Render(evbuffer *out, const Filler &fill) const
+        {
+            for (auto &seg : segments_)
+            {
+                if (!seg.placeholder)
+                {
+                    evbuffer_add(out, seg.text.data(), seg.text.size());
+                }
+                else if (!fill(seg.text, out))
+                {
+                    evbuffer_add_printf(out, "{{%s}}", seg.text.c_str());
+                }
+            }
+        }
+
+    private:
+        struct Segment{
+            bool placeholder;
+            string text;                                    // 字面量内容或占位符名
+        };
+        std::vector<Segment> segments_;
+    }; // class PageTemplate
+
+    // 已渲染的HTML片段，如文件列表中的一行。version由生成片段所依据的数据(大小、修改时间等)算出，
+    // 不一致即视为过期，因此漏掉失效通知也不会输出旧内容
+    class FragmentCache{
+    public:
+        explicit FragmentCache(size_t max_entries) : max_entries_(max_entries) {}
+
+        // 命中时把片段追加到out
+        bool AppendTo(const string &key, uint64_t version, evbuffer *out)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = fragments_.find(key);
+            if (it == fragments_.end() || it->second.version != version) return false;
+            evbuffer_add(out, it->second.html.data(), it->second.html.size());
+            return true;
+        }
+
+        // 超过上限时整体清空，列表渲染会很快重新填满常用的部分
+        void Put(const string &key, uint64_t version, const string &html)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (fragments_.size() >= max_entries_ && fragments_.find(key) == fragments_.end()) fragments_.clear();
+            fragments_[key] = {version, html};
+        }
+
+        void Invalidate(const string &key)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            fragments_.erase(key);
+        }
+
+    private:
+        struct Fragment{
+            uint64_t version;
+            string html;
+        };
+
+        std::mutex mutex_;
+        std::unordered_map<string, Fragment> fragments_;
+        size_t max_entries_;
+    }; // class FragmentCache
+}
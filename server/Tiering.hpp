@@ -0,0 +1,218 @@
+#pragma once
+#include <ctime>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "DataManager.hpp"
+#include "StorageRoots.hpp"
+
+namespace storage{
+    // 冷热分层：后台线程定期把长时间没有被下载的普通存储文件压缩转入深度存储，
+    // 把近期下载频繁的深度存储文件解压转回普通存储，热数据不必每次解压，冷数据少占磁盘。
+    // 依据下载时维护的访问计数，而不是文件系统的atime；最近访问时间写回元数据随之持久化。
+    // 迁移按tier_rate限速，只在记录于迁移期间没有变化时才替换。有多块盘时目标根目录与上传一样按负载选择
+    class Tiering{
+    public:
+        static Tiering& GetTiering()
+        {
+            static Tiering tiering;
+            return tiering;
+        }
+
+        // 下载文件时调用
+        void RecordAccess(const string &url)
+        {
+            time_t now = time(nullptr);
+            std::lock_guard<std::mutex> lock(mutex_);
+            Access &a = access_[url];
+            if (now - a.window_start >= hot_window_)
+            {
+                a.window_start = now;
+                a.hits = 0;
+            }
+            a.hits++;
+            a.last = now;
+        }
+
+        void Start()
+        {
+            if (interval_ <= 0 || (cold_secs_ <= 0 && hot_hits_ <= 0)) return;
+            std::thread([this]{
+                while (true)
+                {
+                    std::this_thread::sleep_for(std::chrono::seconds(interval_));
+                    RunOnce();
+                }
+            }).detach();
+        }
+
+        // 检查一遍并完成迁移，返回迁移的文件数
+        size_t RunOnce()
+        {
+            time_t now = time(nullptr);
+            std::unordered_map<string, Access> access;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                access = access_;
+                // 计数窗口已过的记录不再有用，访问时间下面会写回元数据
+                for (auto it = access_.begin(); it != access_.end();)
+                {
+                    if (now - it->second.window_start >= hot_window_) it = access_.erase(it);
+                    else ++it;
+                }
+            }
+            DataManager &dm = DataManager::GetDataManager();
+            std::vector<std::pair<string, time_t>> times;
+            times.reserve(access.size());
+            for (auto &kv : access) times.emplace_back(kv.first, kv.second.last);
+            dm.RecordAccess(times);
+
+            std::vector<StorageInfo> files, hot, cold;
+            dm.GetAll(files);
+            StorageRoots &roots = StorageRoots::GetStorageRoots();
+            for (auto &f : files)
+            {
+                StorageRoots::Root *root = f.Packed() ? nullptr : roots.RootOf(f.storage_path_);
+                if (root == nullptr) continue;
+                if (root->deep)
+                {
+                    auto it = access.find(f.url_);
+                    if (hot_hits_ > 0 && it != access.end() && now - it->second.window_start < hot_window_ &&
+                        it->second.hits >= (uint32_t)hot_hits_)
+                        hot.push_back(f);
+                }
+                else if (cold_secs_ > 0 && std::max(f.atime_, f.mtime_) + cold_secs_ <= now)
+                {
+                    cold.push_back(f);
+                }
+            }
+            // 先提升最热的，再转移最久没有访问的
+            std::sort(hot.begin(), hot.end(), [&](const StorageInfo &a, const StorageInfo &b){
+                return access[a.url_].hits > access[b.url_].hits;
+            });
+            std::sort(cold.begin(), cold.end(), [](const StorageInfo &a, const StorageInfo &b){
+                return std::max(a.atime_, a.mtime_) < std::max(b.atime_, b.mtime_);
+            });
+
+            size_t promoted = 0, demoted = 0;
+            for (auto &f : hot)
+                if (Move(f, false)) promoted++;
+            for (auto &f : cold)
+                if (Move(f, true)) demoted++;
+            if (promoted + demoted > 0)
+                mylog::GetLogger("asynclogger")->Info("tiering: %lu files promoted, %lu files demoted this run", promoted, demoted);
+            return promoted + demoted;
+        }
+
+        uint64_t Promoted() const { return promoted_.load(std::memory_order_relaxed); }
+        uint64_t Demoted() const { return demoted_.load(std::memory_order_relaxed); }
+
+        Tiering(const Tiering&) = delete;
+        Tiering& operator=(const Tiering&) = delete;
+
+    private:
+        struct Access{
+            time_t last = 0;                                // 最近一次下载
+            time_t window_start = 0;                        // 当前计数窗口的开始
+            uint32_t hits = 0;                              // 窗口内的下载次数
+        };
+
+        Tiering()
+        {
+            Config &cf = Config::GetConfigData();
+            interval_ = cf.GetTierInterval();
+            cold_secs_ = (time_t)cf.GetTierColdDays() * 24 * 60 * 60;
+            hot_hits_ = cf.GetTierHotHits();
+            hot_window_ = std::max(1, cf.GetTierHotWindow());
+            rate_ = cf.GetTierRate();
+            low_quota_ = cf.GetLowStorageQuota();
+            deep_quota_ = cf.GetDeepStorageQuota();
+            reserve_ = cf.GetDiskReserveBytes();
+        }
+
+        // demote为true时压缩转入深度存储，否则解压转回普通存储。对象名不变，只换存储根目录
+        bool Move(const StorageInfo &f, bool demote)
+        {
+            StorageRoots::Root *from = StorageRoots::GetStorageRoots().RootOf(f.storage_path_);
+            if (from == nullptr) return false;
+            string name = f.storage_path_.substr(from->path.size());
+            uint64_t plain = demote ? f.fsize_ : (f.osize_ != StorageInfo::kUnknownSize ? f.osize_ : f.fsize_);
+            StorageRoots::Root *to = HasRoom(demote, plain) ? StorageRoots::GetStorageRoots().Pick(demote, plain, reserve_) : nullptr;
+            if (to == nullptr) return false;
+            string dst = to->path + name;
+
+            // 文件在检查之后又被写入(如正在覆盖上传)时放弃
+            struct stat st;
+            if (stat(f.storage_path_.c_str(), &st) == -1 || st.st_mtime != f.mtime_ || (size_t)st.st_size != f.fsize_) return false;
+
+            // 暂存在目标根目录下，改名不跨文件系统；核对扫描会跳过该目录
+            string staging = to->path + StorageInfo::kPartialDir;
+            string tmp = staging + "tier-" + name;
+            std::replace(tmp.begin() + staging.size(), tmp.end(), '/', '_');
+            FileUtil(staging).CreateDirectory();
+            to->pending.fetch_add(1, std::memory_order_relaxed);
+            bool ok = demote ? FileUtil(tmp).Compress(f.storage_path_) : FileUtil(f.storage_path_).UnCompress(tmp);
+            to->pending.fetch_sub(1, std::memory_order_relaxed);
+            if (!ok || stat(f.storage_path_.c_str(), &st) == -1 || st.st_mtime != f.mtime_ || (size_t)st.st_size != f.fsize_)
+            {
+                remove(tmp.c_str());
+                return false;
+            }
+            // 保留原来的修改时间，使Last-Modified不变，核对时也不会当作磁盘上的文件发生了变化
+            struct timespec times[2] = {{f.atime_, 0}, {f.mtime_, 0}};
+            utimensat(AT_FDCWD, tmp.c_str(), times, 0);
+            FileUtil(dst.substr(0, dst.find_last_of('/') + 1)).CreateDirectory();
+            if (rename(tmp.c_str(), dst.c_str()) == -1)
+            {
+                mylog::GetLogger("asynclogger")->Error("tiering: rename %s to %s failed: %s", tmp.c_str(), dst.c_str(), strerror(errno));
+                remove(tmp.c_str());
+                return false;
+            }
+
+            StorageInfo info = f;
+            info.storage_path_ = dst;
+            info.fsize_ = FileUtil(dst).FileSize();
+            info.osize_ = plain;
+            if (!DataManager::GetDataManager().ReplaceIf(f, info))
+            {
+                remove(dst.c_str());
+                return false;
+            }
+            remove(f.storage_path_.c_str());        // 正在发送该文件的下载已打开fd，不受影响
+            (demote ? demoted_ : promoted_).fetch_add(1, std::memory_order_relaxed);
+            mylog::GetLogger("asynclogger")->Info("tiering: %s %s, %lu -> %lu bytes", demote ? "demoted" : "promoted",
+                f.url_.c_str(), (unsigned long)f.fsize_, (unsigned long)info.fsize_);
+
+            // 按未压缩大小限速
+            if (rate_ > 0) std::this_thread::sleep_for(std::chrono::milliseconds(plain * 1000 / rate_));
+            return true;
+        }
+
+        // 目标存储类别的配额，按未压缩大小估算；磁盘保留空间由选择根目录时检查
+        bool HasRoom(bool demote, uint64_t bytes)
+        {
+            uint64_t quota = demote ? deep_quota_ : low_quota_;
+            DataManager::StorageClass c = demote ? DataManager::kDeep : DataManager::kLow;
+            return quota == 0 || DataManager::GetDataManager().GetUsage(c).bytes + bytes <= quota;
+        }
+
+    private:
+        std::mutex mutex_;
+        std::unordered_map<string, Access> access_;         // 下载URL -> 访问计数
+        int interval_;
+        time_t cold_secs_;
+        int hot_hits_;
+        time_t hot_window_;
+        size_t rate_;
+        uint64_t low_quota_, deep_quota_, reserve_;
+        std::atomic<uint64_t> promoted_{0};
+        std::atomic<uint64_t> demoted_{0};
+    }; // class Tiering
+}
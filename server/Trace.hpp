@@ -0,0 +1,227 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "Config.hpp"
+#include "Metrics.hpp"
+
+namespace storage{
+    // 请求内各阶段的耗时追踪。
+    // 阶段的起止时间用TSC记录，写入当前线程自己的环形缓冲区，无锁、无内存分配；
+    // 请求结束时若总耗时超过阈值，才把该请求的各阶段从本线程的环中取出，转换为纳秒保存，
+    // 通过/admin/trace以Chrome trace格式(chrome://tracing、Perfetto可直接打开)导出
+    class Tracer{
+    public:
+        static Tracer& GetTracer()
+        {
+            static Tracer tracer;
+            return tracer;
+        }
+
+        static uint64_t Now()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#else
+            return MonotonicNs();
+#endif
+        }
+
+        // 开始追踪一个请求，返回其在本线程的编号
+        uint64_t BeginRequest()
+        {
+            Ring &ring = LocalRing();
+            return ring.current = ++ring.last_id;
+        }
+
+        void RecordSpan(const char *name, uint64_t begin, uint64_t end)
+        {
+            Ring &ring = LocalRing();
+            if (ring.current == 0) return;
+            ring.spans[ring.head++ & (kRingSize - 1)] = {name, ring.current, begin, end};
+        }
+
+        // 结束请求：慢请求连同其各阶段一起保存下来
+        void EndRequest(uint64_t id, const char *name, const string &detail, uint64_t begin, uint64_t end)
+        {
+            Ring &ring = LocalRing();
+            uint64_t dur_ns = ToNs(end - begin);
+            if (dur_ns >= slow_ns_)
+            {
+                Trace trace;
+                trace.name = name;
+                trace.detail = detail;
+                trace.tid = ring.tid;
+                trace.begin_ns = ToNs(begin - base_tsc_);
+                trace.dur_ns = dur_ns;
+                // 同一请求的阶段在环尾部连续存放
+                for (uint64_t i = ring.head; i > 0 && ring.head - i < kRingSize; i--)
+                {
+                    const Span &s = ring.spans[(i - 1) & (kRingSize - 1)];
+                    if (s.request != id) break;
+                    trace.spans.push_back({s.name, ToNs(s.begin - base_tsc_), ToNs(s.end - s.begin)});
+                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                traces_.push_back(std::move(trace));
+                if (traces_.size() > kMaxTraces) traces_.pop_front();
+            }
+            ring.current = 0;
+        }
+
+        // Chrome trace JSON，时间单位为微秒
+        string Dump(bool clear)
+        {
+            std::deque<Trace> traces;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (clear) traces.swap(traces_);
+                else traces = traces_;
+            }
+            Json::Value root;
+            root["displayTimeUnit"] = "ms";
+            Json::Value &events = root["traceEvents"] = Json::Value(Json::arrayValue);
+            for (auto &t : traces)
+            {
+                Json::Value ev;
+                ev["name"] = t.name;
+                ev["cat"] = "request";
+                ev["ph"] = "X";
+                ev["pid"] = 1;
+                ev["tid"] = t.tid;
+                ev["ts"] = t.begin_ns / 1000.0;
+                ev["dur"] = t.dur_ns / 1000.0;
+                ev["args"]["detail"] = t.detail;
+                events.append(ev);
+                for (auto &s : t.spans)
+                {
+                    Json::Value sp;
+                    sp["name"] = s.name;
+                    sp["cat"] = "stage";
+                    sp["ph"] = "X";
+                    sp["pid"] = 1;
+                    sp["tid"] = t.tid;
+                    sp["ts"] = s.begin_ns / 1000.0;
+                    sp["dur"] = s.dur_ns / 1000.0;
+                    events.append(sp);
+                }
+            }
+            string body;
+            JsonUtil::Serialize(root, &body, true);
+            return body;
+        }
+
+        Tracer(const Tracer&) = delete;
+        Tracer& operator=(const Tracer&) = delete;
+
+    private:
+        static constexpr size_t kRingSize = 1024;           // 每线程保留的阶段数，须为2的幂
+        static constexpr size_t kMaxTraces = 256;           // 保留的慢请求数
+
+        struct Span{
+            const char *name;                               // 只接受字符串字面量
+            uint64_t request;
+            uint64_t begin;
+            uint64_t end;
+        };
+
+        struct Ring{
+            Span spans[kRingSize];
+            uint64_t head = 0;
+            uint64_t current = 0;                           // 正在追踪的请求编号，0表示没有
+            uint64_t last_id = 0;
+            uint32_t tid = 0;
+        };
+
+        struct SavedSpan{
+            const char *name;
+            uint64_t begin_ns;
+            uint64_t dur_ns;
+        };
+
+        struct Trace{
+            string name;
+            string detail;
+            uint32_t tid;
+            uint64_t begin_ns;
+            uint64_t dur_ns;
+            std::vector<SavedSpan> spans;
+        };
+
+        // 用一小段睡眠校准TSC频率，仅在启动时执行一次
+        Tracer()
+        {
+            slow_ns_ = (uint64_t)std::max(0, Config::GetConfigData().GetTraceSlowMs()) * 1000000;
+            uint64_t ns0 = MonotonicNs();
+            base_tsc_ = Now();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            uint64_t ns1 = MonotonicNs(), tsc1 = Now();
+            ns_per_tick_ = (tsc1 > base_tsc_ && ns1 > ns0) ? (double)(ns1 - ns0) / (tsc1 - base_tsc_) : 1.0;
+        }
+
+        uint64_t ToNs(uint64_t ticks) const { return (uint64_t)(ticks * ns_per_tick_); }
+
+        static Ring &LocalRing()
+        {
+            thread_local std::unique_ptr<Ring> ring;
+            if (!ring)
+            {
+                ring.reset(new Ring());
+                ring->tid = (uint32_t)syscall(SYS_gettid);
+            }
+            return *ring;
+        }
+
+    private:
+        uint64_t slow_ns_;
+        uint64_t base_tsc_;
+        double ns_per_tick_;
+        std::mutex mutex_;
+        std::deque<Trace> traces_;
+    }; // class Tracer
+
+    // 一个请求的追踪范围，析构时结束
+    class TraceRequest{
+    public:
+        explicit TraceRequest(const char *name)
+            : name_(name), id_(Tracer::GetTracer().BeginRequest()), begin_(Tracer::Now()) {}
+        ~TraceRequest() { Tracer::GetTracer().EndRequest(id_, name_, detail_, begin_, Tracer::Now()); }
+
+        void SetDetail(const string &detail) { detail_ = detail; }
+
+    private:
+        const char *name_;
+        uint64_t id_;
+        uint64_t begin_;
+        string detail_;
+    }; // class TraceRequest
+
+    // 顺序执行的各阶段：Next结束当前阶段并开始下一阶段，析构时结束最后一个阶段
+    class TraceStages{
+    public:
+        explicit TraceStages(const char *name) : name_(name), begin_(Tracer::Now()) {}
+        ~TraceStages() { End(); }
+
+        void Next(const char *name)
+        {
+            uint64_t now = Tracer::Now();
+            if (name_) Tracer::GetTracer().RecordSpan(name_, begin_, now);
+            name_ = name;
+            begin_ = now;
+        }
+
+        void End() { Next(nullptr); }
+
+    private:
+        const char *name_;
+        uint64_t begin_;
+    }; // class TraceStages
+}
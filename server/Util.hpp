@@ -87,6 +87,12 @@ namespace storage{
             return true;
         }
 
+        // 一次stat取得文件的全部属性，文件不存在时返回false
+        bool GetStat(struct stat *st)
+        {
+            return stat(filename_.c_str(), st) == 0;
+        }
+
         // 获取文件大小
         int64_t FileSize()
         {
@@ -187,22 +193,23 @@ namespace storage{
             return true;
         }
 
-        // 流压缩文件
-        bool Compress(const std::string sorce)
+        // 流压缩文件，level为zlib压缩级别，chunk_size为每次读写的缓冲区大小
+        bool Compress(const std::string sorce, int level = Z_DEFAULT_COMPRESSION, size_t chunk_size = 16384)
         {
-            const size_t CHUNK_SIZE_ZLIB = 16384;
+            const size_t CHUNK_SIZE_ZLIB = chunk_size;
 
             int ret;
             z_stream strm;
-            unsigned char in[CHUNK_SIZE_ZLIB];
-            unsigned char out[CHUNK_SIZE_ZLIB];
+            std::vector<unsigned char> in_buf(CHUNK_SIZE_ZLIB), out_buf(CHUNK_SIZE_ZLIB);
+            unsigned char *in = in_buf.data();
+            unsigned char *out = out_buf.data();
 
             strm.zalloc = Z_NULL;
             strm.zfree = Z_NULL;
             strm.opaque = Z_NULL;
 
             // 初始化Zlib流
-            ret = deflateInit(&strm, Z_DEFAULT_COMPRESSION);
+            ret = deflateInit(&strm, level);
             if (ret != Z_OK)
             {
                 mylog::GetLogger("asynclogger")->Error("z_stream init error");
@@ -256,9 +263,9 @@ namespace storage{
         }
 
         // 流解压文件
-        bool UnCompress(std::string &uncompress_path)
+        bool UnCompress(std::string &uncompress_path, size_t chunk_size = 16384)
         {
-            const size_t CHUNK_SIZE_ZLIB = 16384;
+            const size_t CHUNK_SIZE_ZLIB = chunk_size;
             std::ifstream source_file(filename_, std::ios::binary);
             if (!source_file.is_open())
             {
@@ -275,8 +282,9 @@ namespace storage{
 
             int ret;
             z_stream strm;
-            unsigned char in[CHUNK_SIZE_ZLIB];
-            unsigned char out[CHUNK_SIZE_ZLIB];
+            std::vector<unsigned char> in_buf(CHUNK_SIZE_ZLIB), out_buf(CHUNK_SIZE_ZLIB);
+            unsigned char *in = in_buf.data();
+            unsigned char *out = out_buf.data();
 
             strm.zalloc = Z_NULL;
             strm.zfree = Z_NULL;
@@ -375,24 +383,32 @@ namespace storage{
             }
         }
 
-        // 扫描指定目录中的普通文件并返回其相对路径
-        bool ScanDirectory(std::vector<std::string> *arry)
+        // 扫描指定目录中的普通文件并返回其相对路径，recursive为true时包含子目录
+        bool ScanDirectory(std::vector<std::string> *arry, bool recursive = false)
         {
-            for (auto &p : fs::directory_iterator(filename_))
+            std::error_code ec;
+            if (recursive)
             {
-                if (p.is_directory()) continue;
-                arry->push_back(p.path().relative_path().string());
+                for (auto &p : fs::recursive_directory_iterator(filename_, ec))
+                    if (p.is_regular_file()) arry->push_back(p.path().string());
+                return !ec;
             }
-            return true;
+            for (auto &p : fs::directory_iterator(filename_, ec))
+            {
+                if (!p.is_regular_file()) continue;
+                arry->push_back(p.path().string());
+            }
+            return !ec;
         }
     }; // class FileUtil
 
     class JsonUtil{
         public:
-            static bool Serialize(const Json::Value &val, std::string *str)
+            static bool Serialize(const Json::Value &val, std::string *str, bool compact = false)
             {
                 Json::StreamWriterBuilder swb;
                 swb["emitUTF8"] = true; // 直接输出UTF-8字符，不进行转义
+                if (compact) swb["indentation"] = ""; // 不缩进不换行，用于接口响应
                 std::unique_ptr<Json::StreamWriter> usw(swb.newStreamWriter());
                 std::stringstream ss;
                 if (usw->write(val, &ss) != 0)
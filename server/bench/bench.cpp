@@ -0,0 +1,522 @@
+// 云存储服务端压测工具
+// 用法: ./bench/bench [profile.json] [--spawn ./test] [--out result.json]
+//   profile.json  描述连接数、时长、文件大小和各类请求的比例，见bench/profile.json
+//   --spawn       先在当前目录启动服务端程序，压测结束后关闭
+//   --out         结果写入文件，默认输出到标准输出
+// 每个连接同一时刻只有一个请求(闭环)，按profile中的权重随机选择下一个操作。
+// 结果为JSON，包含每类操作的次数、错误数、字节数及p50/p99/p999延迟，便于对比不同版本
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <event2/event.h>
+#include <event2/http.h>
+#include <event2/buffer.h>
+#include <event2/keyvalq_struct.h>
+#include <jsoncpp/json/json.h>
+#include "../Metrics.hpp"
+#include "../base64.h"
+
+namespace bench{
+    using storage::Histogram;
+
+    enum Op { kUploadLow, kUploadDeep, kDownload, kRangeDownload, kList, kDelete, kOpCount };
+    const char *kOpNames[kOpCount] = {"upload_low", "upload_deep", "download", "range_download", "list", "delete"};
+
+    struct Profile{
+        string host = "127.0.0.1";
+        int port = 6636;
+        string password;
+        int connections = 8;
+        double duration_sec = 10;
+        int seed_files = 16;
+        size_t min_size = 4096;
+        size_t max_size = 1 << 20;
+        size_t chunk_size = 1 << 20;
+        size_t range_bytes = 64 * 1024;
+        double mix[kOpCount] = {5, 1, 60, 20, 12, 2};
+        bool cleanup = true;
+
+        bool Load(const string &path)
+        {
+            std::ifstream in(path);
+            if (!in) return false;
+            Json::Value v;
+            Json::CharReaderBuilder builder;
+            string errs;
+            if (!Json::parseFromStream(builder, in, &v, &errs))
+            {
+                fprintf(stderr, "parse %s: %s\n", path.c_str(), errs.c_str());
+                return false;
+            }
+            host = v.get("host", host).asString();
+            port = v.get("port", port).asInt();
+            password = v.get("password", password).asString();
+            connections = std::max(1, v.get("connections", connections).asInt());
+            duration_sec = v.get("duration_sec", duration_sec).asDouble();
+            seed_files = v.get("seed_files", seed_files).asInt();
+            min_size = v["file_size"].get("min", (Json::UInt64)min_size).asUInt64();
+            max_size = std::max(min_size, (size_t)v["file_size"].get("max", (Json::UInt64)max_size).asUInt64());
+            chunk_size = std::max<size_t>(1, v.get("chunk_size", (Json::UInt64)chunk_size).asUInt64());
+            range_bytes = std::max<size_t>(1, v.get("range_bytes", (Json::UInt64)range_bytes).asUInt64());
+            if (v.isMember("mix"))
+                for (int i = 0; i < kOpCount; i++) mix[i] = v["mix"].get(kOpNames[i], 0).asDouble();
+            cleanup = v.get("cleanup", cleanup).asBool();
+            return true;
+        }
+    };
+
+    struct OpStats{
+        Histogram latency;              // 纳秒
+        uint64_t count = 0;
+        uint64_t errors = 0;
+        uint64_t bytes = 0;
+    };
+
+    struct RemoteFile{
+        string name;
+        size_t size;
+        string etag;                    // 完整下载过一次后才知道
+    };
+
+    class Bench;
+
+    // 一个HTTP连接及其上正在执行的操作
+    struct Worker{
+        Bench *bench;
+        int id;
+        evhttp_connection *conn = nullptr;
+        bool busy = false;
+        Op op;
+        uint64_t op_start = 0;
+        bool measured = false;
+        // 正在进行的上传
+        string name;
+        string upload_id;
+        size_t size = 0;
+        size_t chunk = 0;
+        size_t chunks = 0;
+        size_t file_index = 0;          // 下载、删除的目标在pool中的位置
+    };
+
+    class Bench{
+    public:
+        enum Phase { kLogin, kSeed, kRun, kCleanup };
+
+        Bench(const Profile &p) : p_(p), rng_(std::random_device{}())
+        {
+            data_.resize(p_.max_size);
+            for (auto &c : data_) c = (char)rng_();
+            run_id_ = std::to_string(time(nullptr)) + "-" + std::to_string(getpid());
+        }
+
+        ~Bench()
+        {
+            for (auto &w : workers_) if (w.conn) evhttp_connection_free(w.conn);
+            if (base_) event_base_free(base_);
+        }
+
+        bool Run(Json::Value *result)
+        {
+            base_ = event_base_new();
+            workers_.resize(p_.connections);
+            for (int i = 0; i < p_.connections; i++)
+            {
+                workers_[i].bench = this;
+                workers_[i].id = i;
+                workers_[i].conn = evhttp_connection_base_new(base_, nullptr, p_.host.c_str(), p_.port);
+                evhttp_connection_set_timeout(workers_[i].conn, 60);
+            }
+
+            if (!p_.password.empty())
+            {
+                RunPhase(kLogin);
+                if (cookie_.empty())
+                {
+                    fprintf(stderr, "login failed\n");
+                    return false;
+                }
+            }
+            seed_left_ = p_.seed_files;
+            RunPhase(kSeed);
+            if (pool_.empty() && (p_.mix[kDownload] > 0 || p_.mix[kRangeDownload] > 0 || p_.mix[kDelete] > 0))
+                fprintf(stderr, "warning: no files seeded, download/delete ops will be skipped\n");
+
+            auto start = std::chrono::steady_clock::now();
+            deadline_ = storage::MonotonicNs() + (uint64_t)(p_.duration_sec * 1e9);
+            RunPhase(kRun);
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (p_.cleanup)
+            {
+                for (auto &f : pool_) cleanup_.push_back(f.name);
+                RunPhase(kCleanup);
+            }
+            Report(elapsed, result);
+            return true;
+        }
+
+        // 请求完成回调，req为nullptr表示连接失败或超时
+        static void OnDone(evhttp_request *req, void *arg)
+        {
+            Worker *w = (Worker *)arg;
+            w->bench->Done(w, req);
+        }
+
+    private:
+        void RunPhase(Phase phase)
+        {
+            phase_ = phase;
+            active_ = 0;
+            for (auto &w : workers_) Next(&w);
+            if (active_ > 0) event_base_dispatch(base_);
+        }
+
+        // 为空闲连接安排下一个操作，没有可做的则保持空闲；全部空闲时结束本阶段
+        void Next(Worker *w)
+        {
+            w->busy = false;
+            switch (phase_)
+            {
+            case kLogin:
+                if (w->id == 0 && cookie_.empty() && !login_sent_)
+                {
+                    login_sent_ = true;
+                    StartLogin(w);
+                }
+                break;
+            case kSeed:
+                if (seed_left_ > 0)
+                {
+                    seed_left_--;
+                    StartUpload(w, kUploadLow, false);
+                }
+                break;
+            case kRun:
+                if (storage::MonotonicNs() < deadline_) StartOp(w, PickOp());
+                break;
+            case kCleanup:
+                if (!cleanup_.empty())
+                {
+                    w->op = kDelete;
+                    w->measured = false;
+                    Send(w, EVHTTP_REQ_GET, "/delete/" + cleanup_.back(), nullptr, 0, {});
+                    cleanup_.pop_back();
+                }
+                break;
+            }
+            if (w->busy) active_++;
+            if (active_ == 0) event_base_loopbreak(base_);
+        }
+
+        Op PickOp()
+        {
+            double total = 0;
+            for (double m : p_.mix) total += m;
+            double r = std::uniform_real_distribution<double>(0, total)(rng_);
+            for (int i = 0; i < kOpCount; i++)
+            {
+                if (r < p_.mix[i]) return (Op)i;
+                r -= p_.mix[i];
+            }
+            return kList;
+        }
+
+        void StartOp(Worker *w, Op op)
+        {
+            w->measured = true;
+            if ((op == kDownload || op == kRangeDownload || op == kDelete) && pool_.empty()) op = kList;
+            switch (op)
+            {
+            case kUploadLow:
+            case kUploadDeep:
+                StartUpload(w, op, true);
+                return;
+            case kDownload:
+            case kRangeDownload:
+            {
+                w->op = op;
+                w->file_index = std::uniform_int_distribution<size_t>(0, pool_.size() - 1)(rng_);
+                const RemoteFile &f = pool_[w->file_index];
+                w->name = f.name;
+                std::vector<std::pair<string, string>> headers;
+                // 断点续传需要If-Range，还没有拿到ETag的文件先做一次完整下载
+                if (op == kRangeDownload && !f.etag.empty())
+                {
+                    size_t len = std::min(p_.range_bytes, f.size);
+                    size_t from = f.size > len ? std::uniform_int_distribution<size_t>(0, f.size - len)(rng_) : 0;
+                    headers.push_back({"If-Range", f.etag});
+                    headers.push_back({"Range", "bytes=" + std::to_string(from) + "-" + std::to_string(from + len - 1)});
+                }
+                else w->op = kDownload;
+                w->op_start = storage::MonotonicNs();
+                Send(w, EVHTTP_REQ_GET, "/download/" + f.name, nullptr, 0, headers);
+                return;
+            }
+            case kList:
+                w->op = kList;
+                w->op_start = storage::MonotonicNs();
+                Send(w, EVHTTP_REQ_GET, "/api/files?limit=50", nullptr, 0, {});
+                return;
+            case kDelete:
+            {
+                w->op = kDelete;
+                size_t i = std::uniform_int_distribution<size_t>(0, pool_.size() - 1)(rng_);
+                string name = pool_[i].name;
+                pool_[i] = pool_.back();
+                pool_.pop_back();
+                w->op_start = storage::MonotonicNs();
+                Send(w, EVHTTP_REQ_GET, "/delete/" + name, nullptr, 0, {});
+                return;
+            }
+            default:
+                return;
+            }
+        }
+
+        void StartLogin(Worker *w)
+        {
+            w->op = kList;
+            w->measured = false;
+            string body = "password=" + p_.password;
+            Send(w, EVHTTP_REQ_POST, "/login", body.data(), body.size(), {});
+        }
+
+        void StartUpload(Worker *w, Op op, bool measured)
+        {
+            w->op = op;
+            w->measured = measured;
+            w->size = std::uniform_int_distribution<size_t>(p_.min_size, p_.max_size)(rng_);
+            w->chunks = std::max<size_t>(1, (w->size + p_.chunk_size - 1) / p_.chunk_size);
+            w->chunk = 0;
+            w->name = "bench/" + run_id_ + "/w" + std::to_string(w->id) + "-" + std::to_string(seq_++) + ".bin";
+            w->upload_id = "bench-" + std::to_string(w->id) + "-" + std::to_string(seq_);
+            w->op_start = storage::MonotonicNs();
+            SendChunk(w);
+        }
+
+        void SendChunk(Worker *w)
+        {
+            size_t from = w->chunk * p_.chunk_size;
+            size_t len = std::min(p_.chunk_size, w->size - from);
+            std::vector<std::pair<string, string>> headers = {
+                {"FileName", base64_encode(w->name)},
+                {"StorageType", w->op == kUploadDeep ? "deep" : "low"},
+                {"Upload-Id", w->upload_id},
+                {"Chunk-Index", std::to_string(w->chunk)},
+                {"Total-Chunks", std::to_string(w->chunks)},
+                {"Chunk-Size", std::to_string(p_.chunk_size)},
+                {"Total-Size", std::to_string(w->size)},
+            };
+            Send(w, EVHTTP_REQ_POST, "/upload", data_.data() + from, len, headers);
+        }
+
+        void Send(Worker *w, evhttp_cmd_type cmd, const string &uri, const char *body, size_t len,
+                  const std::vector<std::pair<string, string>> &headers)
+        {
+            evhttp_request *req = evhttp_request_new(OnDone, w);
+            evkeyvalq *out = evhttp_request_get_output_headers(req);
+            evhttp_add_header(out, "Host", p_.host.c_str());
+            if (!cookie_.empty()) evhttp_add_header(out, "Cookie", cookie_.c_str());
+            if (cmd == EVHTTP_REQ_POST && uri == "/login") evhttp_add_header(out, "Content-Type", "application/x-www-form-urlencoded");
+            for (auto &h : headers) evhttp_add_header(out, h.first.c_str(), h.second.c_str());
+            if (len > 0) evbuffer_add(evhttp_request_get_output_buffer(req), body, len);
+            w->busy = evhttp_make_request(w->conn, req, cmd, uri.c_str()) == 0;
+            if (!w->busy) fprintf(stderr, "request %s failed to start\n", uri.c_str());
+        }
+
+        void Done(Worker *w, evhttp_request *req)
+        {
+            active_--;
+            int code = req ? evhttp_request_get_response_code(req) : 0;
+            bool ok = code >= 200 && code < 300;
+            size_t in_bytes = req ? evbuffer_get_length(evhttp_request_get_input_buffer(req)) : 0;
+
+            if (phase_ == kLogin)
+            {
+                const char *c = ok ? evhttp_find_header(evhttp_request_get_input_headers(req), "Set-Cookie") : nullptr;
+                if (c) cookie_ = string(c).substr(0, string(c).find(';'));
+                Next(w);
+                return;
+            }
+
+            if ((w->op == kUploadLow || w->op == kUploadDeep) && ok && ++w->chunk < w->chunks)
+            {
+                // 同一文件的下一个分片，整个文件传完才算一次操作
+                SendChunk(w);
+                if (w->busy)
+                {
+                    active_++;
+                    return;
+                }
+            }
+
+            uint64_t ns = storage::MonotonicNs() - w->op_start;
+            if (w->measured)
+            {
+                OpStats &s = stats_[w->op];
+                s.count++;
+                if (!ok) s.errors++;
+                else s.latency.Record(ns);
+                if (w->op == kUploadLow || w->op == kUploadDeep) s.bytes += ok ? w->size : 0;
+                else s.bytes += in_bytes;
+            }
+
+            if (ok && (w->op == kUploadLow || w->op == kUploadDeep))
+            {
+                // 深度存储的文件在后台压缩完成后才可下载，只记下名字用于清理
+                if (w->op == kUploadLow) pool_.push_back({w->name, w->size, ""});
+                else if (p_.cleanup) cleanup_.push_back(w->name);
+            }
+            else if (ok && w->op == kDownload && w->file_index < pool_.size() && pool_[w->file_index].name == w->name)
+            {
+                const char *etag = evhttp_find_header(evhttp_request_get_input_headers(req), "ETag");
+                if (etag) pool_[w->file_index].etag = etag;
+            }
+            if (!ok && code == 0 && phase_ == kRun) errors_connect_++;
+            Next(w);
+        }
+
+        void Report(double elapsed, Json::Value *result)
+        {
+            Json::Value &ops = (*result)["ops"];
+            uint64_t total = 0, errors = 0, bytes = 0;
+            std::vector<uint64_t> counts;
+            for (int i = 0; i < kOpCount; i++)
+            {
+                OpStats &s = stats_[i];
+                if (s.count == 0) continue;
+                uint64_t sum;
+                s.latency.Snapshot(&counts, &sum);
+                Json::Value o;
+                o["count"] = (Json::UInt64)s.count;
+                o["errors"] = (Json::UInt64)s.errors;
+                o["bytes"] = (Json::UInt64)s.bytes;
+                o["ops_per_sec"] = s.count / elapsed;
+                o["mean_ms"] = s.count > s.errors ? sum / 1e6 / (s.count - s.errors) : 0;
+                o["p50_ms"] = Histogram::Quantile(counts, 0.5) / 1e6;
+                o["p99_ms"] = Histogram::Quantile(counts, 0.99) / 1e6;
+                o["p999_ms"] = Histogram::Quantile(counts, 0.999) / 1e6;
+                ops[kOpNames[i]] = o;
+                total += s.count;
+                errors += s.errors;
+                bytes += s.bytes;
+            }
+            Json::Value &t = (*result)["total"];
+            t["elapsed_sec"] = elapsed;
+            t["connections"] = p_.connections;
+            t["ops"] = (Json::UInt64)total;
+            t["errors"] = (Json::UInt64)errors;
+            t["connect_errors"] = (Json::UInt64)errors_connect_;
+            t["ops_per_sec"] = total / elapsed;
+            t["mb_per_sec"] = bytes / elapsed / (1 << 20);
+        }
+
+    private:
+        Profile p_;
+        std::mt19937_64 rng_;
+        string data_;                   // 上传内容取自这段随机数据
+        string run_id_;
+        string cookie_;
+        bool login_sent_ = false;
+        event_base *base_ = nullptr;
+        std::vector<Worker> workers_;
+        Phase phase_ = kSeed;
+        int active_ = 0;
+        int seed_left_ = 0;
+        uint64_t seq_ = 0;
+        uint64_t deadline_ = 0;
+        uint64_t errors_connect_ = 0;
+        std::vector<RemoteFile> pool_;  // 可供下载、删除的已上传文件
+        std::vector<string> cleanup_;
+        OpStats stats_[kOpCount];
+    };
+
+    // 等待服务端开始监听
+    bool WaitPort(const string &host, int port, int tries)
+    {
+        for (int i = 0; i < tries; i++)
+        {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+            bool ok = connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0;
+            close(fd);
+            if (ok) return true;
+            usleep(100 * 1000);
+        }
+        return false;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    signal(SIGPIPE, SIG_IGN);
+    bench::Profile profile;
+    string spawn, out;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--spawn" && i + 1 < argc) spawn = argv[++i];
+        else if (arg == "--out" && i + 1 < argc) out = argv[++i];
+        else if (!profile.Load(arg))
+        {
+            fprintf(stderr, "usage: %s [profile.json] [--spawn ./test] [--out result.json]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    pid_t server = -1;
+    if (!spawn.empty())
+    {
+        server = fork();
+        if (server == 0)
+        {
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            execl(spawn.c_str(), spawn.c_str(), (char *)nullptr);
+            _exit(127);
+        }
+    }
+    if (!bench::WaitPort(profile.host, profile.port, 100))
+    {
+        fprintf(stderr, "server %s:%d not reachable\n", profile.host.c_str(), profile.port);
+        if (server > 0) kill(server, SIGTERM);
+        return 1;
+    }
+
+    Json::Value result;
+    bool ok;
+    {
+        bench::Bench b(profile);
+        ok = b.Run(&result);
+    }
+    if (server > 0)
+    {
+        kill(server, SIGTERM);
+        waitpid(server, nullptr, 0);
+    }
+    if (!ok) return 1;
+
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "  ";
+    writer["precision"] = 6;
+    string text = Json::writeString(writer, result) + "\n";
+    if (out.empty()) fputs(text.c_str(), stdout);
+    else std::ofstream(out) << text;
+    return 0;
+}
@@ -0,0 +1,339 @@
+// 压缩、解压微基准
+// 用法: ./bench/compress_bench [--size MB] [--codec name] [--out result.json]
+//   在server目录下运行(需要../log_system/logs_code/config.conf)，
+//   --size   每类语料的大小，默认4MB
+//   --codec  只测指定的编解码器：fileutil、zlib、brotli
+// 生成五类语料：文本、日志、二进制程序、随机数据、已压缩数据，对每种编解码器、级别、缓冲区大小
+// 统计压缩和解压的MB/s、压缩率以及运行期间新增的峰值内存，结果以JSON输出。
+//   fileutil: 服务端deep存储实际使用的FileUtil::Compress/UnCompress(文件到文件，zlib流)，按缓冲区大小测试
+//   zlib/brotli: 内存中的一次性压缩，按分块大小测试(每块独立压缩，对应按分片压缩时的压缩率)
+// bundle.h中的编解码器缺少对应的实现文件，无法链接，故以系统自带的zlib和brotli代替
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+#include <brotli/decode.h>
+#include "../Config.hpp"
+#include "../../log_system/logs_code/ThreadPool.hpp"
+
+ThreadPool *tp = nullptr;
+
+namespace bench{
+    struct Corpus{
+        string name;
+        string data;
+    };
+
+    // 按Zipf分布从词表取词，近似自然语言文本
+    string GenText(size_t size, std::mt19937_64 &rng)
+    {
+        static const char *words[] = {"the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was",
+            "with", "be", "by", "on", "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have",
+            "an", "had", "they", "you", "were", "their", "one", "all", "we", "can", "her", "has", "there", "been",
+            "storage", "server", "file", "upload", "download", "compress", "network", "request", "client", "data"};
+        const size_t n = sizeof(words) / sizeof(words[0]);
+        std::vector<double> weights(n);
+        for (size_t i = 0; i < n; i++) weights[i] = 1.0 / (i + 1);
+        std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+        string out;
+        size_t sentence = 0;
+        while (out.size() < size)
+        {
+            out += words[pick(rng)];
+            out += ++sentence % 12 == 0 ? ".\n" : " ";
+        }
+        out.resize(size);
+        return out;
+    }
+
+    string GenLogs(size_t size, std::mt19937_64 &rng)
+    {
+        static const char *levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+        static const char *paths[] = {"/download/docs/report.pdf", "/upload", "/api/files", "/list", "/delete/tmp/a.bin", "/"};
+        string out;
+        char line[256];
+        long ts = 1700000000;
+        while (out.size() < size)
+        {
+            ts += rng() % 3;
+            snprintf(line, sizeof(line), "[%ld.%03d][%s][tid %d] get req, uri_path: %s from 10.0.%d.%d status=%d bytes=%d\n",
+                     ts, (int)(rng() % 1000), levels[rng() % 6], 4000 + (int)(rng() % 8), paths[rng() % 6],
+                     (int)(rng() % 4), (int)(rng() % 256), rng() % 10 ? 200 : 404, (int)(rng() % 100000));
+            out += line;
+        }
+        out.resize(size);
+        return out;
+    }
+
+    // 以本程序的可执行文件作为二进制样本
+    string GenBinary(size_t size)
+    {
+        std::ifstream in("/proc/self/exe", std::ios::binary);
+        string exe((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        string out;
+        while (out.size() < size) out += exe.empty() ? string(size, '\0') : exe;
+        out.resize(size);
+        return out;
+    }
+
+    string GenRandom(size_t size, std::mt19937_64 &rng)
+    {
+        string out(size, 0);
+        for (size_t i = 0; i + 8 <= size; i += 8)
+        {
+            uint64_t v = rng();
+            memcpy(&out[i], &v, 8);
+        }
+        return out;
+    }
+
+    // 已压缩的数据(近似图片、视频等媒体文件)：文本经zlib最高级别压缩后拼接
+    string GenCompressed(size_t size, std::mt19937_64 &rng)
+    {
+        string out;
+        while (out.size() < size)
+        {
+            string text = GenText(1 << 20, rng);
+            uLongf len = compressBound(text.size());
+            string z(len, 0);
+            compress2((Bytef *)&z[0], &len, (const Bytef *)text.data(), text.size(), 9);
+            out.append(z.data(), len);
+        }
+        out.resize(size);
+        return out;
+    }
+
+    struct Result{
+        bool ok = false;
+        uint64_t output_bytes = 0;
+        double compress_sec = 0;
+        double decompress_sec = 0;
+        long peak_rss_kb = 0;
+    };
+
+    long ReadStatusKb(const char *key)
+    {
+        std::ifstream in("/proc/self/status");
+        string line;
+        while (std::getline(in, line))
+            if (line.compare(0, strlen(key), key) == 0) return atol(line.c_str() + strlen(key) + 1);
+        return 0;
+    }
+
+    double Seconds(std::chrono::steady_clock::time_point since)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+    }
+
+    // 在子进程中执行一次测试，以便单独统计该次运行新增的峰值内存
+    Result RunIsolated(const std::function<Result()> &f)
+    {
+        int fds[2];
+        Result r;
+        if (pipe(fds) != 0) return r;
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            std::ofstream("/proc/self/clear_refs") << "5";     // 重置VmHWM
+            long base = ReadStatusKb("VmRSS:");
+            Result res = f();
+            res.peak_rss_kb = std::max(0L, ReadStatusKb("VmHWM:") - base);
+            ssize_t n = write(fds[1], &res, sizeof(res));
+            (void)n;
+            _exit(0);
+        }
+        close(fds[1]);
+        if (read(fds[0], &r, sizeof(r)) != sizeof(r)) r = Result();
+        close(fds[0]);
+        waitpid(pid, nullptr, 0);
+        return r;
+    }
+
+    // FileUtil文件到文件的流式压缩，缓冲区大小为buffer
+    Result FileUtilCase(const Corpus &c, int level, size_t buffer)
+    {
+        Result r;
+        string src = "./temporary_files/compress_bench_" + std::to_string(getpid());
+        string packed = src + ".z", unpacked = src + ".out";
+        std::ofstream(src, std::ios::binary).write(c.data.data(), c.data.size());
+
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = storage::FileUtil(packed).Compress(src, level, buffer);
+        r.compress_sec = Seconds(t0);
+        r.output_bytes = storage::FileUtil(packed).FileSize();
+
+        t0 = std::chrono::steady_clock::now();
+        ok = ok && storage::FileUtil(packed).UnCompress(unpacked, buffer);
+        r.decompress_sec = Seconds(t0);
+
+        string back;
+        storage::FileUtil(unpacked).GetContent(&back);
+        r.ok = ok && back == c.data;
+        remove(src.c_str());
+        remove(packed.c_str());
+        remove(unpacked.c_str());
+        return r;
+    }
+
+    // 内存中按block大小分块独立压缩，block为0表示整体压缩
+    Result BlockCase(const Corpus &c, size_t block,
+                     const std::function<bool(const char *, size_t, string *)> &enc,
+                     const std::function<bool(const string &, size_t, string *)> &dec)
+    {
+        Result r;
+        size_t step = block ? block : c.data.size();
+        std::vector<string> packed;
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = true;
+        for (size_t off = 0; off < c.data.size() && ok; off += step)
+        {
+            packed.emplace_back();
+            ok = enc(c.data.data() + off, std::min(step, c.data.size() - off), &packed.back());
+            r.output_bytes += packed.back().size();
+        }
+        r.compress_sec = Seconds(t0);
+
+        string back;
+        back.reserve(c.data.size());
+        t0 = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < packed.size() && ok; i++)
+            ok = dec(packed[i], std::min(step, c.data.size() - i * step), &back);
+        r.decompress_sec = Seconds(t0);
+        r.ok = ok && back == c.data;
+        return r;
+    }
+
+    bool ZlibEncode(int level, const char *p, size_t n, string *out)
+    {
+        uLongf len = compressBound(n);
+        out->resize(len);
+        if (compress2((Bytef *)&(*out)[0], &len, (const Bytef *)p, n, level) != Z_OK) return false;
+        out->resize(len);
+        return true;
+    }
+
+    bool ZlibDecode(const string &in, size_t raw, string *out)
+    {
+        size_t pos = out->size();
+        out->resize(pos + raw);
+        uLongf len = raw;
+        return uncompress((Bytef *)&(*out)[pos], &len, (const Bytef *)in.data(), in.size()) == Z_OK && len == raw;
+    }
+
+    bool BrotliEncode(int quality, const char *p, size_t n, string *out)
+    {
+        size_t len = BrotliEncoderMaxCompressedSize(n);
+        out->resize(len);
+        if (!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, n,
+                                   (const uint8_t *)p, &len, (uint8_t *)&(*out)[0])) return false;
+        out->resize(len);
+        return true;
+    }
+
+    bool BrotliDecode(const string &in, size_t raw, string *out)
+    {
+        size_t pos = out->size();
+        out->resize(pos + raw);
+        size_t len = raw;
+        return BrotliDecoderDecompress(in.size(), (const uint8_t *)in.data(), &len, (uint8_t *)&(*out)[pos]) == BROTLI_DECODER_RESULT_SUCCESS
+               && len == raw;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size_mb = 4;
+    string only, out;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        string arg = argv[i];
+        if (arg == "--size") size_mb = std::max(1, atoi(argv[i + 1]));
+        else if (arg == "--codec") only = argv[i + 1];
+        else if (arg == "--out") out = argv[i + 1];
+    }
+    if (argc % 2 == 0)
+    {
+        fprintf(stderr, "usage: %s [--size MB] [--codec fileutil|zlib|brotli] [--out result.json]\n", argv[0]);
+        return 1;
+    }
+
+    tp = new ThreadPool(1);
+    std::shared_ptr<mylog::LoggerBuilder> Glb(new mylog::LoggerBuilder());
+    Glb->BuildLoggerName("asynclogger");
+    Glb->BuildLoggerFlush<mylog::RollFileFlush>("./logfile/compress_bench_log", 1024 * 1024);
+    mylog::LoggerManager::GetInstance().AddLogger(Glb->Build());
+    storage::FileUtil("./temporary_files/").CreateDirectory();
+
+    size_t size = size_mb << 20;
+    std::mt19937_64 rng(42);
+    std::vector<bench::Corpus> corpora = {
+        {"text", bench::GenText(size, rng)},
+        {"logs", bench::GenLogs(size, rng)},
+        {"binary", bench::GenBinary(size)},
+        {"random", bench::GenRandom(size, rng)},
+        {"compressed", bench::GenCompressed(size, rng)},
+    };
+
+    Json::Value results(Json::arrayValue);
+    auto emit = [&](const bench::Corpus &c, const string &codec, int level, size_t buffer, const bench::Result &r){
+        Json::Value v;
+        v["corpus"] = c.name;
+        v["codec"] = codec;
+        v["level"] = level;
+        v["buffer"] = (Json::UInt64)buffer;
+        v["ok"] = r.ok;
+        v["input_bytes"] = (Json::UInt64)c.data.size();
+        v["output_bytes"] = (Json::UInt64)r.output_bytes;
+        v["ratio"] = r.output_bytes ? (double)c.data.size() / r.output_bytes : 0;
+        v["compress_mb_per_sec"] = r.compress_sec > 0 ? c.data.size() / r.compress_sec / (1 << 20) : 0;
+        v["decompress_mb_per_sec"] = r.decompress_sec > 0 ? c.data.size() / r.decompress_sec / (1 << 20) : 0;
+        v["peak_rss_kb"] = (Json::Int64)r.peak_rss_kb;
+        results.append(v);
+        fprintf(stderr, "%-10s %-8s level=%-2d buffer=%-8zu ratio=%.2f comp=%.1fMB/s decomp=%.1fMB/s rss=%ldKB%s\n",
+                c.name.c_str(), codec.c_str(), level, buffer, v["ratio"].asDouble(), v["compress_mb_per_sec"].asDouble(),
+                v["decompress_mb_per_sec"].asDouble(), r.peak_rss_kb, r.ok ? "" : " FAILED");
+    };
+
+    for (auto &c : corpora)
+    {
+        if (only.empty() || only == "fileutil")
+            for (int level : {1, Z_DEFAULT_COMPRESSION, 9})
+                for (size_t buffer : {4096, 16384, 65536, 262144})
+                    emit(c, "fileutil", level, buffer, bench::RunIsolated([&]{ return bench::FileUtilCase(c, level, buffer); }));
+
+        // buffer为0表示整体压缩
+        if (only.empty() || only == "zlib")
+            for (int level : {1, 6, 9})
+                for (size_t block : {65536, 1 << 20, 0})
+                    emit(c, "zlib", level, block, bench::RunIsolated([&]{
+                        return bench::BlockCase(c, block,
+                            [&](const char *p, size_t n, string *o){ return bench::ZlibEncode(level, p, n, o); }, bench::ZlibDecode);
+                    }));
+
+        if (only.empty() || only == "brotli")
+            for (int quality : {1, 5, 9})
+                for (size_t block : {65536, 1 << 20, 0})
+                    emit(c, "brotli", quality, block, bench::RunIsolated([&]{
+                        return bench::BlockCase(c, block,
+                            [&](const char *p, size_t n, string *o){ return bench::BrotliEncode(quality, p, n, o); }, bench::BrotliDecode);
+                    }));
+    }
+
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "  ";
+    writer["precision"] = 6;
+    string text = Json::writeString(writer, results) + "\n";
+    if (out.empty()) fputs(text.c_str(), stdout);
+    else std::ofstream(out) << text;
+    delete tp;
+    return 0;
+}
@@ -0,0 +1,138 @@
+// 纠删码编解码微基准
+// 用法: ./bench/erasure_bench [--size MB] [--kernel name] [--out result.json]
+//   --size    每次编码的原数据大小，默认64MB
+//   --kernel  只测指定的GF(2^8)乘加实现：avx2、ssse3、scalar(CPU不支持的实现自动跳过)
+// 对每种实现和(k, m)组合，统计编码和丢失m个数据分片时恢复的MB/s(按原数据大小计)，
+// 并与scalar实现的结果逐字节比较，结果以JSON输出。编码速度应高于上传带宽，否则上传会在编码队列中积压
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <fstream>
+#include <jsoncpp/json/json.h>
+#include "../ErasureCode.hpp"
+
+using std::string;
+
+namespace bench{
+    struct Result{
+        bool ok = false;
+        double encode_sec = 0;
+        double decode_sec = 0;
+    };
+
+    double Seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // 数据分为k个分片，编码出m个校验分片；再去掉前m个数据分片，由其余k个分片恢复。
+    // expect非空时比较校验分片是否与之相同
+    Result Run(const string &data, int k, int m, std::vector<string> *parity_out, const std::vector<string> *expect)
+    {
+        Result r;
+        storage::ReedSolomon rs(k, m);
+        size_t frag = (data.size() + k - 1) / k;
+        std::vector<string> shards(k + m, string(frag, '\0'));
+        for (int i = 0; i < k; i++)
+            memcpy(&shards[i][0], data.data() + i * frag, std::min(frag, data.size() - std::min(data.size(), i * frag)));
+        std::vector<const uint8_t *> in(k);
+        std::vector<uint8_t *> out(m);
+        for (int i = 0; i < k; i++) in[i] = (const uint8_t *)shards[i].data();
+        for (int i = 0; i < m; i++) out[i] = (uint8_t *)&shards[k + i][0];
+
+        auto start = std::chrono::steady_clock::now();
+        rs.Encode(in.data(), out.data(), frag);
+        r.encode_sec = Seconds(start);
+
+        int lost = std::min(k, m);
+        std::vector<int> have, want;
+        std::vector<const uint8_t *> have_ptr;
+        for (int i = lost; i < k + m && (int)have.size() < k; i++)
+        {
+            have.push_back(i);
+            have_ptr.push_back((const uint8_t *)shards[i].data());
+        }
+        std::vector<string> rebuilt(lost, string(frag, '\0'));
+        std::vector<uint8_t *> rebuilt_ptr;
+        for (int i = 0; i < lost; i++)
+        {
+            want.push_back(i);
+            rebuilt_ptr.push_back((uint8_t *)&rebuilt[i][0]);
+        }
+        start = std::chrono::steady_clock::now();
+        bool decoded = rs.Reconstruct(have.data(), have_ptr.data(), want.data(), rebuilt_ptr.data(), lost, frag);
+        r.decode_sec = Seconds(start);
+
+        r.ok = decoded;
+        for (int i = 0; i < lost && r.ok; i++) r.ok = rebuilt[i] == shards[i];
+        for (int i = 0; i < m && r.ok && expect; i++) r.ok = (*expect)[i] == shards[k + i];
+        if (parity_out) parity_out->assign(shards.begin() + k, shards.end());
+        return r;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size_mb = 64;
+    string only, out;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        string arg = argv[i];
+        if (arg == "--size") size_mb = std::max(1, atoi(argv[i + 1]));
+        else if (arg == "--kernel") only = argv[i + 1];
+        else if (arg == "--out") out = argv[i + 1];
+    }
+    if (argc % 2 == 0)
+    {
+        fprintf(stderr, "usage: %s [--size MB] [--kernel avx2|ssse3|scalar] [--out result.json]\n", argv[0]);
+        return 1;
+    }
+
+    string data(size_mb << 20, '\0');
+    std::mt19937_64 rng(42);
+    for (size_t i = 0; i + 8 <= data.size(); i += 8)
+    {
+        uint64_t v = rng();
+        memcpy(&data[i], &v, 8);
+    }
+
+    const std::pair<int, int> schemes[] = {{4, 2}, {6, 3}, {10, 4}, {12, 4}};
+    Json::Value results(Json::arrayValue);
+    for (auto &scheme : schemes)
+    {
+        // scalar的结果作为其他实现的参照
+        std::vector<string> reference;
+        storage::GF256::SetKernel("scalar");
+        bench::Run(data.substr(0, std::min<size_t>(data.size(), 4 << 20)), scheme.first, scheme.second, &reference, nullptr);
+
+        for (const char *kernel : {"avx2", "ssse3", "scalar"})
+        {
+            if (!only.empty() && only != kernel) continue;
+            if (!storage::GF256::SetKernel(kernel)) continue;
+            bench::Result check = bench::Run(data.substr(0, std::min<size_t>(data.size(), 4 << 20)), scheme.first, scheme.second, nullptr, &reference);
+            bench::Result r = bench::Run(data, scheme.first, scheme.second, nullptr, nullptr);
+            Json::Value v;
+            v["kernel"] = kernel;
+            v["k"] = scheme.first;
+            v["m"] = scheme.second;
+            v["ok"] = check.ok && r.ok;
+            v["input_bytes"] = (Json::UInt64)data.size();
+            v["encode_mb_per_sec"] = r.encode_sec > 0 ? data.size() / r.encode_sec / (1 << 20) : 0;
+            v["decode_mb_per_sec"] = r.decode_sec > 0 ? data.size() / r.decode_sec / (1 << 20) : 0;
+            results.append(v);
+            fprintf(stderr, "%-6s k=%-2d m=%-2d encode=%.1fMB/s decode=%.1fMB/s%s\n", kernel, scheme.first, scheme.second,
+                    v["encode_mb_per_sec"].asDouble(), v["decode_mb_per_sec"].asDouble(), v["ok"].asBool() ? "" : " FAILED");
+        }
+    }
+
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "  ";
+    writer["precision"] = 6;
+    string text = Json::writeString(writer, results) + "\n";
+    if (out.empty()) fputs(text.c_str(), stdout);
+    else std::ofstream(out) << text;
+    return 0;
+}